@@ -74,8 +74,20 @@ struct SQOuter;
 #define SQ_VMSTATE_RUNNING      1
 #define SQ_VMSTATE_SUSPENDED    2
 
+#define SQ_GCPHASE_IDLE         0
+#define SQ_GCPHASE_MARK         1
+
+#define SQ_GCEVENT_BEGIN        0
+#define SQ_GCEVENT_END          1
+
+#define SQ_GCKIND_FULL          0
+#define SQ_GCKIND_YOUNG         1
+#define SQ_GCKIND_CYCLE         2
+
 #define SQUIRREL_EOB 0
 #define SQ_BYTECODE_STREAM_TAG  0xFAFA
+#define SQ_HEAPSNAPSHOT_TAG     0x53514850
+#define SQ_HEAPSNAPSHOT_VERSION 1
 
 #define SQOBJECT_REF_COUNTED    0x08000000
 #define SQOBJECT_NUMERIC        0x04000000
@@ -154,11 +166,32 @@ typedef union tagSQObjectValue
 }SQObjectValue;
 
 
+#ifdef SQ_NANBOXING
+#if !defined(_SQ64) || !defined(SQUSEDOUBLE)
+#error SQ_NANBOXING requires a 64 bits build with SQUSEDOUBLE
+#endif
+/* the whole object is a double; any other type is stored in the payload of a negative quiet NaN
+   [sign(1)][exponent(11, all ones)][tag(5)][payload(47)] */
+typedef struct tagSQObject
+{
+    SQRawObjectVal _val;
+}SQObject;
+
+SQUIRREL_API const SQObjectType sq_nbtypes[33];
+
+/* (val >> 47) is below 0x1FFE0 for every double but -inf, they all read the last entry */
+static inline SQObjectType sq_nbtype(SQRawObjectVal val)
+{
+    SQRawObjectVal tag = (val >> 47) - 0x1FFE0;
+    return sq_nbtypes[tag < 32 ? tag : 32];
+}
+#else
 typedef struct tagSQObject
 {
     SQObjectType _type;
     SQObjectValue _unVal;
 }SQObject;
+#endif
 
 typedef struct  tagSQMemberHandle{
     SQBool _static;
@@ -179,6 +212,8 @@ typedef SQInteger (*SQRELEASEHOOK)(SQUserPointer,SQInteger size);
 typedef void (*SQCOMPILERERROR)(HSQUIRRELVM,const SQChar * /*desc*/,const SQChar * /*source*/,SQInteger /*line*/,SQInteger /*column*/);
 typedef void (*SQPRINTFUNCTION)(HSQUIRRELVM,const SQChar * ,...);
 typedef void (*SQDEBUGHOOK)(HSQUIRRELVM /*v*/, SQInteger /*type*/, const SQChar * /*sourcename*/, SQInteger /*line*/, const SQChar * /*funcname*/);
+typedef void (*SQMEMLIMITHOOK)(HSQUIRRELVM /*v*/, SQInteger /*allocated*/, SQInteger /*hardlimit*/);
+typedef void (*SQGCHOOK)(HSQUIRRELVM /*v*/, SQInteger /*event*/, SQInteger /*kind*/, SQInteger /*collected*/);
 typedef SQInteger (*SQWRITEFUNC)(SQUserPointer,SQUserPointer,SQInteger);
 typedef SQInteger (*SQREADFUNC)(SQUserPointer,SQUserPointer,SQInteger);
 
@@ -198,6 +233,45 @@ typedef struct tagSQFunctionInfo {
     SQInteger line;
 }SQFunctionInfo;
 
+typedef struct tagSQGCProgress {
+    SQInteger phase;
+    SQInteger marked;
+    SQInteger estimate;
+    SQInteger collected;
+}SQGCProgress;
+
+typedef struct tagSQMemPoolStats {
+    SQInteger arenas;
+    SQInteger arenabytes;
+    SQInteger pages;
+    SQInteger blocks;
+    SQInteger blockbytes;
+    SQInteger allocs;
+}SQMemPoolStats;
+
+typedef struct tagSQTypeStats {
+    SQObjectType type;
+    SQInteger objects;
+    SQInteger bytes;
+}SQTypeStats;
+
+#define SQ_HEAPSTATS_NTYPES 13
+
+typedef struct tagSQHeapStats {
+    SQTypeStats types[SQ_HEAPSTATS_NTYPES];
+    SQInteger stringslots;
+    SQInteger stringsused;
+    SQInteger refslots;
+    SQInteger refsused;
+    SQInteger fullcollections;
+    SQInteger youngcollections;
+    SQInteger cycles;
+    SQInteger marktime;
+    SQInteger sweeptime;
+    SQInteger youngtime;
+    SQInteger cycletime;
+}SQHeapStats;
+
 /*vm*/
 SQUIRREL_API HSQUIRRELVM sq_open(SQInteger initialstacksize);
 SQUIRREL_API HSQUIRRELVM sq_newthread(HSQUIRRELVM friendvm, SQInteger initialstacksize);
@@ -353,6 +427,15 @@ SQUIRREL_API SQUnsignedInteger sq_getvmrefcount(HSQUIRRELVM v, const HSQOBJECT *
 /*GC*/
 SQUIRREL_API SQInteger sq_collectgarbage(HSQUIRRELVM v);
 SQUIRREL_API SQRESULT sq_resurrectunreachable(HSQUIRRELVM v);
+SQUIRREL_API SQInteger sq_collectyoung(HSQUIRRELVM v);
+SQUIRREL_API SQInteger sq_gcstep(HSQUIRRELVM v,SQInteger budget_us);
+SQUIRREL_API SQRESULT sq_getgcprogress(HSQUIRRELVM v,SQGCProgress *p);
+SQUIRREL_API void sq_enableautogc(HSQUIRRELVM v,SQBool enable);
+SQUIRREL_API SQRESULT sq_setgcparams(HSQUIRRELVM v,SQInteger pause,SQInteger stepmul);
+SQUIRREL_API SQRESULT sq_setgcthreads(HSQUIRRELVM v,SQInteger nthreads);
+SQUIRREL_API SQRESULT sq_getheapstats(HSQUIRRELVM v,SQHeapStats *s);
+SQUIRREL_API void sq_setgchook(HSQUIRRELVM v,SQGCHOOK hook);
+SQUIRREL_API SQRESULT sq_writeheapsnapshot(HSQUIRRELVM v,SQWRITEFUNC writef,SQUserPointer up);
 
 /*serialization*/
 SQUIRREL_API SQRESULT sq_writeclosure(HSQUIRRELVM vm,SQWRITEFUNC writef,SQUserPointer up);
@@ -362,6 +445,11 @@ SQUIRREL_API SQRESULT sq_readclosure(HSQUIRRELVM vm,SQREADFUNC readf,SQUserPoint
 SQUIRREL_API void *sq_malloc(SQUnsignedInteger size);
 SQUIRREL_API void *sq_realloc(void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize);
 SQUIRREL_API void sq_free(void *p,SQUnsignedInteger size);
+SQUIRREL_API SQRESULT sq_getmempoolstats(HSQUIRRELVM v,SQMemPoolStats *s);
+SQUIRREL_API SQInteger sq_getmemusage(HSQUIRRELVM v);
+SQUIRREL_API SQRESULT sq_setmemlimits(HSQUIRRELVM v,SQInteger softlimit,SQInteger hardlimit);
+SQUIRREL_API void sq_setmemlimithook(HSQUIRRELVM v,SQMEMLIMITHOOK hook);
+SQUIRREL_API void sq_setinternlimit(HSQUIRRELVM v,SQInteger maxlen);
 
 /*debug*/
 SQUIRREL_API SQRESULT sq_stackinfos(HSQUIRRELVM v,SQInteger level,SQStackInfos *si);
@@ -369,25 +457,29 @@ SQUIRREL_API void sq_setdebughook(HSQUIRRELVM v);
 SQUIRREL_API void sq_setnativedebughook(HSQUIRRELVM v,SQDEBUGHOOK hook);
 
 /*UTILITY MACRO*/
-#define sq_isnumeric(o) ((o)._type&SQOBJECT_NUMERIC)
-#define sq_istable(o) ((o)._type==OT_TABLE)
-#define sq_isarray(o) ((o)._type==OT_ARRAY)
-#define sq_isfunction(o) ((o)._type==OT_FUNCPROTO)
-#define sq_isclosure(o) ((o)._type==OT_CLOSURE)
-#define sq_isgenerator(o) ((o)._type==OT_GENERATOR)
-#define sq_isnativeclosure(o) ((o)._type==OT_NATIVECLOSURE)
-#define sq_isstring(o) ((o)._type==OT_STRING)
-#define sq_isinteger(o) ((o)._type==OT_INTEGER)
-#define sq_isfloat(o) ((o)._type==OT_FLOAT)
-#define sq_isuserpointer(o) ((o)._type==OT_USERPOINTER)
-#define sq_isuserdata(o) ((o)._type==OT_USERDATA)
-#define sq_isthread(o) ((o)._type==OT_THREAD)
-#define sq_isnull(o) ((o)._type==OT_NULL)
-#define sq_isclass(o) ((o)._type==OT_CLASS)
-#define sq_isinstance(o) ((o)._type==OT_INSTANCE)
-#define sq_isbool(o) ((o)._type==OT_BOOL)
-#define sq_isweakref(o) ((o)._type==OT_WEAKREF)
+#define sq_isnumeric(o) (sq_type(o)&SQOBJECT_NUMERIC)
+#define sq_istable(o) (sq_type(o)==OT_TABLE)
+#define sq_isarray(o) (sq_type(o)==OT_ARRAY)
+#define sq_isfunction(o) (sq_type(o)==OT_FUNCPROTO)
+#define sq_isclosure(o) (sq_type(o)==OT_CLOSURE)
+#define sq_isgenerator(o) (sq_type(o)==OT_GENERATOR)
+#define sq_isnativeclosure(o) (sq_type(o)==OT_NATIVECLOSURE)
+#define sq_isstring(o) (sq_type(o)==OT_STRING)
+#define sq_isinteger(o) (sq_type(o)==OT_INTEGER)
+#define sq_isfloat(o) (sq_type(o)==OT_FLOAT)
+#define sq_isuserpointer(o) (sq_type(o)==OT_USERPOINTER)
+#define sq_isuserdata(o) (sq_type(o)==OT_USERDATA)
+#define sq_isthread(o) (sq_type(o)==OT_THREAD)
+#define sq_isnull(o) (sq_type(o)==OT_NULL)
+#define sq_isclass(o) (sq_type(o)==OT_CLASS)
+#define sq_isinstance(o) (sq_type(o)==OT_INSTANCE)
+#define sq_isbool(o) (sq_type(o)==OT_BOOL)
+#define sq_isweakref(o) (sq_type(o)==OT_WEAKREF)
+#ifdef SQ_NANBOXING
+#define sq_type(o) sq_nbtype((o)._val)
+#else
 #define sq_type(o) ((o)._type)
+#endif
 
 /* deprecated */
 #define sq_createslot(v,n) sq_newslot(v,n,SQFalse)
@@ -0,0 +1,47 @@
+/*
+* allocation throughput and fragmentation of the small objects
+* run it with a build configured with -DSQ_MEMORY_POOL=OFF to compare with the system allocator
+*/
+
+class Point {
+    x = 0;
+    y = 0;
+    constructor(_x, _y) { x = _x; y = _y; }
+}
+
+local n = vargv.len() != 0 ? vargv[0].tointeger() : 200000;
+
+function report(name, start, nobjects)
+{
+    local t = clock() - start;
+    local rate = t > 0 ? (nobjects / t / 1000).tointeger() + "K objects/s" : "-";
+    print(name + ": " + t + "s " + rate + "\n");
+}
+
+//short lived objects of every kind, freed as soon as they are created
+local start = clock();
+for(local i = 0; i < n; i++) {
+    local t = { a = i, b = i + 1 };
+    local a = [i, i, i];
+    local p = Point(i, i);
+    local f = function() { return t; };
+    local s = "key" + (i % 1000);
+}
+report("churn", start, n * 5);
+
+//objects with mixed lifetimes: a window of live ones, most of which die afterwards
+start = clock();
+local live = array(n);
+for(local i = 0; i < n; i++) {
+    live[i] = (i % 3 == 0) ? { v = i } : (i % 3 == 1) ? [i, i] : Point(i, i);
+    if(i >= 1000 && i % 7 != 0) live[i - 1000] = null;
+}
+report("window", start, n);
+
+if("mempoolstats" in getroottable()) {
+    local s = mempoolstats();
+    print("pool: " + s.arenas + " arenas " + s.arenabytes + " bytes, " + s.pages + " pages, "
+        + s.blocks + " blocks " + s.blockbytes + " bytes in use\n");
+    if(s.arenabytes > 0)
+        print("pool: " + (100 - s.blockbytes * 100 / s.arenabytes) + "% of the arenas unused\n");
+}
@@ -0,0 +1,65 @@
+/*
+* scaling of the full collections with the number of threads marking the heap
+* run it with a build configured with -DSQ_PARALLEL_MARK=ON, the argument is the number of objects
+* clock() counts the time of all the threads, so the wall time is measured with time() over a few seconds
+*/
+
+class Vec {
+    x = 0;
+    y = 0;
+    next = null;
+    constructor(_x, _y) { x = _x; y = _y; }
+}
+
+function gen(n) { for(local i = 0; i < n; i++) yield i; }
+
+local n = vargv.len() != 0 ? vargv[0].tointeger() : 5000000;
+local seconds = vargv.len() > 1 ? vargv[1].tointeger() : 5;
+
+//a synthetic heap of about n objects: tables, arrays, instances, closures and generators
+print("building a heap of " + n + " objects\n");
+local heap = array(n / 64 + 1);
+foreach(i, v in heap) heap[i] = [];
+for(local i = 0; i * 7 < n; i++) {
+    local t = { a = i, b = [i, i + 1] };
+    local p = Vec(i, i);
+    p.next = Vec(i + 1, i);
+    t.p <- p;
+    t.f <- function() { return t; };
+    t.g <- gen(3);
+    heap[i % heap.len()].append(t);
+}
+//some garbage cycles for the sweep
+for(local i = 0; i < n / 100; i++) { local c = {}; c.self <- c; }
+
+//collections per second of wall time
+function measure(seconds)
+{
+    local start = time();
+    while(time() == start) {}
+    start = time();
+    local cpu = clock();
+    local count = 0;
+    while(time() - start < seconds) {
+        collectgarbage();
+        count++;
+    }
+    local elapsed = time() - start;
+    return { ms = elapsed * 1000.0 / count, cpums = (clock() - cpu) * 1000 / count };
+}
+
+print("collectgarbage: " + collectgarbage() + " cycles\n");
+if(!("setgcthreads" in getroottable())) {
+    local m = measure(seconds);
+    print(m.ms + "ms per collection(no parallel mark in this build)\n");
+    return;
+}
+
+local single = 0;
+foreach(threads in [1, 2, 4, 8, 16]) {
+    setgcthreads(threads);
+    local m = measure(seconds);
+    if(threads == 1) single = m.ms;
+    print(threads + " threads: " + m.ms + "ms per collection, x" + (single / m.ms) + ", cpu " + m.cpums + "ms\n");
+}
+setgcthreads(1);
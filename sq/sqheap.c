@@ -0,0 +1,434 @@
+/*
+    see copyright notice in squirrel.h
+*/
+/*
+    offline analyzer of the heap snapshots written by sq_writeheapsnapshot():
+    computes the dominator tree of the objects(Lengauer and Tarjan) and the size each
+    object retains, the memory that would be freed with it, then reports the biggest retainers.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <squirrel.h>
+
+typedef struct tagHeap {
+    int nnodes;
+    int nnames;
+    char **names;
+    unsigned int *type;
+    long long *size;
+    int *name;
+    /* the successors of node i are edges[edgestart[i]..edgestart[i+1]), node nnodes is the virtual root */
+    int *edgestart;
+    int *edges;
+    long long strings;
+    long long stringbytes;
+} Heap;
+
+typedef struct tagReader {
+    FILE *f;
+    unsigned int intsize;
+    unsigned int charsize;
+    int ok;
+} Reader;
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+    if(!p) {
+        fprintf(stderr,"sqheap: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static unsigned int read_u32(Reader *r)
+{
+    unsigned int v = 0;
+    if(fread(&v,sizeof(v),1,r->f) != 1) r->ok = 0;
+    return v;
+}
+
+static long long read_int(Reader *r)
+{
+    if(r->intsize == 8) {
+        long long v = 0;
+        if(fread(&v,sizeof(v),1,r->f) != 1) r->ok = 0;
+        return v;
+    }
+    else {
+        int v = 0;
+        if(fread(&v,sizeof(v),1,r->f) != 1) r->ok = 0;
+        return v;
+    }
+}
+
+/* the names are written with the SQChar of the VM, anything past ASCII becomes '?' */
+static char *read_name(Reader *r)
+{
+    long long len = read_int(r);
+    if(!r->ok || len < 0) {
+        r->ok = 0;
+        return NULL;
+    }
+    char *s = (char *)xmalloc((size_t)len + 1);
+    for(long long i = 0; i < len; i++) {
+        unsigned int c = 0;
+        if(fread(&c,r->charsize,1,r->f) != 1) r->ok = 0;
+        s[i] = (char)(c < 128 ? c : '?');
+    }
+    s[len] = 0;
+    return s;
+}
+
+static int load_heap(const char *path,Heap *h)
+{
+    Reader r;
+    memset(h,0,sizeof(Heap));
+    r.f = fopen(path,"rb");
+    r.ok = 1;
+    if(!r.f) {
+        fprintf(stderr,"sqheap: cannot open %s\n",path);
+        return 0;
+    }
+    if(read_u32(&r) != SQ_HEAPSNAPSHOT_TAG || read_u32(&r) != SQ_HEAPSNAPSHOT_VERSION) {
+        fprintf(stderr,"sqheap: %s is not a heap snapshot\n",path);
+        fclose(r.f);
+        return 0;
+    }
+    r.intsize = read_u32(&r);
+    r.charsize = read_u32(&r);
+    if((r.intsize != 4 && r.intsize != 8) || r.charsize < 1 || r.charsize > 4) r.ok = 0;
+
+    h->nnames = r.ok ? (int)read_int(&r) : 0;
+    if(h->nnames < 0) r.ok = 0, h->nnames = 0;
+    h->names = (char **)xmalloc(sizeof(char *) * h->nnames);
+    memset(h->names,0,sizeof(char *) * h->nnames);
+    for(int i = 0; i < h->nnames && r.ok; i++) h->names[i] = read_name(&r);
+
+    h->nnodes = r.ok ? (int)read_int(&r) : 0;
+    if(h->nnodes < 0) r.ok = 0, h->nnodes = 0;
+    int n = h->nnodes;
+    h->type = (unsigned int *)xmalloc(sizeof(unsigned int) * n);
+    h->size = (long long *)xmalloc(sizeof(long long) * n);
+    h->name = (int *)xmalloc(sizeof(int) * n);
+    h->edgestart = (int *)xmalloc(sizeof(int) * (n + 2));
+    size_t cap = (size_t)n * 2 + 16, nedges = 0;
+    h->edges = (int *)xmalloc(sizeof(int) * cap);
+    for(int i = 0; i <= n && r.ok; i++) {
+        long long count;
+        if(i < n) {
+            h->type[i] = (unsigned int)read_int(&r);
+            h->size[i] = read_int(&r);
+            h->name[i] = (int)read_int(&r);
+            if(h->name[i] >= h->nnames) h->name[i] = -1;
+        }
+        /* the roots are the successors of the virtual root */
+        count = read_int(&r);
+        h->edgestart[i] = (int)nedges;
+        if(!r.ok || count < 0) break;
+        if(nedges + (size_t)count > cap) {
+            while(nedges + (size_t)count > cap) cap *= 2;
+            h->edges = (int *)realloc(h->edges,sizeof(int) * cap);
+            if(!h->edges) {
+                fprintf(stderr,"sqheap: out of memory\n");
+                exit(1);
+            }
+        }
+        for(long long k = 0; k < count; k++) {
+            long long e = read_int(&r);
+            if(e >= 0 && e < n) h->edges[nedges++] = (int)e;
+        }
+    }
+    h->edgestart[n + 1] = (int)nedges;
+    h->strings = read_int(&r);
+    h->stringbytes = read_int(&r);
+    fclose(r.f);
+    if(!r.ok) {
+        fprintf(stderr,"sqheap: %s is truncated\n",path);
+        return 0;
+    }
+    return 1;
+}
+
+static void free_heap(Heap *h)
+{
+    for(int i = 0; i < h->nnames; i++) free(h->names[i]);
+    free(h->names);
+    free(h->type);
+    free(h->size);
+    free(h->name);
+    free(h->edgestart);
+    free(h->edges);
+}
+
+static const unsigned int g_types[] = { OT_TABLE, OT_ARRAY, OT_USERDATA, OT_CLOSURE, OT_NATIVECLOSURE,
+    OT_GENERATOR, OT_THREAD, OT_FUNCPROTO, OT_CLASS, OT_INSTANCE, OT_OUTER };
+#define NTYPES ((int)(sizeof(g_types) / sizeof(g_types[0])))
+
+/* position of the type in g_types, NTYPES if it isn't a collectable */
+static int type_slot(unsigned int type)
+{
+    int t = 0;
+    while(t < NTYPES && g_types[t] != type) t++;
+    return t;
+}
+
+static const char *type_name(unsigned int type)
+{
+    switch(_RAW_TYPE(type)) {
+    case _RT_TABLE: return "table";
+    case _RT_ARRAY: return "array";
+    case _RT_USERDATA: return "userdata";
+    case _RT_CLOSURE: return "closure";
+    case _RT_NATIVECLOSURE: return "nativeclosure";
+    case _RT_GENERATOR: return "generator";
+    case _RT_THREAD: return "thread";
+    case _RT_FUNCPROTO: return "funcproto";
+    case _RT_CLASS: return "class";
+    case _RT_INSTANCE: return "instance";
+    case _RT_OUTER: return "outer";
+    default: return "?";
+    }
+}
+
+static void node_label(Heap *h,int i,char *buf,size_t size)
+{
+    if(i == h->nnodes) snprintf(buf,size,"(roots)");
+    else if(h->name[i] >= 0) snprintf(buf,size,"%s %s #%d",type_name(h->type[i]),h->names[h->name[i]],i);
+    else snprintf(buf,size,"%s #%d",type_name(h->type[i]),i);
+}
+
+/*
+    Lengauer-Tarjan with path compression, iterative.
+    semi[] holds the dfs numbers, idom[] the immediate dominators as nodes, -1 if unreachable.
+*/
+static int *dominators(Heap *h,int **order,int *nreached)
+{
+    int n = h->nnodes + 1, root = h->nnodes;
+    int *predstart = (int *)xmalloc(sizeof(int) * (n + 1));
+    int *preds = (int *)xmalloc(sizeof(int) * ((size_t)h->edgestart[n] + 1));
+    int *dfnum = (int *)xmalloc(sizeof(int) * n);
+    int *vertex = (int *)xmalloc(sizeof(int) * n);
+    int *parent = (int *)xmalloc(sizeof(int) * n);
+    int *semi = (int *)xmalloc(sizeof(int) * n);
+    int *ancestor = (int *)xmalloc(sizeof(int) * n);
+    int *label = (int *)xmalloc(sizeof(int) * n);
+    int *idom = (int *)xmalloc(sizeof(int) * n);
+    int *bucket = (int *)xmalloc(sizeof(int) * n);
+    int *bucketnext = (int *)xmalloc(sizeof(int) * n);
+    int *stack = (int *)xmalloc(sizeof(int) * n);
+    int *stackedge = (int *)xmalloc(sizeof(int) * n);
+    int count = 0, top = 0;
+
+    memset(predstart,0,sizeof(int) * (n + 1));
+    for(int v = 0; v < n; v++)
+        for(int e = h->edgestart[v]; e < h->edgestart[v + 1]; e++) predstart[h->edges[e] + 1]++;
+    for(int v = 0; v < n; v++) predstart[v + 1] += predstart[v];
+    memcpy(stack,predstart,sizeof(int) * n);
+    for(int v = 0; v < n; v++)
+        for(int e = h->edgestart[v]; e < h->edgestart[v + 1]; e++) preds[stack[h->edges[e]]++] = v;
+
+    for(int v = 0; v < n; v++) {
+        dfnum[v] = -1;
+        ancestor[v] = -1;
+        label[v] = v;
+        idom[v] = -1;
+        bucket[v] = -1;
+    }
+    dfnum[root] = count;
+    vertex[count++] = root;
+    parent[root] = -1;
+    stack[top] = root;
+    stackedge[top++] = h->edgestart[root];
+    while(top) {
+        int v = stack[top - 1];
+        if(stackedge[top - 1] == h->edgestart[v + 1]) {
+            top--;
+            continue;
+        }
+        int w = h->edges[stackedge[top - 1]++];
+        if(dfnum[w] >= 0) continue;
+        dfnum[w] = count;
+        vertex[count++] = w;
+        parent[w] = v;
+        stack[top] = w;
+        stackedge[top++] = h->edgestart[w];
+    }
+    for(int v = 0; v < n; v++) semi[v] = dfnum[v];
+
+    for(int i = count - 1; i > 0; i--) {
+        int w = vertex[i];
+        for(int e = predstart[w]; e < predstart[w + 1]; e++) {
+            int v = preds[e], u = v;
+            if(dfnum[v] < 0) continue;
+            if(ancestor[v] >= 0) {
+                /* eval(v) compressing the path to the root of its tree */
+                int x = v;
+                top = 0;
+                while(ancestor[ancestor[x]] >= 0) {
+                    stack[top++] = x;
+                    x = ancestor[x];
+                }
+                while(top) {
+                    x = stack[--top];
+                    int a = ancestor[x];
+                    if(semi[label[a]] < semi[label[x]]) label[x] = label[a];
+                    ancestor[x] = ancestor[a];
+                }
+                u = label[v];
+            }
+            if(semi[u] < semi[w]) semi[w] = semi[u];
+        }
+        int s = vertex[semi[w]];
+        bucketnext[w] = bucket[s];
+        bucket[s] = w;
+        int p = parent[w];
+        ancestor[w] = p;
+        for(int v = bucket[p]; v >= 0; v = bucketnext[v]) {
+            int u = v, x = v;
+            top = 0;
+            while(ancestor[ancestor[x]] >= 0) {
+                stack[top++] = x;
+                x = ancestor[x];
+            }
+            while(top) {
+                x = stack[--top];
+                int a = ancestor[x];
+                if(semi[label[a]] < semi[label[x]]) label[x] = label[a];
+                ancestor[x] = ancestor[a];
+            }
+            u = label[v];
+            idom[v] = semi[u] < semi[v] ? u : p;
+        }
+        bucket[p] = -1;
+    }
+    for(int i = 1; i < count; i++) {
+        int w = vertex[i];
+        if(idom[w] != vertex[semi[w]]) idom[w] = idom[idom[w]];
+    }
+
+    free(predstart); free(preds); free(dfnum); free(parent); free(semi); free(ancestor);
+    free(label); free(bucket); free(bucketnext); free(stack); free(stackedge);
+    *order = vertex;
+    *nreached = count;
+    return idom;
+}
+
+static long long *g_keys;
+static int by_key(const void *a,const void *b)
+{
+    long long ka = g_keys[*(const int *)a], kb = g_keys[*(const int *)b];
+    return ka < kb ? 1 : (ka > kb ? -1 : 0);
+}
+
+static void sort_by(int *idx,int n,long long *keys)
+{
+    g_keys = keys;
+    qsort(idx,n,sizeof(int),by_key);
+}
+
+int main(int argc,char *argv[])
+{
+    Heap h;
+    int top = 20;
+    const char *path = NULL;
+    char label[512], holder[512];
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i],"-n") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+        else path = argv[i];
+    }
+    if(!path) {
+        fprintf(stderr,"usage: sqheap [-n count] <snapshot>\n");
+        return 1;
+    }
+    if(!load_heap(path,&h)) {
+        free_heap(&h);
+        return 1;
+    }
+
+    int n = h.nnodes, nreached;
+    int *order;
+    int *idom = dominators(&h,&order,&nreached);
+    long long *retained = (long long *)xmalloc(sizeof(long long) * (n + 1));
+    long long total = 0, unreachable = 0;
+    for(int i = 0; i < n; i++) {
+        retained[i] = h.size[i];
+        total += h.size[i];
+        if(idom[i] < 0) unreachable += h.size[i];
+    }
+    retained[n] = 0;
+    for(int i = nreached - 1; i > 0; i--) retained[idom[order[i]]] += retained[order[i]];
+
+    printf("%d objects, %lld bytes, %d roots\n",n,total,h.edgestart[n + 1] - h.edgestart[n]);
+    printf("%d unreachable objects, %lld bytes\n",n - (nreached - 1),unreachable);
+    printf("%lld strings, %lld bytes(not in the graph)\n\n",h.strings,h.stringbytes);
+
+    /* objects and bytes by type */
+    {
+        long long counts[NTYPES + 1], bytes[NTYPES + 1];
+        int idx[NTYPES + 1];
+        memset(counts,0,sizeof(counts));
+        memset(bytes,0,sizeof(bytes));
+        for(int i = 0; i < n; i++) {
+            int t = type_slot(h.type[i]);
+            counts[t]++;
+            bytes[t] += h.size[i];
+        }
+        for(int t = 0; t < NTYPES; t++) idx[t] = t;
+        sort_by(idx,NTYPES,bytes);
+        printf("%12s %14s  type\n","objects","bytes");
+        for(int t = 0; t < NTYPES; t++) {
+            if(!counts[idx[t]]) continue;
+            printf("%12lld %14lld  %s\n",counts[idx[t]],bytes[idx[t]],type_name(g_types[idx[t]]));
+        }
+        printf("\n");
+    }
+
+    /* objects and bytes of the named classes, instances and functions */
+    if(h.nnames) {
+        int groups = h.nnames * (NTYPES + 1);
+        long long *counts = (long long *)xmalloc(sizeof(long long) * groups);
+        long long *bytes = (long long *)xmalloc(sizeof(long long) * groups);
+        int *idx = (int *)xmalloc(sizeof(int) * groups);
+        memset(counts,0,sizeof(long long) * groups);
+        memset(bytes,0,sizeof(long long) * groups);
+        for(int i = 0; i < n; i++) {
+            if(h.name[i] < 0) continue;
+            int g = h.name[i] * (NTYPES + 1) + type_slot(h.type[i]);
+            counts[g]++;
+            bytes[g] += h.size[i];
+        }
+        for(int g = 0; g < groups; g++) idx[g] = g;
+        sort_by(idx,groups,bytes);
+        printf("%12s %14s  name\n","objects","bytes");
+        for(int g = 0; g < groups && g < top; g++) {
+            int k = idx[g];
+            if(!counts[k]) break;
+            printf("%12lld %14lld  %s %s\n",counts[k],bytes[k],type_name(k % (NTYPES + 1) < NTYPES ? g_types[k % (NTYPES + 1)] : 0),h.names[k / (NTYPES + 1)]);
+        }
+        printf("\n");
+        free(counts); free(bytes); free(idx);
+    }
+
+    /* the objects retaining the most memory and the one holding each of them */
+    {
+        int *idx = (int *)xmalloc(sizeof(int) * (n + 1));
+        int m = 0;
+        for(int i = 0; i < n; i++) if(idom[i] >= 0) idx[m++] = i;
+        sort_by(idx,m,retained);
+        printf("%14s %12s  object <- retained by\n","retained","self");
+        for(int i = 0; i < m && i < top; i++) {
+            int k = idx[i];
+            node_label(&h,k,label,sizeof(label));
+            node_label(&h,idom[k],holder,sizeof(holder));
+            printf("%14lld %12lld  %s <- %s\n",retained[k],h.size[k],label,holder);
+        }
+        free(idx);
+    }
+    free(retained);
+    free(order);
+    free(idom);
+    free_heap(&h);
+    return 0;
+}
@@ -426,6 +426,15 @@ SQRESULT sqstd_writeclosuretofile(HSQUIRRELVM v,const SQChar *filename)
     return SQ_ERROR; //forward the error
 }
 
+SQRESULT sqstd_writeheapsnapshottofile(HSQUIRRELVM v,const SQChar *filename)
+{
+    SQFILE file = sqstd_fopen(filename,_SC("wb+"));
+    if(!file) return sq_throwerror(v,_SC("cannot open the file"));
+    SQRESULT res = sq_writeheapsnapshot(v,file_write,file);
+    sqstd_fclose(file);
+    return res;
+}
+
 SQInteger _g_io_loadfile(HSQUIRRELVM v)
 {
     const SQChar *filename;
@@ -448,6 +457,15 @@ SQInteger _g_io_writeclosuretofile(HSQUIRRELVM v)
     return SQ_ERROR; //propagates the error
 }
 
+SQInteger _g_io_writeheapsnapshot(HSQUIRRELVM v)
+{
+    const SQChar *filename;
+    sq_getstring(v,2,&filename);
+    if(SQ_SUCCEEDED(sqstd_writeheapsnapshottofile(v,filename)))
+        return 0;
+    return SQ_ERROR; //propagates the error
+}
+
 SQInteger _g_io_dofile(HSQUIRRELVM v)
 {
     const SQChar *filename;
@@ -467,6 +485,7 @@ static const SQRegFunction iolib_funcs[]={
     _DECL_GLOBALIO_FUNC(loadfile,-2,_SC(".sb")),
     _DECL_GLOBALIO_FUNC(dofile,-2,_SC(".sb")),
     _DECL_GLOBALIO_FUNC(writeclosuretofile,3,_SC(".sc")),
+    _DECL_GLOBALIO_FUNC(writeheapsnapshot,2,_SC(".s")),
     {NULL,(SQFUNCTION)0,0,NULL}
 };
 
@@ -45,13 +45,13 @@ HSQUIRRELVM sq_open(SQInteger initialstacksize)
     SQVM *v;
     sq_new(ss, SQSharedState);
     ss->Init();
-    v = (SQVM *)SQ_MALLOC(sizeof(SQVM));
+    v = (SQVM *)SQ_SSMALLOC(ss,sizeof(SQVM));
     new (v) SQVM(ss);
     ss->_root_vm = v;
     if(v->Init(NULL, initialstacksize)) {
         return v;
     } else {
-        sq_delete(v, SQVM);
+        sq_ssdelete(ss, v, SQVM);
         return NULL;
     }
     return v;
@@ -63,14 +63,14 @@ HSQUIRRELVM sq_newthread(HSQUIRRELVM friendvm, SQInteger initialstacksize)
     SQVM *v;
     ss=_ss(friendvm);
 
-    v= (SQVM *)SQ_MALLOC(sizeof(SQVM));
+    v= (SQVM *)SQ_SSMALLOC(ss,sizeof(SQVM));
     new (v) SQVM(ss);
 
     if(v->Init(friendvm, initialstacksize)) {
         friendvm->Push(v);
         return v;
     } else {
-        sq_delete(v, SQVM);
+        sq_ssdelete(ss, v, SQVM);
         return NULL;
     }
 }
@@ -152,7 +152,7 @@ void sq_addref(HSQUIRRELVM v,HSQOBJECT *po)
 {
     if(!ISREFCOUNTED(sq_type(*po))) return;
 #ifdef NO_GARBAGE_COLLECTOR
-    __AddRef(po->_type,po->_unVal);
+    __ObjAddRef(_refcounted(*po));
 #else
     _ss(v)->_refs_table.AddRef(*po);
 #endif
@@ -162,7 +162,7 @@ SQUnsignedInteger sq_getrefcount(HSQUIRRELVM v,HSQOBJECT *po)
 {
     if(!ISREFCOUNTED(sq_type(*po))) return 0;
 #ifdef NO_GARBAGE_COLLECTOR
-   return po->_unVal.pRefCounted->_uiRef;
+   return _refcounted(*po)->_uiRef;
 #else
    return _ss(v)->_refs_table.GetRefCount(*po);
 #endif
@@ -172,8 +172,9 @@ SQBool sq_release(HSQUIRRELVM v,HSQOBJECT *po)
 {
     if(!ISREFCOUNTED(sq_type(*po))) return SQTrue;
 #ifdef NO_GARBAGE_COLLECTOR
-    bool ret = (po->_unVal.pRefCounted->_uiRef <= 1) ? SQTrue : SQFalse;
-    __Release(po->_type,po->_unVal);
+    SQRefCounted *ref = _refcounted(*po);
+    bool ret = (ref->_uiRef <= 1) ? SQTrue : SQFalse;
+    __ObjRelease(ref);
     return ret; //the ret val doesn't work(and cannot be fixed)
 #else
     return _ss(v)->_refs_table.Release(*po);
@@ -183,7 +184,7 @@ SQBool sq_release(HSQUIRRELVM v,HSQOBJECT *po)
 SQUnsignedInteger sq_getvmrefcount(HSQUIRRELVM SQ_UNUSED_ARG(v), const HSQOBJECT *po)
 {
     if (!ISREFCOUNTED(sq_type(*po))) return 0;
-    return po->_unVal.pRefCounted->_uiRef;
+    return _refcounted(*po)->_uiRef;
 }
 
 const SQChar *sq_objtostring(const HSQOBJECT *o)
@@ -273,16 +274,19 @@ SQUserPointer sq_newuserdata(HSQUIRRELVM v,SQUnsignedInteger size)
 void sq_newtable(HSQUIRRELVM v)
 {
     v->Push(SQTable::Create(_ss(v), 0));
+    SQ_MEMCHECK(_ss(v),NULL);
 }
 
 void sq_newtableex(HSQUIRRELVM v,SQInteger initialcapacity)
 {
     v->Push(SQTable::Create(_ss(v), initialcapacity));
+    SQ_MEMCHECK(_ss(v),NULL);
 }
 
 void sq_newarray(HSQUIRRELVM v,SQInteger size)
 {
     v->Push(SQArray::Create(_ss(v), size));
+    SQ_MEMCHECK(_ss(v),NULL);
 }
 
 SQRESULT sq_newclass(HSQUIRRELVM v,SQBool hasbase)
@@ -1120,7 +1124,7 @@ void sq_pushobject(HSQUIRRELVM v,HSQOBJECT obj)
 
 void sq_resetobject(HSQOBJECT *po)
 {
-    po->_unVal.pUserPointer=NULL;po->_type=OT_NULL;
+    _setnull(*po);
 }
 
 SQRESULT sq_throwerror(HSQUIRRELVM v,const SQChar *err)
@@ -1311,6 +1315,102 @@ SQInteger sq_collectgarbage(HSQUIRRELVM v)
 #endif
 }
 
+SQInteger sq_collectyoung(HSQUIRRELVM v)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    return _ss(v)->CollectYoung(v);
+#else
+    return -1;
+#endif
+}
+
+SQInteger sq_gcstep(HSQUIRRELVM v,SQInteger budget_us)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    return _ss(v)->GCStep(v,budget_us);
+#else
+    return SQ_GCPHASE_IDLE;
+#endif
+}
+
+SQRESULT sq_getgcprogress(HSQUIRRELVM v,SQGCProgress *p)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    SQSharedState *ss = _ss(v);
+    p->phase = ss->_gc_phase;
+    p->marked = ss->_gc_phase == SQ_GCPHASE_MARK ? ss->_gc_marked : 0;
+    p->estimate = ss->_gc_estimate;
+    p->collected = ss->_gc_collected;
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_getgcprogress requires a garbage collector build"));
+#endif
+}
+
+void sq_enableautogc(HSQUIRRELVM v,SQBool enable)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    SQSharedState *ss = _ss(v);
+    ss->_gc_auto = enable?true:false;
+    ss->SetThreshold();
+#endif
+}
+
+SQRESULT sq_setgcparams(HSQUIRRELVM v,SQInteger pause,SQInteger stepmul)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    if(pause <= 0 || stepmul <= 0)
+        return sq_throwerror(v,_SC("invalid gc parameters"));
+    SQSharedState *ss = _ss(v);
+    ss->_gc_pause = pause;
+    ss->_gc_stepmul = stepmul;
+    ss->SetThreshold();
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_setgcparams requires a garbage collector build"));
+#endif
+}
+
+SQRESULT sq_setgcthreads(HSQUIRRELVM v,SQInteger SQ_UNUSED_ARG(nthreads))
+{
+#ifdef SQ_PARALLEL_MARK
+    if(nthreads <= 0 || nthreads > GC_MAXTHREADS)
+        return sq_throwerror(v,_SC("invalid number of gc threads"));
+    _ss(v)->_gc_threads = nthreads;
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_setgcthreads requires a parallel mark build"));
+#endif
+}
+
+SQRESULT sq_getheapstats(HSQUIRRELVM v,SQHeapStats *SQ_UNUSED_ARG(s))
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    _ss(v)->GetHeapStats(s);
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_getheapstats requires a garbage collector build"));
+#endif
+}
+
+void sq_setgchook(HSQUIRRELVM SQ_UNUSED_ARG(v),SQGCHOOK SQ_UNUSED_ARG(hook))
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    _ss(v)->_gc_hook = hook;
+#endif
+}
+
+SQRESULT sq_writeheapsnapshot(HSQUIRRELVM v,SQWRITEFUNC SQ_UNUSED_ARG(writef),SQUserPointer SQ_UNUSED_ARG(up))
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    if(!_ss(v)->WriteHeapSnapshot(writef,up))
+        return sq_throwerror(v,_SC("io error"));
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_writeheapsnapshot requires a garbage collector build"));
+#endif
+}
+
 SQRESULT sq_getcallee(HSQUIRRELVM v)
 {
     if(v->_callsstacksize > 1)
@@ -1629,3 +1729,47 @@ void sq_free(void *p,SQUnsignedInteger size)
 {
     SQ_FREE(p,size);
 }
+
+SQRESULT sq_getmempoolstats(HSQUIRRELVM v,SQMemPoolStats *s)
+{
+#ifndef NO_MEMORY_POOL
+    SQMemPool &pool = _ss(v)->_pool;
+    s->arenas = pool._narenas;
+    s->arenabytes = pool._narenas * SQ_POOL_ARENASIZE;
+    s->pages = pool._npages;
+    s->blocks = pool._nblocks;
+    s->blockbytes = pool._blockbytes;
+    s->allocs = pool._nallocs;
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_getmempoolstats requires a memory pool build"));
+#endif
+}
+
+SQInteger sq_getmemusage(HSQUIRRELVM v)
+{
+    return (SQInteger)_ss(v)->_allocated;
+}
+
+SQRESULT sq_setmemlimits(HSQUIRRELVM v,SQInteger softlimit,SQInteger hardlimit)
+{
+    if(softlimit < 0 || hardlimit < 0 || (softlimit && hardlimit && softlimit > hardlimit))
+        return sq_throwerror(v,_SC("invalid memory limits"));
+    SQSharedState *ss = _ss(v);
+    ss->_mem_softlimit = (SQUnsignedInteger)softlimit;
+    ss->_mem_hardlimit = (SQUnsignedInteger)hardlimit;
+    ss->_mem_emergency = ss->_mem_softlimit;
+    ss->_mem_overlimit = ss->_mem_exhausted = false;
+    ss->SetThreshold();
+    return SQ_OK;
+}
+
+void sq_setmemlimithook(HSQUIRRELVM v,SQMEMLIMITHOOK hook)
+{
+    _ss(v)->_mem_hook = hook;
+}
+
+void sq_setinternlimit(HSQUIRRELVM v,SQInteger maxlen)
+{
+    _ss(v)->_stringtable->SetInternLimit(maxlen);
+}
@@ -5,19 +5,21 @@
 struct SQArray : public CHAINABLE_OBJ
 {
 private:
-    SQArray(SQSharedState *ss,SQInteger nsize){_values.resize(nsize); INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+    SQArray(SQSharedState *ss,SQInteger nsize){_values.setowner(_gcss(ss)); _values.resize(nsize); INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this);}
     ~SQArray()
     {
-        REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+        REMOVE_FROM_CHAIN(_gcchain(this),this);
     }
 public:
     static SQArray* Create(SQSharedState *ss,SQInteger nInitialSize){
-        SQArray *newarray=(SQArray*)SQ_MALLOC(sizeof(SQArray));
+        SQArray *newarray=(SQArray*)SQ_SSMALLOC(_gcss(ss),sizeof(SQArray));
         new (newarray) SQArray(ss,nInitialSize);
         return newarray;
     }
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     SQObjectType GetType() {return OT_ARRAY;}
 #endif
     void Finalize(){
@@ -86,7 +88,7 @@ public:
     }
     void Release()
     {
-        sq_delete(this,SQArray);
+        sq_ssdelete(_gcss(_sharedstate),this,SQArray);
     }
 
     SQObjectPtrVec _values;
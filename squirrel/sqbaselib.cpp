@@ -52,6 +52,61 @@ static SQInteger base_collectgarbage(HSQUIRRELVM v)
     sq_pushinteger(v, sq_collectgarbage(v));
     return 1;
 }
+static SQInteger base_collectyoung(HSQUIRRELVM v)
+{
+    sq_pushinteger(v, sq_collectyoung(v));
+    return 1;
+}
+static SQInteger base_gcstep(HSQUIRRELVM v)
+{
+    SQInteger budget;
+    sq_getinteger(v, 2, &budget);
+    sq_pushinteger(v, sq_gcstep(v, budget));
+    return 1;
+}
+#ifdef SQ_PARALLEL_MARK
+static SQInteger base_setgcthreads(HSQUIRRELVM v)
+{
+    SQInteger n;
+    sq_getinteger(v, 2, &n);
+    if(SQ_FAILED(sq_setgcthreads(v, n)))
+        return SQ_ERROR;
+    return 0;
+}
+#endif
+static SQInteger base_heapstats(HSQUIRRELVM v)
+{
+    SQHeapStats s;
+    sq_getheapstats(v, &s);
+    sq_newtable(v);
+    //in the order of SQHeapStats::types
+    const SQChar *types[] = { _SC("string"), _SC("table"), _SC("array"), _SC("userdata"), _SC("closure"),
+        _SC("nativeclosure"), _SC("generator"), _SC("thread"), _SC("funcproto"), _SC("class"),
+        _SC("instance"), _SC("weakref"), _SC("outer") };
+    for(SQInteger i = 0; i < SQ_HEAPSTATS_NTYPES; i++) {
+        sq_pushstring(v, types[i], -1);
+        sq_newtable(v);
+        sq_pushstring(v, _SC("objects"), -1);
+        sq_pushinteger(v, s.types[i].objects);
+        sq_newslot(v, -3, SQFalse);
+        sq_pushstring(v, _SC("bytes"), -1);
+        sq_pushinteger(v, s.types[i].bytes);
+        sq_newslot(v, -3, SQFalse);
+        sq_newslot(v, -3, SQFalse);
+    }
+    const SQChar *names[] = { _SC("stringslots"), _SC("stringsused"), _SC("refslots"), _SC("refsused"),
+        _SC("fullcollections"), _SC("youngcollections"), _SC("cycles"),
+        _SC("marktime"), _SC("sweeptime"), _SC("youngtime"), _SC("cycletime") };
+    SQInteger values[] = { s.stringslots, s.stringsused, s.refslots, s.refsused,
+        s.fullcollections, s.youngcollections, s.cycles,
+        s.marktime, s.sweeptime, s.youngtime, s.cycletime };
+    for(SQInteger i = 0; i < 11; i++) {
+        sq_pushstring(v, names[i], -1);
+        sq_pushinteger(v, values[i]);
+        sq_newslot(v, -3, SQFalse);
+    }
+    return 1;
+}
 static SQInteger base_resurectureachable(HSQUIRRELVM v)
 {
     sq_resurrectunreachable(v);
@@ -65,6 +120,23 @@ static SQInteger base_getroottable(HSQUIRRELVM v)
     return 1;
 }
 
+#ifndef NO_MEMORY_POOL
+static SQInteger base_mempoolstats(HSQUIRRELVM v)
+{
+    SQMemPoolStats s;
+    sq_getmempoolstats(v, &s);
+    sq_newtable(v);
+    const SQChar *names[] = { _SC("arenas"), _SC("arenabytes"), _SC("pages"), _SC("blocks"), _SC("blockbytes"), _SC("allocs") };
+    SQInteger values[] = { s.arenas, s.arenabytes, s.pages, s.blocks, s.blockbytes, s.allocs };
+    for(SQInteger i = 0; i < 6; i++) {
+        sq_pushstring(v, names[i], -1);
+        sq_pushinteger(v, values[i]);
+        sq_newslot(v, -3, SQFalse);
+    }
+    return 1;
+}
+#endif
+
 static SQInteger base_getconsttable(HSQUIRRELVM v)
 {
     v->Push(_ss(v)->_consts);
@@ -252,6 +324,8 @@ static SQInteger base_array(HSQUIRRELVM v)
 {
     SQArray *a;
     SQObject &size = stack_get(v,2);
+    if(!_ss(v)->CanAllocate((SQUnsignedInteger)tointeger(size),sizeof(SQObjectPtr)))
+        return sq_throwerror(v,_SC("out of memory"));
     if(sq_gettop(v) > 2) {
         a = SQArray::Create(_ss(v),0);
         a->Resize(tointeger(size),stack_get(v,3));
@@ -302,7 +376,16 @@ static const SQRegFunction base_funcs[]={
     {_SC("dummy"),base_dummy,0,NULL},
 #ifndef NO_GARBAGE_COLLECTOR
     {_SC("collectgarbage"),base_collectgarbage,0, NULL},
+    {_SC("collectyoung"),base_collectyoung,0, NULL},
+    {_SC("gcstep"),base_gcstep,2, _SC(".n")},
+#ifdef SQ_PARALLEL_MARK
+    {_SC("setgcthreads"),base_setgcthreads,2, _SC(".n")},
+#endif
+    {_SC("heapstats"),base_heapstats,0, NULL},
     {_SC("resurrectunreachable"),base_resurectureachable,0, NULL},
+#endif
+#ifndef NO_MEMORY_POOL
+    {_SC("mempoolstats"),base_mempoolstats,0, NULL},
 #endif
     {NULL,(SQFUNCTION)0,0,NULL}
 };
@@ -636,6 +719,8 @@ static SQInteger array_resize(HSQUIRRELVM v)
         SQInteger sz = tointeger(nsize);
         if (sz<0)
           return sq_throwerror(v, _SC("resizing to negative length"));
+        if(sz > _array(o)->Size() && !_ss(v)->CanAllocate((SQUnsignedInteger)(sz - _array(o)->Size()),sizeof(SQObjectPtr)))
+            return sq_throwerror(v, _SC("out of memory"));
 
         if(sq_gettop(v) > 2)
             fill = stack_get(v, 3);
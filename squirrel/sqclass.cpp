@@ -13,11 +13,14 @@
 SQClass::SQClass(SQSharedState *ss,SQClass *base)
 {
     _base = base;
+    _defaultvalues.setowner(_gcss(ss));
+    _methods.setowner(_gcss(ss));
     _typetag = 0;
     _hook = NULL;
     _udsize = 0;
     _locked = false;
     _constructoridx = -1;
+    _classid = ++ss->_lastclassid;
     if(_base) {
         _constructoridx = _base->_constructoridx;
         _udsize = _base->_udsize;
@@ -30,7 +33,7 @@ SQClass::SQClass(SQSharedState *ss,SQClass *base)
     __ObjAddRef(_members);
 
     INIT_CHAIN();
-    ADD_TO_CHAIN(&_sharedstate->_gc_chain, this);
+    ADD_TO_CHAIN(&_sharedstate->_gc_young,this);
 }
 
 void SQClass::Finalize() {
@@ -46,7 +49,7 @@ void SQClass::Finalize() {
 
 SQClass::~SQClass()
 {
-    REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
+    REMOVE_FROM_CHAIN(_gcchain(this),this);
     Finalize();
 }
 
@@ -154,7 +157,7 @@ void SQInstance::Init(SQSharedState *ss)
     __ObjAddRef(_class);
     _delegate = _class->_members;
     INIT_CHAIN();
-    ADD_TO_CHAIN(&_sharedstate->_gc_chain, this);
+    ADD_TO_CHAIN(&_sharedstate->_gc_young,this);
 }
 
 SQInstance::SQInstance(SQSharedState *ss, SQClass *c, SQInteger memsize)
@@ -188,7 +191,7 @@ void SQInstance::Finalize()
 
 SQInstance::~SQInstance()
 {
-    REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
+    REMOVE_FROM_CHAIN(_gcchain(this),this);
     if(_class){ Finalize(); } //if _class is null it was already finalized by the GC
 }
 
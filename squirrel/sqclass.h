@@ -31,7 +31,7 @@ struct SQClass : public CHAINABLE_OBJ
     SQClass(SQSharedState *ss,SQClass *base);
 public:
     static SQClass* Create(SQSharedState *ss,SQClass *base) {
-        SQClass *newclass = (SQClass *)SQ_MALLOC(sizeof(SQClass));
+        SQClass *newclass = (SQClass *)SQ_SSMALLOC(_gcss(ss),sizeof(SQClass));
         new (newclass) SQClass(ss, base);
         return newclass;
     }
@@ -63,11 +63,13 @@ public:
     void Lock() { _locked = true; if(_base) _base->Lock(); }
     void Release() {
         if (_hook) { _hook(_typetag,0);}
-        sq_delete(this, SQClass);
+        sq_ssdelete(_gcss(_sharedstate),this, SQClass);
     }
     void Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable ** );
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     SQObjectType GetType() {return OT_CLASS;}
 #endif
     SQInteger Next(const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
@@ -83,6 +85,7 @@ public:
     bool _locked;
     SQInteger _constructoridx;
     SQInteger _udsize;
+    SQUnsignedInteger _classid; //unique in the shared state, keys the VM inline caches
 };
 
 #define calcinstancesize(_theclass_) \
@@ -97,7 +100,7 @@ public:
     static SQInstance* Create(SQSharedState *ss,SQClass *theclass) {
 
         SQInteger size = calcinstancesize(theclass);
-        SQInstance *newinst = (SQInstance *)SQ_MALLOC(size);
+        SQInstance *newinst = (SQInstance *)SQ_SSMALLOC(_gcss(ss),size);
         new (newinst) SQInstance(ss, theclass,size);
         if(theclass->_udsize) {
             newinst->_userpointer = ((unsigned char *)newinst) + (size - theclass->_udsize);
@@ -107,7 +110,7 @@ public:
     SQInstance *Clone(SQSharedState *ss)
     {
         SQInteger size = calcinstancesize(_class);
-        SQInstance *newinst = (SQInstance *)SQ_MALLOC(size);
+        SQInstance *newinst = (SQInstance *)SQ_SSMALLOC(_gcss(ss),size);
         new (newinst) SQInstance(ss, this,size);
         if(_class->_udsize) {
             newinst->_userpointer = ((unsigned char *)newinst) + (size - _class->_udsize);
@@ -142,12 +145,15 @@ public:
         _uiRef--;
         if(_uiRef > 0) return;
         SQInteger size = _memsize;
+        SQSharedState *ss = _gcss(_sharedstate);
         this->~SQInstance();
-        SQ_FREE(this, size);
+        SQ_SSFREE(ss,this, size);
     }
     void Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable ** );
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     SQObjectType GetType() {return OT_INSTANCE;}
 #endif
     bool InstanceOf(SQClass *trg);
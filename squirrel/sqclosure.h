@@ -10,11 +10,11 @@ struct SQClass;
 struct SQClosure : public CHAINABLE_OBJ
 {
 private:
-    SQClosure(SQSharedState *ss,SQFunctionProto *func){_function = func; __ObjAddRef(_function); _base = NULL; INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this); _env = NULL; _root=NULL;}
+    SQClosure(SQSharedState *ss,SQFunctionProto *func){_function = func; __ObjAddRef(_function); _base = NULL; INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this); _env = NULL; _root=NULL;}
 public:
     static SQClosure *Create(SQSharedState *ss,SQFunctionProto *func,SQWeakRef *root){
         SQInteger size = _CALC_CLOSURE_SIZE(func);
-        SQClosure *nc=(SQClosure*)SQ_MALLOC(size);
+        SQClosure *nc=(SQClosure*)SQ_SSMALLOC(_gcss(ss),size);
         new (nc) SQClosure(ss,func);
         nc->_outervalues = (SQObjectPtr *)(nc + 1);
         nc->_defaultparams = &nc->_outervalues[func->_noutervalues];
@@ -30,8 +30,9 @@ public:
         _DESTRUCT_VECTOR(SQObjectPtr,f->_noutervalues,_outervalues);
         _DESTRUCT_VECTOR(SQObjectPtr,f->_ndefaultparams,_defaultparams);
         __ObjRelease(_function);
+        SQSharedState *ss = _gcss(_sharedstate);
         this->~SQClosure();
-        sq_vm_free(this,size);
+        sq_ss_free(ss,this,size);
     }
     void SetRoot(SQWeakRef *r)
     {
@@ -55,6 +56,8 @@ public:
     static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize(){
         SQFunctionProto *f = _function;
         _NULL_SQOBJECT_VECTOR(_outervalues,f->_noutervalues);
@@ -75,25 +78,26 @@ struct SQOuter : public CHAINABLE_OBJ
 {
 
 private:
-    SQOuter(SQSharedState *ss, SQObjectPtr *outer){_valptr = outer; _next = NULL; INIT_CHAIN(); ADD_TO_CHAIN(&_ss(this)->_gc_chain,this); }
+    SQOuter(SQSharedState *ss, SQObjectPtr *outer){_valptr = outer; _next = NULL; INIT_CHAIN(); ADD_TO_CHAIN(&_ss(this)->_gc_young,this); }
 
 public:
     static SQOuter *Create(SQSharedState *ss, SQObjectPtr *outer)
     {
-        SQOuter *nc  = (SQOuter*)SQ_MALLOC(sizeof(SQOuter));
+        SQOuter *nc  = (SQOuter*)SQ_SSMALLOC(_gcss(ss),sizeof(SQOuter));
         new (nc) SQOuter(ss, outer);
         return nc;
     }
-    ~SQOuter() { REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this); }
+    ~SQOuter() { REMOVE_FROM_CHAIN(_gcchain(this),this); }
 
     void Release()
     {
-        this->~SQOuter();
-        sq_vm_free(this,sizeof(SQOuter));
+        sq_ssdelete(_gcss(_sharedstate),this,SQOuter);
     }
 
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize() { _value.Null(); }
     SQObjectType GetType() {return OT_OUTER;}
 #endif
@@ -109,29 +113,31 @@ struct SQGenerator : public CHAINABLE_OBJ
 {
     enum SQGeneratorState{eRunning,eSuspended,eDead};
 private:
-    SQGenerator(SQSharedState *ss,SQClosure *closure){_closure=closure;_state=eRunning;_ci._generator=NULL;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);}
+    SQGenerator(SQSharedState *ss,SQClosure *closure){_stack.setowner(_gcss(ss));_etraps.setowner(_gcss(ss));_closure=closure;_state=eRunning;_ci._generator=NULL;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this);}
 public:
     static SQGenerator *Create(SQSharedState *ss,SQClosure *closure){
-        SQGenerator *nc=(SQGenerator*)SQ_MALLOC(sizeof(SQGenerator));
+        SQGenerator *nc=(SQGenerator*)SQ_SSMALLOC(_gcss(ss),sizeof(SQGenerator));
         new (nc) SQGenerator(ss,closure);
         return nc;
     }
     ~SQGenerator()
     {
-        REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+        REMOVE_FROM_CHAIN(_gcchain(this),this);
     }
     void Kill(){
         _state=eDead;
         _stack.resize(0);
         _closure.Null();}
     void Release(){
-        sq_delete(this,SQGenerator);
+        sq_ssdelete(_gcss(_sharedstate),this,SQGenerator);
     }
 
     bool Yield(SQVM *v,SQInteger target);
     bool Resume(SQVM *v,SQObjectPtr &dest);
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize(){_stack.resize(0);_closure.Null();}
     SQObjectType GetType() {return OT_GENERATOR;}
 #endif
@@ -147,12 +153,12 @@ public:
 struct SQNativeClosure : public CHAINABLE_OBJ
 {
 private:
-    SQNativeClosure(SQSharedState *ss,SQFUNCTION func){_function=func;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this); _env = NULL;}
+    SQNativeClosure(SQSharedState *ss,SQFUNCTION func){_typecheck.setowner(_gcss(ss));_function=func;INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this); _env = NULL;}
 public:
     static SQNativeClosure *Create(SQSharedState *ss,SQFUNCTION func,SQInteger nouters)
     {
         SQInteger size = _CALC_NATVIVECLOSURE_SIZE(nouters);
-        SQNativeClosure *nc=(SQNativeClosure*)SQ_MALLOC(size);
+        SQNativeClosure *nc=(SQNativeClosure*)SQ_SSMALLOC(_gcss(ss),size);
         new (nc) SQNativeClosure(ss,func);
         nc->_outervalues = (SQObjectPtr *)(nc + 1);
         nc->_noutervalues = nouters;
@@ -173,17 +179,20 @@ public:
     ~SQNativeClosure()
     {
         __ObjRelease(_env);
-        REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+        REMOVE_FROM_CHAIN(_gcchain(this),this);
     }
     void Release(){
         SQInteger size = _CALC_NATVIVECLOSURE_SIZE(_noutervalues);
         _DESTRUCT_VECTOR(SQObjectPtr,_noutervalues,_outervalues);
+        SQSharedState *ss = _gcss(_sharedstate);
         this->~SQNativeClosure();
-        sq_free(this,size);
+        sq_ss_free(ss,this,size);
     }
 
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize() { _NULL_SQOBJECT_VECTOR(_outervalues,_noutervalues); }
     SQObjectType GetType() {return OT_NATIVECLOSURE;}
 #endif
@@ -27,6 +27,8 @@ struct SQExpState {
 };
 
 #define MAX_COMPILER_ERROR_LEN 256
+//fewer cases are faster compared one after the other than through a jump table
+#define MIN_TABLE_CASES 4
 
 struct SQScope {
     SQInteger outers;
@@ -1189,17 +1191,53 @@ public:
         BEGIN_BREAKBLE_BLOCK()
         Statement();
         SQInteger continuetrg = _fs->GetCurrentPos();
-        if(expsize > 0) {
-            for(SQInteger i = 0; i < expsize; i++)
-                _fs->AddInstruction(exp[i]);
+        if(!ForLoop(jmppos, jzpos, exp)) {
+            if(expsize > 0) {
+                for(SQInteger i = 0; i < expsize; i++)
+                    _fs->AddInstruction(exp[i]);
+            }
+            _fs->AddInstruction(_OP_JMP, 0, jmppos - _fs->GetCurrentPos() - 1, 0);
         }
-        _fs->AddInstruction(_OP_JMP, 0, jmppos - _fs->GetCurrentPos() - 1, 0);
         if(jzpos>  0) _fs->SetInstructionParam(jzpos, 1, _fs->GetCurrentPos() - jzpos);
         
         END_BREAKBLE_BLOCK(continuetrg);
 
 		END_SCOPE();
     }
+    //a counted loop, that compares a local with another local or an integer and adds an integer to it,
+    //ends with an _OP_FORLOOP instead of the step and the jump back to the condition
+    bool ForLoop(SQInteger jmppos, SQInteger jzpos, SQInstructionVec &exp)
+    {
+        if(jzpos < 0) return false;
+        SQInstruction cond = _fs->GetInstruction(jzpos);
+        SQInteger var = cond._arg2, bound = cond._arg0, step, flags = 0;
+        if(cond.op != _OP_JCMP || cond._arg3 == CMP_3W || var == bound || !_fs->IsLocal(var)) return false;
+        if(jzpos == jmppos + 2) {
+            SQInstruction &k = _fs->GetInstruction(jmppos + 1);
+            if(k.op != _OP_LOADINT || k._arg0 != bound) return false;
+            bound = _fs->GetNumericConstant((SQInteger)k._arg1);
+            if(bound > 0xFF) return false;
+            flags |= FORLOOP_LITERAL;
+        }
+        else if(jzpos != jmppos + 1 || !_fs->IsLocal(bound)) return false;
+        if(exp.size() == 1 && (exp[0].op == _OP_INCL || exp[0].op == _OP_PINCL) && exp[0]._arg1 == var) {
+            step = *((const signed char *)&exp[0]._arg3);
+        }
+        else if(exp.size() == 2 && exp[0].op == _OP_LOADINT && (exp[1].op == _OP_ADD || exp[1].op == _OP_SUB)
+            && exp[1]._arg0 == var && exp[1]._arg1 == exp[0]._arg0 && exp[1]._arg2 == var) {
+            step = exp[0]._arg1;
+            if(exp[1].op == _OP_SUB) {
+                step = -step;
+                flags |= FORLOOP_SUB;
+            }
+            if(step < -128 || step > 127) return false;
+        }
+        else return false;
+        SQInteger jump = jzpos - (_fs->GetCurrentPos() + 1);
+        if(jump < -(1 << 25)) return false;
+        _fs->AddInstruction(_OP_FORLOOP, var, FORLOOP_ARG1(jump, cond._arg3, flags), bound, step);
+        return true;
+    }
     void ForEachStatement()
     {
         SQObject idxname, valname;
@@ -1251,7 +1289,16 @@ public:
         SQInteger tonextcondjmp = -1;
         SQInteger skipcondjmp = -1;
         SQInteger __nbreaks__ = _fs->_unresolvedbreaks.size();
+        //the cases from the first one with a constant label can be dispatched by a table
+        SQInstructionVec labels;
+        SQIntVec conds, bodies;
+        SQInteger tablejmp = -1;
+        bool constants = true;
         _fs->_breaktargets.push_back(0);
+        if(_token == TK_CASE) {
+            _fs->AddInstruction(_OP_JMP, 0, 0);
+            tablejmp = _fs->GetCurrentPos();
+        }
         while(_token == TK_CASE) {
             if(!bfirst) {
                 _fs->AddInstruction(_OP_JMP, 0, 0);
@@ -1259,8 +1306,18 @@ public:
                 _fs->SetInstructionParam(tonextcondjmp, 1, _fs->GetCurrentPos() - tonextcondjmp);
             }
             //condition
+            SQInteger condpos = _fs->GetCurrentPos() + 1;
             Lex(); Expression(); Expect(_SC(':'));
             SQInteger trg = _fs->PopTarget();
+            if(constants) {
+                constants = _fs->GetCurrentPos() == condpos;
+                if(constants) {
+                    SQInstruction &l = _fs->GetInstruction(condpos);
+                    constants = (l.op == _OP_LOADINT || l.op == _OP_LOAD) && l._arg0 == trg;
+                    if(constants) labels.push_back(l);
+                }
+                conds.push_back(condpos);
+            }
             SQInteger eqtarget = trg;
             bool local = _fs->IsLocal(trg);
             if(local) {
@@ -1277,6 +1334,7 @@ public:
                 _fs->SetInstructionParam(skipcondjmp, 1, (_fs->GetCurrentPos() - skipcondjmp));
             }
             tonextcondjmp = _fs->GetCurrentPos();
+            if(constants) bodies.push_back(tonextcondjmp + 1);
             BEGIN_SCOPE();
             Statements();
             END_SCOPE();
@@ -1284,6 +1342,7 @@ public:
         }
         if(tonextcondjmp != -1)
             _fs->SetInstructionParam(tonextcondjmp, 1, _fs->GetCurrentPos() - tonextcondjmp);
+        if(constants) conds.push_back(_fs->GetCurrentPos() + 1);
         if(_token == TK_DEFAULT) {
             Lex(); Expect(_SC(':'));
             BEGIN_SCOPE();
@@ -1291,11 +1350,94 @@ public:
             END_SCOPE();
         }
         Expect(_SC('}'));
+        if(tablejmp != -1) JumpTable(tablejmp, expr, labels, conds, bodies);
         _fs->PopTarget();
         __nbreaks__ = _fs->_unresolvedbreaks.size() - __nbreaks__;
         if(__nbreaks__ > 0)ResolveBreaks(_fs, __nbreaks__);
         _fs->_breaktargets.pop_back();
     }
+    //the constant labels of a switch are dispatched by a table after its end, that tablejmp jumps to.
+    //Their compares become unreachable, a value that isn't in the table goes on from the compare of
+    //the first label that isn't a constant, or from the default
+    void JumpTable(SQInteger tablejmp, SQInteger expr, SQInstructionVec &labels, SQIntVec &conds, SQIntVec &bodies)
+    {
+        SQObjectPtrVec keys, literals;
+        SQInteger n, lo = 0, hi = 0;
+        bool integers = true;
+        for(n = 0; n < (SQInteger)labels.size(); n++) {
+            SQInstruction &l = labels[n];
+            SQObjectPtr key;
+            if(l.op == _OP_LOADINT) {
+                key = (SQInteger)l._arg1;
+            }
+            else {
+                if(literals.size() == 0) {
+                    SQObjectPtr refidx, lit, idx;
+                    SQInteger next;
+                    literals.resize(_fs->_nliterals);
+                    while((next = _table(_fs->_literals)->Next(false, refidx, lit, idx)) != -1) {
+                        literals[_integer(idx)] = lit;
+                        refidx = next;
+                    }
+                }
+                key = literals[l._arg1];
+            }
+            if(sq_type(key) == OT_INTEGER) {
+                if(_integer(key) < -JMPTABLE_MAXKEY || _integer(key) > JMPTABLE_MAXKEY) break;
+                if(n == 0 || _integer(key) < lo) lo = _integer(key);
+                if(n == 0 || _integer(key) > hi) hi = _integer(key);
+            }
+            else if(sq_type(key) == OT_STRING) {
+                integers = false;
+            }
+            else break;
+            keys.push_back(key);
+        }
+        if(n < MIN_TABLE_CASES) return;
+        SQInteger size = hi - lo + 1, bits = 1;
+        bool dense = integers && size <= n * 2 && size <= 0xFFFF && lo == (SQInt32)lo;
+        SQIntVec targets, slotkeys;
+        targets.resize(dense ? size : 0, -1);
+        if(!dense) {
+            while(((SQInteger)1 << bits) < n * 2) bits++;
+            if(bits > 16) return;
+            size = (SQInteger)1 << bits;
+            SQObjectPtrVec slotlabels;
+            targets.resize(size, -1);
+            slotkeys.resize(size, 0);
+            slotlabels.resize(size);
+            for(SQInteger k = 0; k < n; k++) {
+                SQObjectPtr &key = keys[k];
+                SQHash h = sq_type(key) == OT_STRING ? _string(key)->_hash : (SQHash)_integer(key);
+                SQInteger slot = JMPHASH_SLOT(h, bits);
+                //the first of two equal labels is the one == finds
+                while(slotkeys[slot] && !(sq_type(slotlabels[slot]) == sq_type(key) && (sq_type(key) == OT_INTEGER ?
+                    _integer(slotlabels[slot]) == _integer(key) : _streq(_string(slotlabels[slot]), _string(key))))) {
+                    slot = (slot + 1) & (size - 1);
+                }
+                if(slotkeys[slot]) continue;
+                SQInteger lit = labels[k].op == _OP_LOADINT ? _fs->GetNumericConstant(_integer(key)) : labels[k]._arg1;
+                if(lit >= 0xFFFFFF) return;
+                slotkeys[slot] = lit + 1;
+                slotlabels[slot] = key;
+                targets[slot] = bodies[k];
+            }
+        }
+        else {
+            for(SQInteger k = n - 1; k >= 0; k--) targets[_integer(keys[k]) - lo] = bodies[k];
+        }
+        _fs->AddInstruction(_OP_JMP, 0, 0);
+        SQInteger skipjmp = _fs->GetCurrentPos();
+        _fs->SetInstructionParam(tablejmp, 1, skipjmp - tablejmp);
+        if(dense) _fs->AddInstruction(_OP_JMPTABLE, expr, lo, size & 0xFF, size >> 8);
+        else _fs->AddInstruction(_OP_JMPHASH, expr, 0, bits);
+        for(SQInteger k = 0; k <= size; k++) {
+            SQInteger target = k < size && targets[k] != -1 ? targets[k] : conds[n];
+            SQInteger key = dense || k == size ? 0 : slotkeys[k];
+            _fs->AddInstruction(_OP_JMP, key & 0xFF, target - (_fs->GetCurrentPos() + 2), (key >> 8) & 0xFF, key >> 16);
+        }
+        _fs->SetInstructionParam(skipjmp, 1, _fs->GetCurrentPos() - skipjmp);
+    }
     void FunctionStatement()
     {
         SQObject id;
@@ -1343,35 +1485,30 @@ public:
     SQObject ExpectScalar()
     {
         SQObject val;
-        val._type = OT_NULL; val._unVal.nInteger = 0; //shut up GCC 4.x
+        _setnull(val); //shut up GCC 4.x
         switch(_token) {
             case TK_INTEGER:
-                val._type = OT_INTEGER;
-                val._unVal.nInteger = _lex._nvalue;
+                _setinteger(val,_lex._nvalue);
                 break;
             case TK_FLOAT:
-                val._type = OT_FLOAT;
-                val._unVal.fFloat = _lex._fvalue;
+                _setfloat(val,_lex._fvalue);
                 break;
             case TK_STRING_LITERAL:
                 val = _fs->CreateString(_lex._svalue,_lex._longstr.size()-1);
                 break;
             case TK_TRUE:
             case TK_FALSE:
-                val._type = OT_BOOL;
-                val._unVal.nInteger = _token == TK_TRUE ? 1 : 0;
+                _setbool(val,_token == TK_TRUE);
                 break;
             case '-':
                 Lex();
                 switch(_token)
                 {
                 case TK_INTEGER:
-                    val._type = OT_INTEGER;
-                    val._unVal.nInteger = -_lex._nvalue;
+                    _setinteger(val,-_lex._nvalue);
                 break;
                 case TK_FLOAT:
-                    val._type = OT_FLOAT;
-                    val._unVal.fFloat = -_lex._fvalue;
+                    _setfloat(val,-_lex._fvalue);
                 break;
                 default:
                     Error(_SC("scalar expected : integer, float"));
@@ -1399,8 +1536,7 @@ public:
                 val = ExpectScalar();
             }
             else {
-                val._type = OT_INTEGER;
-                val._unVal.nInteger = nval++;
+                _setinteger(val,nval++);
             }
             _table(table)->NewSlot(SQObjectPtr(key),SQObjectPtr(val));
             if(_token == ',') Lex();
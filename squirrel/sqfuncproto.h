@@ -3,6 +3,7 @@
 #define _SQFUNCTION_H_
 
 #include "sqopcodes.h"
+#include "sqjit.h"
 
 enum SQOuterType {
     otLOCAL = 0,
@@ -48,6 +49,46 @@ struct SQLocalVarInfo
 
 struct SQLineInfo { SQInteger _line;SQInteger _op; };
 
+#define SQ_INLINECACHE_WAYS 2
+#define SQ_INLINECACHE_MAX 0xFFFF
+
+//caches the member resolved by a GET/SET site on a class instance
+struct SQInlineCacheEntry
+{
+    SQInlineCacheEntry():_classid(0),_member(0){}
+    SQUnsignedInteger _classid;
+    SQInteger _member;
+    SQObjectPtr _key;
+};
+
+struct SQInlineCache
+{
+    SQInlineCache():_tableslot(0){}
+    bool Lookup(SQUnsignedInteger classid,const SQObject &key,SQInteger &member)
+    {
+        for(SQInteger i = 0; i < SQ_INLINECACHE_WAYS; i++) {
+            SQInlineCacheEntry &e = _ways[i];
+            if(e._classid == classid && _rawequal(e._key,key)) {
+                member = e._member;
+                return true;
+            }
+        }
+        return false;
+    }
+    void Fill(SQUnsignedInteger classid,const SQObject &key,SQInteger member)
+    {
+        for(SQInteger i = SQ_INLINECACHE_WAYS - 1; i > 0; i--) {
+            _ways[i] = _ways[i - 1];
+        }
+        _ways[0]._classid = classid;
+        _ways[0]._key = key;
+        _ways[0]._member = member;
+    }
+    SQInlineCacheEntry _ways[SQ_INLINECACHE_WAYS];
+    //where the site found its key the last time it accessed a table(see SQTable::GetSlot)
+    SQInteger _tableslot;
+};
+
 typedef sqvector<SQOuterVar> SQOuterVarVec;
 typedef sqvector<SQLocalVarInfo> SQLocalVarInfoVec;
 typedef sqvector<SQLineInfo> SQLineInfoVec;
@@ -73,7 +114,7 @@ public:
     {
         SQFunctionProto *f;
         //I compact the whole class and members in a single memory allocation
-        f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
+        f = (SQFunctionProto *)sq_ss_malloc(_gcss(ss),_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
         new (f) SQFunctionProto(ss);
         f->_ninstructions = ninstructions;
         f->_literals = (SQObjectPtr*)&f->_instructions[ninstructions];
@@ -100,6 +141,10 @@ public:
         return f;
     }
     void Release(){
+        FreeInlineCaches();
+#ifdef SQ_JIT
+        if(_jitcode) sq_jit_free(_jitcode);
+#endif
         _DESTRUCT_VECTOR(SQObjectPtr,_nliterals,_literals);
         _DESTRUCT_VECTOR(SQObjectPtr,_nparameters,_parameters);
         _DESTRUCT_VECTOR(SQObjectPtr,_nfunctions,_functions);
@@ -107,16 +152,27 @@ public:
         //_DESTRUCT_VECTOR(SQLineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
         _DESTRUCT_VECTOR(SQLocalVarInfo,_nlocalvarinfos,_localvarinfos);
         SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+        SQSharedState *ss = _gcss(_sharedstate);
         this->~SQFunctionProto();
-        sq_vm_free(this,size);
+        sq_ss_free(ss,this,size);
     }
 
     const SQChar* GetLocal(SQVM *v,SQUnsignedInteger stackbase,SQUnsignedInteger nseq,SQUnsignedInteger nop);
     SQInteger GetLine(SQInstruction *curr);
+    SQInlineCache *GetInlineCache(const SQInstruction *site)
+    {
+        if(!_inlinecachemap) AllocInlineCaches();
+        unsigned short n = _inlinecachemap[site - _instructions];
+        return n ? &_inlinecaches[n - 1] : NULL;
+    }
+    void AllocInlineCaches();
+    void FreeInlineCaches();
     bool Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
     static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize(){ _NULL_SQOBJECT_VECTOR(_literals,_nliterals); }
     SQObjectType GetType() {return OT_FUNCPROTO;}
 #endif
@@ -147,6 +203,17 @@ public:
     SQInteger _ndefaultparams;
     SQInteger *_defaultparams;
 
+    //allocated on the first instance access of a GET/SET site
+    SQInteger _ninlinecaches;
+    SQInlineCache *_inlinecaches;
+    unsigned short *_inlinecachemap;
+
+#ifdef SQ_JIT
+    //native code, compiled once the function gets hot(see sqjit.cpp)
+    SQJitCode *_jitcode;
+    SQInteger _jithotness;
+#endif
+
     SQInteger _ninstructions;
     SQInstruction _instructions[1];
 };
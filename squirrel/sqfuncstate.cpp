@@ -3,12 +3,14 @@
 */
 #include "sqpcheader.h"
 #ifndef NO_COMPILER
+#include <math.h>
 #include "sqcompiler.h"
 #include "sqstring.h"
 #include "sqfuncproto.h"
 #include "sqtable.h"
 #include "sqopcodes.h"
 #include "sqfuncstate.h"
+#include "sqvm.h"
 
 #ifdef _DEBUG_DUMP
 SQInstructionDesc g_InstrDesc[]={
@@ -73,6 +75,19 @@ SQInstructionDesc g_InstrDesc[]={
     {_SC("_OP_NEWSLOTA")},
     {_SC("_OP_GETBASE")},
     {_SC("_OP_CLOSE")},
+    {_SC("_OP_ADDI")},
+    {_SC("_OP_ADDF")},
+    {_SC("_OP_SUBI")},
+    {_SC("_OP_SUBF")},
+    {_SC("_OP_MULI")},
+    {_SC("_OP_MULF")},
+    {_SC("_OP_CMPI")},
+    {_SC("_OP_CMPF")},
+    {_SC("_OP_JCMPI")},
+    {_SC("_OP_JCMPF")},
+    {_SC("_OP_FORLOOP")},
+    {_SC("_OP_JMPTABLE")},
+    {_SC("_OP_JMPHASH")},
 };
 #endif
 void DumpLiteral(SQObjectPtr &o)
@@ -82,7 +97,7 @@ void DumpLiteral(SQObjectPtr &o)
         case OT_FLOAT: scprintf(_SC("{%f}"),_float(o));break;
         case OT_INTEGER: scprintf(_SC("{") _PRINT_INT_FMT _SC("}"),_integer(o));break;
         case OT_BOOL: scprintf(_SC("%s"),_integer(o)?_SC("true"):_SC("false"));break;
-        default: scprintf(_SC("(%s %p)"),GetTypeName(o),(void*)_rawval(o));break; break; //shut up compiler
+        default: scprintf(_SC("(%s %p)"),GetTypeName(o),(void*)_refcounted(o));break; break; //shut up compiler
     }
 }
 
@@ -369,7 +384,7 @@ SQInteger SQFuncState::GetLocalVariable(const SQObject &name)
     SQInteger locals=_vlocals.size();
     while(locals>=1){
         SQLocalVarInfo &lvi = _vlocals[locals-1];
-        if(sq_type(lvi._name)==OT_STRING && _string(lvi._name)==_string(name)){
+        if(sq_type(lvi._name)==OT_STRING && _streq(_string(lvi._name),_string(name))){
             return locals-1;
         }
         locals--;
@@ -388,7 +403,7 @@ SQInteger SQFuncState::GetOuterVariable(const SQObject &name)
 {
     SQInteger outers = _outervalues.size();
     for(SQInteger i = 0; i<outers; i++) {
-        if(_string(_outervalues[i]._name) == _string(name))
+        if(_streq(_string(_outervalues[i]._name),_string(name)))
             return i;
     }
     SQInteger pos=-1;
@@ -578,7 +593,10 @@ void SQFuncState::AddInstruction(SQInstruction &i)
 SQObject SQFuncState::CreateString(const SQChar *s,SQInteger len)
 {
     SQObjectPtr ns(SQString::Create(_sharedstate,s,len));
-    _table(_strings)->NewSlot(ns,(SQInteger)1);
+    //the table keeps the strings alive, a long one equal to a string already there is a copy(see sq_setinternlimit())
+    SQObjectPtr old;
+    if(_table(_strings)->Get(ns,old)) return old;
+    _table(_strings)->NewSlot(ns,ns);
     return ns;
 }
 
@@ -589,8 +607,993 @@ SQObject SQFuncState::CreateTable()
     return nt;
 }
 
+#ifndef SQ_NO_OPTIMIZER
+
+/*
+    optimizer, run by BuildProto() over the instructions of the function: folds the arithmetic
+    on constants and the branches on constant conditions, threads the jumps to jumps and drops
+    the instructions that can't be reached. Then the jumps, the line infos and the ranges of
+    the local variables are moved to the positions of the instructions left.
+    A constant is only looked for in the instructions before the one that reads it, in the same
+    block; its load is dropped when no local variable lives in the register, the compiler reads
+    a temporary only once.
+*/
+
+//where the instruction at pc jumps, -1 if it doesn't
+static SQInteger JumpTarget(const SQInstruction &i,SQInteger pc)
+{
+    switch(i.op) {
+    case _OP_JMP: case _OP_JZ: case _OP_JCMP: case _OP_AND: case _OP_OR:
+    case _OP_FOREACH: case _OP_PUSHTRAP:
+        return pc + 1 + i._arg1;
+    case _OP_POSTFOREACH: return pc + i._arg1;
+    case _OP_FORLOOP: return pc + 1 + FORLOOP_JUMP(i._arg1);
+    default: return -1;
+    }
+}
+
+static void SetJumpTarget(SQInstruction &i,SQInteger pc,SQInteger target)
+{
+    switch(i.op) {
+    case _OP_POSTFOREACH: i._arg1 = (SQInt32)(target - pc); break;
+    case _OP_FORLOOP: i._arg1 = FORLOOP_ARG1(target - pc - 1,FORLOOP_CMP(i._arg1),i._arg1 & (FORLOOP_LITERAL|FORLOOP_SUB)); break;
+    default: i._arg1 = (SQInt32)(target - pc - 1); break;
+    }
+}
+
+//same result of SQVM::ObjCmp() for two numbers
+static SQInteger FoldCmp(const SQObjectPtr &o1,const SQObjectPtr &o2)
+{
+    if(sq_type(o1) == sq_type(o2)) {
+        if(_rawval(o1) == _rawval(o2)) return 0;
+        if(sq_type(o1) == OT_INTEGER) return (_integer(o1) < _integer(o2)) ? -1 : 1;
+        return (_float(o1) < _float(o2)) ? -1 : 1;
+    }
+    if(sq_type(o1) == OT_INTEGER) {
+        if(_integer(o1) == _float(o2)) return 0;
+        return (_integer(o1) < _float(o2)) ? -1 : 1;
+    }
+    if(_float(o1) == _integer(o2)) return 0;
+    return (_float(o1) < _integer(o2)) ? -1 : 1;
+}
+
+//what the VM would compute for o1 op o2(arg3 is the BitWiseOP or the CmpOP), false if only the VM can tell
+static bool FoldOp(SQInteger op,SQInteger arg3,const SQObjectPtr &o1,const SQObjectPtr &o2,SQObjectPtr &res)
+{
+    SQInteger tmask = sq_type(o1)|sq_type(o2);
+    if(tmask != OT_INTEGER && tmask != OT_FLOAT && tmask != (OT_INTEGER|OT_FLOAT)) return false;
+    if(op == _OP_CMP || op == _OP_JCMP) {
+        SQInteger r = FoldCmp(o1,o2);
+        switch(arg3) {
+            case CMP_G: res = (r > 0); return true;
+            case CMP_GE: res = (r >= 0); return true;
+            case CMP_L: res = (r < 0); return true;
+            case CMP_LE: res = (r <= 0); return true;
+            default: res = r; return true;
+        }
+    }
+    if(tmask == OT_INTEGER) {
+        SQInteger i1 = _integer(o1), i2 = _integer(o2);
+        SQUnsignedInteger u1 = (SQUnsignedInteger)i1, u2 = (SQUnsignedInteger)i2;
+        switch(op) {
+            case _OP_ADD: res = (SQInteger)(u1 + u2); return true;
+            case _OP_SUB: res = (SQInteger)(u1 - u2); return true;
+            case _OP_MUL: res = (SQInteger)(u1 * u2); return true;
+            //the errors are left to the VM
+            case _OP_DIV: if(i2 == 0 || i2 == -1) return false; res = i1 / i2; return true;
+            case _OP_MOD: if(i2 == 0 || i2 == -1) return false; res = i1 % i2; return true;
+            case _OP_BITW:
+                switch(arg3) {
+                    case BW_AND: res = i1 & i2; return true;
+                    case BW_OR: res = i1 | i2; return true;
+                    case BW_XOR: res = i1 ^ i2; return true;
+                    case BW_SHIFTL: case BW_SHIFTR: case BW_USHIFTR:
+                        if(i2 < 0 || i2 >= (SQInteger)(sizeof(SQInteger) * 8)) return false;
+                        if(arg3 == BW_SHIFTL) res = (SQInteger)(u1 << i2);
+                        else if(arg3 == BW_SHIFTR) res = i1 >> i2;
+                        else res = (SQInteger)(u1 >> i2);
+                        return true;
+                }
+                return false;
+        }
+        return false;
+    }
+    SQFloat f1 = tofloat(o1), f2 = tofloat(o2), r;
+    switch(op) {
+        case _OP_ADD: r = f1 + f2; break;
+        case _OP_SUB: r = f1 - f2; break;
+        case _OP_MUL: r = f1 * f2; break;
+        case _OP_DIV: r = f1 / f2; break;
+        case _OP_MOD: r = SQFloat(fmod((double)f1,(double)f2)); break;
+        default: return false;
+    }
+    //a NaN can't be a key of the literals
+    if(r != r) return false;
+    res = r;
+    return true;
+}
+
+struct SQOptimizer
+{
+    SQOptimizer(SQFuncState *fs) : _fs(fs), _i(fs->_instructions)
+    {
+        _n = _i.size();
+        _dead.resize(_n + 1,0);
+        _targets.resize(_n + 1,0);
+        _slots.resize(_n + 1,0);
+        _jumps.resize(_n,-1);
+        _targets[0] = 1;
+        for(SQInteger pc = 0; pc < _n; pc++) {
+            _jumps[pc] = JumpTarget(_i[pc],pc);
+            if(_jumps[pc] >= 0 && _jumps[pc] <= _n) _targets[_jumps[pc]] = 1;
+            if(_i[pc].op == _OP_FOREACH && pc + 2 <= _n) _targets[pc + 2] = 1;
+            if(_i[pc].op == _OP_JMPTABLE || _i[pc].op == _OP_JMPHASH) {
+                for(SQInteger k = 1; k <= JMPTABLE_JUMPS(_i[pc]) && pc + k < _n; k++) _slots[pc + k] = 1;
+            }
+        }
+        _literals.resize(fs->_nliterals);
+        SQObjectPtr refidx,key,val;
+        SQInteger idx;
+        while((idx = _table(fs->_literals)->Next(false,refidx,key,val)) != -1) {
+            _literals[_integer(val)] = key;
+            refidx = idx;
+        }
+    }
+    //first instruction left at or after pc
+    SQInteger Live(SQInteger pc)
+    {
+        if(pc < 0 || pc > _n) pc = _n;
+        while(pc < _n && _dead[pc]) pc++;
+        return pc;
+    }
+    void Kill(SQInteger pc)
+    {
+        _dead[pc] = 1;
+        if(_targets[pc]) _targets[Live(pc)] = 1;
+    }
+    //instruction left before pc, -1 if a jump can land between the two
+    SQInteger Prev(SQInteger pc)
+    {
+        if(_targets[pc]) return -1;
+        for(SQInteger p = pc - 1; p >= 0; p--) {
+            if(!_dead[p]) return p;
+        }
+        return -1;
+    }
+    //the constant loaded in the register r by the instructions before pc, def is where
+    bool Constant(SQInteger pc,SQInteger r,SQObjectPtr &val,SQInteger &def)
+    {
+        for(SQInteger p = Prev(pc); p >= 0; p = Prev(p)) {
+            SQInstruction &i = _i[p];
+            def = p;
+            switch(i.op) {
+            case _OP_LOADINT: if(i._arg0 == r) { val = (SQInteger)i._arg1; return true; } break;
+            case _OP_LOADFLOAT: if(i._arg0 == r) { val = *((const SQFloat *)&i._arg1); return true; } break;
+            case _OP_LOADBOOL: if(i._arg0 == r) { val = i._arg1 ? true : false; return true; } break;
+            case _OP_LOAD: if(i._arg0 == r) { val = _literals[i._arg1]; return true; } break;
+            case _OP_DLOAD:
+                if(i._arg2 == r) { val = _literals[i._arg3]; return true; }
+                if(i._arg0 == r) { val = _literals[i._arg1]; return true; }
+                break;
+            default: return false;
+            }
+        }
+        return false;
+    }
+    //no local variable lives in r from def to pc
+    bool IsTemp(SQInteger r,SQInteger def,SQInteger pc)
+    {
+        for(SQUnsignedInteger k = 0; k < _fs->_localvarinfos.size(); k++) {
+            SQLocalVarInfo &lvi = _fs->_localvarinfos[k];
+            if((SQInteger)lvi._pos == r && lvi._start_op <= (SQUnsignedInteger)pc && lvi._end_op >= (SQUnsignedInteger)def) return false;
+        }
+        return true;
+    }
+    //drops the load of r done at def, if nothing else reads it
+    void DropLoad(SQInteger r,SQInteger def,SQInteger pc,SQInteger trg)
+    {
+        if(r != trg && !IsTemp(r,def,pc)) return;
+        SQInstruction &i = _i[def];
+        if(i.op != _OP_DLOAD) {
+            Kill(def);
+        }
+        else if(i._arg2 == r) {
+            i = SQInstruction(_OP_LOAD,i._arg0,i._arg1);
+        }
+        else {
+            i = SQInstruction(_OP_LOAD,i._arg2,i._arg3);
+        }
+    }
+    //the instruction at pc becomes a load of val
+    void SetLoad(SQInteger pc,SQInteger trg,const SQObjectPtr &val)
+    {
+        SQInstruction &i = _i[pc];
+        switch(sq_type(val)) {
+        case OT_BOOL:
+            i = SQInstruction(_OP_LOADBOOL,trg,_integer(val));
+            return;
+        case OT_INTEGER:
+            if(_integer(val) <= INT_MAX && _integer(val) > INT_MIN) {
+                i = SQInstruction(_OP_LOADINT,trg,_integer(val));
+                return;
+            }
+            break;
+        case OT_FLOAT:
+            if(sizeof(SQFloat) == sizeof(SQInt32)) {
+                SQFloat f = _float(val);
+                i = SQInstruction(_OP_LOADFLOAT,trg,*((SQInt32 *)&f));
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+        SQInteger idx = _fs->GetConstant(val);
+        if(idx == (SQInteger)_literals.size()) _literals.push_back(val);
+        i = SQInstruction(_OP_LOAD,trg,idx);
+    }
+    //arithmetic, bitwise and compare ops of two constants become a load of the result
+    void FoldBinary(SQInteger pc)
+    {
+        SQInstruction &i = _i[pc];
+        SQObjectPtr o1,o2,res;
+        SQInteger d1,d2,r1 = i._arg2,r2 = i._arg1,trg = i._arg0;
+        if(!Constant(pc,r1,o1,d1) || !Constant(pc,r2,o2,d2)) return;
+        if(!FoldOp(i.op,i._arg3,o1,o2,res)) return;
+        SetLoad(pc,trg,res);
+        DropLoad(r1,d1,pc,trg);
+        if(r2 != r1) DropLoad(r2,d2,pc,trg);
+    }
+    void FoldUnary(SQInteger pc)
+    {
+        SQInstruction &i = _i[pc];
+        SQObjectPtr o,res;
+        SQInteger d,r = i._arg1,trg = i._arg0;
+        if(!Constant(pc,r,o,d)) return;
+        switch(i.op) {
+        case _OP_NOT: res = SQVM::IsFalse(o); break;
+        case _OP_NEG:
+            if(sq_type(o) == OT_INTEGER) res = (SQInteger)(0 - (SQUnsignedInteger)_integer(o));
+            else if(sq_type(o) == OT_FLOAT) res = -_float(o);
+            else return;
+            break;
+        default:
+            if(sq_type(o) != OT_INTEGER) return;
+            res = ~_integer(o);
+            break;
+        }
+        SetLoad(pc,trg,res);
+        DropLoad(r,d,pc,trg);
+    }
+    //a branch on a constant condition becomes a jump or nothing
+    void FoldBranch(SQInteger pc)
+    {
+        SQInstruction &i = _i[pc];
+        SQObjectPtr o1,o2,res;
+        SQInteger d1,d2 = -1,r1 = i.op == _OP_JZ ? i._arg0 : i._arg2,r2 = i._arg0;
+        if(!Constant(pc,r1,o1,d1)) return;
+        if(i.op == _OP_JZ) {
+            res = o1;
+        }
+        else if(!Constant(pc,r2,o2,d2) || !FoldOp(_OP_JCMP,i._arg3,o1,o2,res)) {
+            return;
+        }
+        if(SQVM::IsFalse(res)) {
+            i = SQInstruction(_OP_JMP,0,i._arg1);
+        }
+        else {
+            Kill(pc);
+        }
+        DropLoad(r1,d1,pc,-1);
+        if(d2 >= 0 && r2 != r1) DropLoad(r2,d2,pc,-1);
+    }
+    //where a jump to pc ends, through the unconditional jumps
+    SQInteger Final(SQInteger pc)
+    {
+        pc = Live(pc);
+        for(SQInteger k = 0; k < _n && pc < _n && _i[pc].op == _OP_JMP; k++) {
+            SQInteger next = Live(_jumps[pc]);
+            if(next == pc) break;
+            pc = next;
+        }
+        return pc;
+    }
+    void Thread()
+    {
+        for(SQInteger pc = 0; pc < _n; pc++) {
+            if(_dead[pc] || _jumps[pc] < 0) continue;
+            switch(_i[pc].op) {
+            case _OP_JMP:
+                _jumps[pc] = Final(_jumps[pc]);
+                break;
+            //the backward jumps are left to _OP_JMP, where the VM counts the loops for the JIT
+            case _OP_JZ: case _OP_JCMP: case _OP_AND: case _OP_OR: {
+                SQInteger target = Final(_jumps[pc]);
+                if(target > pc) _jumps[pc] = target;
+                }
+                break;
+            }
+        }
+    }
+    void DropUnreachable()
+    {
+        sqvector<unsigned char> reached;
+        SQIntVec todo;
+        reached.resize(_n + 1,0);
+        todo.push_back(Live(0));
+        while(todo.size()) {
+            SQInteger pc = todo.back();
+            todo.pop_back();
+            if(pc >= _n || reached[pc]) continue;
+            reached[pc] = 1;
+            SQInstruction &i = _i[pc];
+            if(_jumps[pc] >= 0) todo.push_back(Live(_jumps[pc]));
+            if(i.op == _OP_FOREACH) todo.push_back(Live(pc + 2));
+            if(i.op == _OP_JMPTABLE || i.op == _OP_JMPHASH) {
+                for(SQInteger k = 1; k <= JMPTABLE_JUMPS(i); k++) todo.push_back(pc + k);
+            }
+            if(i.op != _OP_JMP && i.op != _OP_RETURN && i.op != _OP_THROW) todo.push_back(Live(pc + 1));
+        }
+        for(SQInteger pc = 0; pc < _n; pc++) {
+            if(!reached[pc]) _dead[pc] = 1;
+        }
+        //the jumps to the next instruction, from the last as dropping one can make another useless
+        for(SQInteger pc = _n - 1; pc >= 0; pc--) {
+            if(_dead[pc] || _slots[pc] || (_i[pc].op != _OP_JMP && _i[pc].op != _OP_JZ)) continue;
+            if(Live(_jumps[pc]) == Live(pc + 1)) Kill(pc);
+        }
+    }
+    void Compact()
+    {
+        SQIntVec newpos;
+        newpos.resize(_n + 1);
+        SQInteger count = 0;
+        for(SQInteger pc = 0; pc <= _n; pc++) {
+            newpos[pc] = count;
+            if(pc < _n && !_dead[pc]) count++;
+        }
+        for(SQInteger pc = 0; pc < _n; pc++) {
+            if(_dead[pc]) continue;
+            SQInstruction i = _i[pc];
+            if(_jumps[pc] >= 0) SetJumpTarget(i,newpos[pc],newpos[Live(_jumps[pc])]);
+            _i[newpos[pc]] = i;
+        }
+        _i.resize(count);
+
+        //an instruction dropped takes its line info to the next one, that keeps its own
+        SQLineInfoVec &li = _fs->_lineinfos;
+        SQInteger nli = 0;
+        for(SQUnsignedInteger k = 0; k < li.size(); k++) {
+            SQLineInfo l = li[k];
+            l._op = newpos[Live(l._op)];
+            if(l._op >= count && nli > 0) break;
+            if(nli > 0 && li[nli - 1]._op == l._op) nli--;
+            li[nli++] = l;
+        }
+        li.resize(nli);
+
+        SQLocalVarInfoVec &lv = _fs->_localvarinfos;
+        SQInteger nlv = 0;
+        for(SQUnsignedInteger k = 0; k < lv.size(); k++) {
+            SQLocalVarInfo l = lv[k];
+            SQInteger start = newpos[Live(l._start_op)];
+            if(l._end_op != UINT_MINUS_ONE) {
+                SQInteger end = newpos[Live(l._end_op + 1)] - 1;
+                //no instruction of its scope is left
+                if(end < start) continue;
+                l._end_op = end;
+            }
+            l._start_op = start;
+            lv[nlv++] = l;
+        }
+        lv.resize(nlv);
+    }
+    void Run()
+    {
+        for(SQInteger pc = 0; pc < _n; pc++) {
+            switch(_i[pc].op) {
+            case _OP_ADD: case _OP_SUB: case _OP_MUL: case _OP_DIV: case _OP_MOD:
+            case _OP_BITW: case _OP_CMP:
+                FoldBinary(pc);
+                break;
+            case _OP_NEG: case _OP_NOT: case _OP_BWNOT:
+                FoldUnary(pc);
+                break;
+            case _OP_JZ: case _OP_JCMP:
+                FoldBranch(pc);
+                break;
+            }
+        }
+        Thread();
+        DropUnreachable();
+        Compact();
+    }
+    SQFuncState *_fs;
+    SQInstructionVec &_i;
+    SQInteger _n;
+    sqvector<unsigned char> _dead;
+    sqvector<unsigned char> _targets;
+    //the jumps of the switch tables, kept where they are
+    sqvector<unsigned char> _slots;
+    SQIntVec _jumps;
+    SQObjectPtrVec _literals;
+};
+
+//the instruction can change the register r
+static bool Writes(const SQInstruction &i,SQInteger r)
+{
+    switch(i.op) {
+    case _OP_LINE: case _OP_JMP: case _OP_JZ: case _OP_JCMP: case _OP_JCMPI: case _OP_JCMPF:
+    case _OP_RETURN: case _OP_THROW: case _OP_POPTRAP: case _OP_CLOSE: case _OP_APPENDARRAY:
+    case _OP_NEWSLOTA: case _OP_POSTFOREACH: case _OP_JMPTABLE: case _OP_JMPHASH:
+        return false;
+    case _OP_DLOAD: case _OP_DMOVE: return i._arg0 == r || i._arg2 == r;
+    case _OP_INCL: case _OP_PINCL: return i._arg0 == r || i._arg1 == r;
+    case _OP_PREPCALL: case _OP_PREPCALLK: return i._arg0 == r || i._arg3 == r;
+    case _OP_LOADNULLS: return r >= i._arg0 && r < i._arg0 + i._arg1;
+    case _OP_FOREACH: return r >= i._arg2 && r <= i._arg2 + 2;
+    //the frame of the callee starts at arg2
+    case _OP_CALL: case _OP_TAILCALL: return i._arg0 == r || r >= i._arg2;
+    case _OP_YIELD: return true;
+    default: return i._arg0 == r;
+    }
+}
+
+//f or one of its nested functions changes its outer variable n
+static bool SetsOuter(SQFunctionProto *f,SQInteger n)
+{
+    for(SQInteger pc = 0; pc < f->_ninstructions; pc++) {
+        if(f->_instructions[pc].op == _OP_SETOUTER && f->_instructions[pc]._arg1 == n) return true;
+    }
+    for(SQInteger k = 0; k < f->_nfunctions; k++) {
+        SQFunctionProto *c = _funcproto(f->_functions[k]);
+        for(SQInteger o = 0; o < c->_noutervalues; o++) {
+            if(c->_outervalues[o]._type == otOUTER && _integer(c->_outervalues[o]._src) == n && SetsOuter(c,o)) return true;
+        }
+    }
+    return false;
+}
+
+/*
+    inliner, run before the optimizer: a call of a local function declared with 'local function'
+    and never assigned again is replaced by the body of the function, when that is short and has
+    no loops, nested functions, traps or yields. The registers of the callee are moved above the
+    base of the call, where the arguments already are; 'this' stays in the register 0 of the caller,
+    that holds the same object and keeps the lookups that fall back to the root table working.
+    The outer variables become moves from and to the locals they refer to, the default parameters
+    that aren't passed are loaded again when they are constants. The locals of the callee are added
+    to the ones of the caller over the inlined code.
+    An inlined function has no frame of its own, what getstackinfos() and the debug hook see changes;
+    with the debug infos on the functions have _OP_LINE and are never inlined.
+*/
+
+#define INLINE_MAXSIZE 16
+
+struct SQInliner
+{
+    SQInliner(SQFuncState *fs) : _fs(fs), _i(fs->_instructions) {}
+    SQInteger Reg(SQInteger r) { return r == 0 ? 0 : _base + r; }
+    SQInteger Lit(SQInteger n) { return _fs->GetConstant(_f->_literals[n]); }
+    void Emit(const SQInstruction &i,SQInteger target = -2)
+    {
+        _code.push_back(i);
+        _targets.push_back(target);
+    }
+    //pc where the closure called at pc is created, -1 if it isn't always the same local function
+    SQInteger Callee(SQInteger pc)
+    {
+        SQInteger r = _i[pc]._arg1, n = _i.size();
+        for(SQUnsignedInteger k = 0; k < _fs->_localvarinfos.size(); k++) {
+            SQLocalVarInfo &lvi = _fs->_localvarinfos[k];
+            SQInteger start = lvi._start_op, end = lvi._end_op == UINT_MINUS_ONE ? n - 1 : (SQInteger)lvi._end_op;
+            if((SQInteger)lvi._pos != r || start > pc || end < pc) continue;
+            SQInstruction &c = _i[start - 1];
+            if(start == 0 || c.op != _OP_CLOSURE || c._arg0 != r || c._arg2 != 0xFF) return -1;
+            for(SQInteger p = start; p <= end && p < n; p++) {
+                if(Writes(_i[p],r)) return -1;
+                if(_i[p].op != _OP_CLOSURE) continue;
+                SQFunctionProto *f = _funcproto(_fs->_functions[_i[p]._arg1]);
+                for(SQInteger o = 0; o < f->_noutervalues; o++) {
+                    if(f->_outervalues[o]._type == otLOCAL && _integer(f->_outervalues[o]._src) == r && SetsOuter(f,o)) return -1;
+                }
+            }
+            return start - 1;
+        }
+        return -1;
+    }
+    //the constant the register r holds at pc
+    bool Constant(SQInteger pc,SQInteger r,SQInstruction &load)
+    {
+        for(SQInteger p = pc - 1; p >= 0; p--) {
+            SQInstruction &i = _i[p];
+            switch(i.op) {
+            case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: case _OP_LOAD:
+                if(i._arg0 == r) load = i;
+                break;
+            case _OP_DLOAD:
+                if(i._arg2 == r) load = SQInstruction(_OP_LOAD,0,i._arg3);
+                else if(i._arg0 == r) load = SQInstruction(_OP_LOAD,0,i._arg1);
+                break;
+            case _OP_LOADNULLS:
+                if(r >= i._arg0 && r < i._arg0 + i._arg1) load = SQInstruction(_OP_LOADNULLS,0,1);
+                break;
+            default: return false;
+            }
+            if(load.op == _OP_LINE) continue;
+            //no jump lands after the load
+            for(SQInteger k = 0; k < (SQInteger)_i.size(); k++) {
+                SQInteger t = JumpTarget(_i[k],k);
+                if(t > p && t <= pc) return false;
+            }
+            return true;
+        }
+        return false;
+    }
+    bool Translate(SQInteger pc)
+    {
+        SQInstruction i = _f->_instructions[pc];
+        switch(i.op) {
+        case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: case _OP_LOADNULLS:
+        case _OP_LOADROOT: case _OP_THROW:
+            i._arg0 = Reg(i._arg0);
+            break;
+        case _OP_LOAD:
+            i._arg0 = Reg(i._arg0); i._arg1 = Lit(i._arg1);
+            break;
+        case _OP_DLOAD:
+            Emit(SQInstruction(_OP_LOAD,Reg(i._arg0),Lit(i._arg1)));
+            i = SQInstruction(_OP_LOAD,Reg(i._arg2),Lit(i._arg3));
+            break;
+        case _OP_MOVE: case _OP_NEG: case _OP_NOT: case _OP_BWNOT: case _OP_TYPEOF: case _OP_CLONE:
+        case _OP_INCL: case _OP_PINCL:
+            i._arg0 = Reg(i._arg0); i._arg1 = Reg(i._arg1);
+            break;
+        case _OP_DMOVE:
+            i._arg0 = Reg(i._arg0); i._arg1 = Reg(i._arg1); i._arg2 = Reg(i._arg2); i._arg3 = Reg(i._arg3);
+            break;
+        case _OP_GETK:
+            i._arg0 = Reg(i._arg0); i._arg1 = Lit(i._arg1); i._arg2 = Reg(i._arg2);
+            break;
+        case _OP_GET: case _OP_EXISTS: case _OP_INSTANCEOF: case _OP_DELETE: case _OP_INC: case _OP_PINC:
+        case _OP_ADD: case _OP_SUB: case _OP_MUL: case _OP_DIV: case _OP_MOD: case _OP_BITW: case _OP_CMP:
+        case _OP_ADDI: case _OP_ADDF: case _OP_SUBI: case _OP_SUBF: case _OP_MULI: case _OP_MULF:
+        case _OP_CMPI: case _OP_CMPF:
+            i._arg0 = Reg(i._arg0); i._arg1 = Reg(i._arg1); i._arg2 = Reg(i._arg2);
+            break;
+        case _OP_SET: case _OP_NEWSLOT:
+            if(i._arg0 != 0xFF) i._arg0 = Reg(i._arg0);
+            i._arg1 = Reg(i._arg1); i._arg2 = Reg(i._arg2); i._arg3 = Reg(i._arg3);
+            break;
+        case _OP_EQ: case _OP_NE:
+            i._arg0 = Reg(i._arg0); i._arg1 = i._arg3 ? Lit(i._arg1) : Reg(i._arg1); i._arg2 = Reg(i._arg2);
+            break;
+        case _OP_PREPCALL: case _OP_PREPCALLK:
+            i._arg0 = Reg(i._arg0); i._arg1 = i.op == _OP_PREPCALLK ? Lit(i._arg1) : Reg(i._arg1);
+            i._arg2 = Reg(i._arg2); i._arg3 = Reg(i._arg3);
+            break;
+        case _OP_CALL:
+            if(i._arg0 != 0xFF) i._arg0 = Reg(i._arg0);
+            i._arg1 = Reg(i._arg1); i._arg2 = Reg(i._arg2);
+            break;
+        case _OP_NEWOBJ:
+            if(i._arg3 == NOT_CLASS) return false;
+            i._arg0 = Reg(i._arg0);
+            break;
+        case _OP_APPENDARRAY:
+            i._arg0 = Reg(i._arg0);
+            if(i._arg2 == AAT_STACK) i._arg1 = Reg(i._arg1);
+            else if(i._arg2 == AAT_LITERAL) i._arg1 = Lit(i._arg1);
+            break;
+        case _OP_JMP:
+            Emit(i,JumpTarget(i,pc));
+            return true;
+        case _OP_JZ: case _OP_JCMP: case _OP_JCMPI: case _OP_JCMPF: case _OP_AND: case _OP_OR:
+            //backward jumps are loops
+            if(JumpTarget(i,pc) <= pc) return false;
+            i._arg0 = Reg(i._arg0); i._arg2 = Reg(i._arg2);
+            Emit(i,JumpTarget(i,pc));
+            return true;
+        case _OP_GETOUTER: {
+            SQOuterVar &o = _f->_outervalues[i._arg1];
+            if(o._type == otLOCAL) i = SQInstruction(_OP_MOVE,Reg(i._arg0),_integer(o._src));
+            else { i._arg0 = Reg(i._arg0); i._arg1 = (SQInt32)_integer(o._src); }
+            }
+            break;
+        case _OP_SETOUTER: {
+            SQOuterVar &o = _f->_outervalues[i._arg1];
+            if(o._type == otLOCAL) {
+                Emit(SQInstruction(_OP_MOVE,_integer(o._src),Reg(i._arg2)));
+                if(i._arg0 == 0xFF) return true;
+                i = SQInstruction(_OP_MOVE,Reg(i._arg0),Reg(i._arg2));
+            }
+            else {
+                if(i._arg0 != 0xFF) i._arg0 = Reg(i._arg0);
+                i._arg1 = (SQInt32)_integer(o._src); i._arg2 = Reg(i._arg2);
+            }
+            }
+            break;
+        case _OP_RETURN:
+            if(_trg != 0xFF) {
+                if(i._arg0 == 0xFF) Emit(SQInstruction(_OP_LOADNULLS,_trg,1));
+                else if(Reg(i._arg1) != _trg) Emit(SQInstruction(_OP_MOVE,_trg,Reg(i._arg1)));
+            }
+            Emit(SQInstruction(_OP_JMP,0,0),-1);
+            return true;
+        default:
+            return false;
+        }
+        Emit(i);
+        return true;
+    }
+    //the body of the function created at closurepc, that replaces the call at pc
+    bool Expand(SQInteger pc,SQInteger closurepc)
+    {
+        SQInstruction &call = _i[pc];
+        SQInteger nargs = call._arg3, nparams = _f->_nparameters, ndefaults = _f->_ndefaultparams;
+        _base = call._arg2;
+        _trg = call._arg0;
+        _code.resize(0);
+        _targets.resize(0);
+        if(nargs > nparams || nargs < nparams - ndefaults || _base + _f->_stacksize >= MAX_FUNC_STACKSIZE) return false;
+        for(SQInteger p = nargs; p < nparams; p++) {
+            SQInstruction load(_OP_LINE);
+            if(!Constant(closurepc,_f->_defaultparams[p - (nparams - ndefaults)],load)) return false;
+            load._arg0 = (unsigned char)Reg(p);
+            Emit(load);
+        }
+        SQIntVec newpos;
+        newpos.resize(_f->_ninstructions + 1);
+        for(SQInteger k = 0; k < _f->_ninstructions; k++) {
+            newpos[k] = _code.size();
+            if(!Translate(k)) return false;
+        }
+        newpos[_f->_ninstructions] = _code.size();
+        for(SQUnsignedInteger k = 0; k < _code.size(); k++) {
+            if(_targets[k] == -2) continue;
+            SetJumpTarget(_code[k],k,_targets[k] == -1 ? _code.size() : newpos[_targets[k]]);
+        }
+        return true;
+    }
+    void Run()
+    {
+        for(SQInteger pc = 0; pc < (SQInteger)_i.size(); pc++) {
+            if(_i[pc].op != _OP_CALL) continue;
+            SQInteger closurepc = Callee(pc);
+            if(closurepc < 0) continue;
+            _f = _funcproto(_fs->_functions[_i[closurepc]._arg1]);
+            if(_f->_varparams || _f->_bgenerator || _f->_nfunctions || _f->_ninstructions > INLINE_MAXSIZE) continue;
+            bool recursive = false;
+            for(SQInteger o = 0; o < _f->_noutervalues; o++) {
+                if(_f->_outervalues[o]._type == otLOCAL && _integer(_f->_outervalues[o]._src) == _i[pc]._arg1) recursive = true;
+            }
+            if(recursive || !Expand(pc,closurepc)) continue;
+            if(_base + _f->_stacksize > _fs->_stacksize) _fs->_stacksize = _base + _f->_stacksize;
+            _fs->Splice(pc,_code);
+            //the locals of the callee keep living in the caller, the optimizer must not take them as temporaries
+            for(SQInteger k = 0; k < _f->_nlocalvarinfos; k++) {
+                SQLocalVarInfo lvi(_f->_localvarinfos[k]);
+                if(lvi._pos == 0) continue;
+                lvi._pos = Reg(lvi._pos);
+                lvi._start_op = pc;
+                lvi._end_op = pc + _code.size() - 1;
+                _fs->_localvarinfos.push_back(lvi);
+            }
+            pc += _code.size() - 1;
+        }
+    }
+    SQFuncState *_fs;
+    SQInstructionVec &_i;
+    SQFunctionProto *_f;
+    SQInteger _base,_trg;
+    SQInstructionVec _code;
+    SQIntVec _targets;
+};
+
+#ifdef SQ_LOOP_OPTIMIZER
+//the arguments of the instruction that are registers it reads, -1 if the instruction isn't known here
+static SQInteger Reads(const SQInstruction &i,SQInteger *args)
+{
+    SQInteger n = 0;
+    switch(i.op) {
+    case _OP_LINE: case _OP_LOAD: case _OP_LOADINT: case _OP_LOADFLOAT: case _OP_LOADBOOL: case _OP_DLOAD:
+    case _OP_LOADNULLS: case _OP_LOADROOT: case _OP_GETOUTER: case _OP_JMP:
+        break;
+    case _OP_MOVE: case _OP_NEG: case _OP_NOT: case _OP_BWNOT: case _OP_TYPEOF: case _OP_CLONE:
+        args[n++] = 1;
+        break;
+    case _OP_GETK: case _OP_AND: case _OP_OR: case _OP_SETOUTER:
+        args[n++] = 2;
+        break;
+    case _OP_GET: case _OP_DELETE: case _OP_EXISTS: case _OP_INSTANCEOF:
+    case _OP_ADD: case _OP_SUB: case _OP_MUL: case _OP_DIV: case _OP_MOD: case _OP_BITW: case _OP_CMP:
+    case _OP_ADDI: case _OP_ADDF: case _OP_SUBI: case _OP_SUBF: case _OP_MULI: case _OP_MULF:
+    case _OP_CMPI: case _OP_CMPF:
+        args[n++] = 1; args[n++] = 2;
+        break;
+    case _OP_EQ: case _OP_NE:
+        if(!i._arg3) args[n++] = 1;
+        args[n++] = 2;
+        break;
+    case _OP_SET: case _OP_NEWSLOT:
+        args[n++] = 1; args[n++] = 2; args[n++] = 3;
+        break;
+    case _OP_DMOVE:
+        args[n++] = 1; args[n++] = 3;
+        break;
+    case _OP_JZ: case _OP_THROW:
+        args[n++] = 0;
+        break;
+    case _OP_JCMP: case _OP_JCMPI: case _OP_JCMPF:
+        args[n++] = 0; args[n++] = 2;
+        break;
+    case _OP_RETURN:
+        if(i._arg0 != 0xFF) args[n++] = 1;
+        break;
+    case _OP_APPENDARRAY:
+        args[n++] = 0;
+        if(i._arg2 == AAT_STACK) args[n++] = 1;
+        break;
+    default:
+        return -1;
+    }
+    return n;
+}
+
+static SQInteger Arg(const SQInstruction &i,SQInteger n)
+{
+    switch(n) {
+    case 0: return i._arg0;
+    case 1: return i._arg1;
+    case 2: return i._arg2;
+    default: return i._arg3;
+    }
+}
+
+static void SetArg(SQInstruction &i,SQInteger n,SQInteger val)
+{
+    switch(n) {
+    case 0: i._arg0 = (unsigned char)val; break;
+    case 1: i._arg1 = (SQInt32)val; break;
+    case 2: i._arg2 = (unsigned char)val; break;
+    default: i._arg3 = (unsigned char)val; break;
+    }
+}
+
+/*
+    loop pass, run after the optimizer: the constants loaded in the body of a loop that makes
+    no calls are loaded once before it, the same constant in a single register. They go in
+    registers above the ones the function already uses; nothing but a call writes there,
+    the metamethods and the generators run above the whole frame. The loops that don't
+    nest share the same registers.
+*/
+struct SQLoopOptimizer
+{
+    struct Hoist { SQInteger _load,_reader,_reg; };
+    SQLoopOptimizer(SQFuncState *fs) : _fs(fs), _i(fs->_instructions), _base(fs->_stacksize) {}
+    void Scan()
+    {
+        SQInteger n = _i.size();
+        _targets.resize(0);
+        _targets.resize(n + 1,0);
+        _slots.resize(0);
+        _slots.resize(n + 1,0);
+        _ends.resize(0);
+        _ends.resize(n,-1);
+        for(SQInteger pc = 0; pc < n; pc++) {
+            SQInteger t = JumpTarget(_i[pc],pc);
+            if(t >= 0 && t <= n) _targets[t] = 1;
+            if(_i[pc].op == _OP_FOREACH && pc + 2 <= n) _targets[pc + 2] = 1;
+            if(_i[pc].op == _OP_JMPTABLE || _i[pc].op == _OP_JMPHASH) {
+                for(SQInteger k = 1; k <= JMPTABLE_JUMPS(_i[pc]) && pc + k < n; k++) _slots[pc + k] = 1;
+            }
+            //a jump back closes a loop, the last one is its end
+            if(t >= 0 && t <= pc) _ends[t] = pc;
+        }
+    }
+    //the loop from h to e can be entered only from h and makes no calls
+    bool Eligible(SQInteger h,SQInteger e)
+    {
+        if(_slots[h]) return false;
+        for(SQInteger pc = 0; pc < (SQInteger)_i.size(); pc++) {
+            SQInteger t = JumpTarget(_i[pc],pc);
+            if((pc < h || pc > e) && t > h && t <= e) return false;
+            if(pc < h || pc > e) continue;
+            switch(_i[pc].op) {
+            case _OP_CALL: case _OP_TAILCALL: case _OP_YIELD: case _OP_RESUME: return false;
+            default: break;
+            }
+        }
+        return true;
+    }
+    //no local variable lives in r at pc
+    bool IsTemp(SQInteger r,SQInteger pc)
+    {
+        for(SQUnsignedInteger k = 0; k < _fs->_localvarinfos.size(); k++) {
+            SQLocalVarInfo &lvi = _fs->_localvarinfos[k];
+            if((SQInteger)lvi._pos == r && lvi._start_op <= (SQUnsignedInteger)pc && lvi._end_op >= (SQUnsignedInteger)pc) return false;
+        }
+        return true;
+    }
+    //the instruction that reads the temporary loaded at p, in the same block; -1 if there isn't one
+    SQInteger Reader(SQInteger p,SQInteger e)
+    {
+        SQInteger r = _i[p]._arg0, args[4];
+        for(SQInteger pc = p + 1; pc <= e; pc++) {
+            if(_targets[pc]) return -1;
+            SQInteger n = Reads(_i[pc],args);
+            if(n < 0) return -1;
+            for(SQInteger k = 0; k < n; k++) {
+                if(Arg(_i[pc],args[k]) == r) return Consumed(pc,r,e) ? pc : -1;
+            }
+            if(Writes(_i[pc],r) || JumpTarget(_i[pc],pc) >= 0) return -1;
+        }
+        return -1;
+    }
+    //nothing after the reader at q reads r again before the end of the block
+    bool Consumed(SQInteger q,SQInteger r,SQInteger e)
+    {
+        SQInteger args[4];
+        if(Writes(_i[q],r) || JumpTarget(_i[q],q) >= 0) return true;
+        for(SQInteger pc = q + 1; pc <= e && !_targets[pc]; pc++) {
+            SQInteger n = Reads(_i[pc],args);
+            if(n < 0) return true;
+            for(SQInteger k = 0; k < n; k++) {
+                if(Arg(_i[pc],args[k]) == r) return false;
+            }
+            if(Writes(_i[pc],r) || JumpTarget(_i[pc],pc) >= 0) return true;
+        }
+        return true;
+    }
+    SQInteger Collect(SQInteger h,SQInteger e,sqvector<Hoist> &hoists,SQInstructionVec &code)
+    {
+        for(SQInteger p = h; p <= e; p++) {
+            SQInstruction &i = _i[p];
+            if(i.op != _OP_LOADINT && i.op != _OP_LOADFLOAT && i.op != _OP_LOADBOOL && i.op != _OP_LOAD) continue;
+            if(i._arg0 >= _base || !IsTemp(i._arg0,p)) continue;
+            Hoist hs;
+            if((hs._reader = Reader(p,e)) < 0) continue;
+            hs._load = p;
+            hs._reg = -1;
+            for(SQUnsignedInteger k = 0; k < code.size(); k++) {
+                if(code[k].op == i.op && code[k]._arg1 == i._arg1) hs._reg = code[k]._arg0;
+            }
+            if(hs._reg < 0) {
+                if(_base + (SQInteger)code.size() >= MAX_FUNC_STACKSIZE - 1) continue;
+                hs._reg = _base + code.size();
+                code.push_back(SQInstruction((SQOpcode)i.op,hs._reg,i._arg1));
+            }
+            hoists.push_back(hs);
+        }
+        return hoists.size();
+    }
+    void Move(SQInteger h,SQInteger e,sqvector<Hoist> &hoists,SQInstructionVec &code)
+    {
+        SQInteger args[4];
+        for(SQUnsignedInteger k = 0; k < hoists.size(); k++) {
+            SQInstruction &reader = _i[hoists[k]._reader];
+            SQInteger r = _i[hoists[k]._load]._arg0, n = Reads(reader,args);
+            for(SQInteger a = 0; a < n; a++) {
+                if(Arg(reader,args[a]) == r) SetArg(reader,args[a],hoists[k]._reg);
+            }
+        }
+        SQInstructionVec none;
+        for(SQInteger k = hoists.size() - 1; k >= 0; k--) {
+            _fs->Splice(hoists[k]._load,none);
+            e--;
+        }
+        SQIntVec back;
+        for(SQInteger pc = h; pc <= e; pc++) {
+            if(JumpTarget(_i[pc],pc) == h) back.push_back(pc);
+        }
+        SQInteger grow = code.size();
+        code.push_back(_i[h]);
+        _fs->Splice(h,code);
+        for(SQUnsignedInteger k = 0; k < back.size(); k++) {
+            SetJumpTarget(_i[back[k] + grow],back[k] + grow,h + grow);
+        }
+        if(_base + grow > _fs->_stacksize) _fs->_stacksize = _base + grow;
+    }
+    //moves the constants out of one loop, the last outermost one that has any
+    bool Step()
+    {
+        Scan();
+        SQInteger n = _i.size();
+        SQIntVec eligible;
+        eligible.resize(n,0);
+        for(SQInteger h = 0; h < n; h++) {
+            if(_ends[h] >= 0) eligible[h] = Eligible(h,_ends[h]);
+        }
+        for(SQInteger h = n - 1; h >= 0; h--) {
+            if(!eligible[h]) continue;
+            bool inner = false;
+            for(SQInteger o = 0; o < h && !inner; o++) {
+                if(eligible[o] && _ends[o] >= _ends[h]) inner = true;
+            }
+            sqvector<Hoist> hoists;
+            SQInstructionVec code;
+            if(inner || !Collect(h,_ends[h],hoists,code)) continue;
+            Move(h,_ends[h],hoists,code);
+            return true;
+        }
+        return false;
+    }
+    void Run()
+    {
+        while(Step());
+    }
+    SQFuncState *_fs;
+    SQInstructionVec &_i;
+    SQInteger _base;
+    SQIntVec _targets,_slots,_ends;
+};
+#endif
+
+void SQFuncState::Splice(SQInteger pos,const SQInstructionVec &code)
+{
+    SQInteger n = _instructions.size(), grow = code.size() - 1;
+    SQIntVec targets;
+    targets.resize(n);
+    for(SQInteger pc = 0; pc < n; pc++) {
+        SQInteger t = JumpTarget(_instructions[pc],pc);
+        targets[pc] = t > pos ? t + grow : t;
+    }
+    if(grow > 0) {
+        _instructions.resize(n + grow);
+        for(SQInteger pc = n - 1; pc > pos; pc--) _instructions[pc + grow] = _instructions[pc];
+    }
+    else if(grow < 0) {
+        for(SQInteger pc = pos + 1; pc < n; pc++) _instructions[pc + grow] = _instructions[pc];
+        _instructions.resize(n + grow);
+    }
+    for(SQInteger k = 0; k <= grow; k++) _instructions[pos + k] = code[k];
+    for(SQInteger pc = 0; pc < n; pc++) {
+        if(pc == pos || targets[pc] < 0) continue;
+        SQInteger at = pc > pos ? pc + grow : pc;
+        SetJumpTarget(_instructions[at],at,targets[pc]);
+    }
+    //an instruction removed takes its line info to the next one, that keeps its own
+    SQInteger nli = 0;
+    for(SQUnsignedInteger k = 0; k < _lineinfos.size(); k++) {
+        SQLineInfo l = _lineinfos[k];
+        if(l._op > pos) l._op += grow;
+        if(nli > 0 && _lineinfos[nli - 1]._op == l._op) nli--;
+        _lineinfos[nli++] = l;
+    }
+    _lineinfos.resize(nli);
+    SQInteger nlv = 0;
+    for(SQUnsignedInteger k = 0; k < _localvarinfos.size(); k++) {
+        SQLocalVarInfo lvi(_localvarinfos[k]);
+        if(lvi._start_op > (SQUnsignedInteger)pos) lvi._start_op += grow;
+        if(lvi._end_op != UINT_MINUS_ONE && lvi._end_op >= (SQUnsignedInteger)pos) {
+            lvi._end_op += grow;
+            //no instruction of its scope is left
+            if(lvi._end_op + 1 == lvi._start_op) continue;
+        }
+        _localvarinfos[nlv++] = lvi;
+    }
+    _localvarinfos.resize(nlv);
+}
+
+void SQFuncState::Optimize()
+{
+    if(_instructions.size() == 0) return;
+    SQInliner inliner(this);
+    inliner.Run();
+    SQOptimizer o(this);
+    o.Run();
+#ifdef SQ_LOOP_OPTIMIZER
+    SQLoopOptimizer l(this);
+    l.Run();
+#endif
+}
+
+#endif
+
 SQFunctionProto *SQFuncState::BuildProto()
 {
+#ifndef SQ_NO_OPTIMIZER
+    Optimize();
+#endif
 
     SQFunctionProto *f=SQFunctionProto::Create(_ss,_instructions.size(),
         _nliterals,_parameters.size(),_functions.size(),_outervalues.size(),
@@ -39,6 +39,11 @@ struct SQFuncState
     SQInteger CalcStackFrameSize();
     void AddLineInfos(SQInteger line,bool lineop,bool force=false);
     SQFunctionProto *BuildProto();
+#ifndef SQ_NO_OPTIMIZER
+    void Optimize();
+    //replaces the instruction at pos with code, the jumps, line infos and local variables after it move
+    void Splice(SQInteger pos,const SQInstructionVec &code);
+#endif
     SQInteger AllocStackPos();
     SQInteger PushTarget(SQInteger n=-1);
     SQInteger PopTarget();
@@ -0,0 +1,830 @@
+/*
+    see copyright notice in squirrel.h
+*/
+#include "sqpcheader.h"
+#include "sqopcodes.h"
+#include "sqvm.h"
+#include "sqfuncproto.h"
+#include "sqclosure.h"
+#include "sqstring.h"
+#include "sqtable.h"
+#include "sqarray.h"
+#include "sqclass.h"
+#include "sqjit.h"
+
+#ifdef SQ_JIT
+
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+    Baseline template JIT.
+    Every instruction of a hot function is translated in a fixed sequence of x86-64 code;
+    integer arithmetic, comparisons, jumps and moves between scalars run inline, everything
+    else calls a helper that does what the interpreter would do. Calls, returns, generators
+    and exception traps leave the native code and are run by the interpreter, that enters
+    the native code again through sq_jit_run().
+
+    registers while the native code runs:
+        rbx = the VM
+        r12 = &_stack._vals[_stackbase](reloaded after every helper)
+        r13 = the native address of every instruction(SQJitCode::_targets)
+        r14 = result of the last helper
+*/
+
+#define _i_ (*i)
+#define arg0 (_i_._arg0)
+#define sarg0 ((SQInteger)*((const signed char *)&_i_._arg0))
+#define arg1 (_i_._arg1)
+#define sarg1 (*((const SQInt32 *)&_i_._arg1))
+#define arg2 (_i_._arg2)
+#define arg3 (_i_._arg3)
+#define sarg3 ((SQInteger)*((const signed char *)&_i_._arg3))
+
+#define STK(a) v->_stack._vals[v->_stackbase+(a)]
+#define TARGET STK(arg0)
+#define COND_LITERAL (arg3!=0?v->ci->_literals[arg1]:STK(arg1))
+
+#define _JIT_GUARD(exp) { if(!(exp)) return SQ_JIT_THROW; }
+#define _JIT_JUMP(n) { v->ci->_ip += (n); return SQ_JIT_JUMP; }
+
+//helpers called by the native code, the same as the interpreter's handlers
+typedef SQInteger (*SQJitHelper)(SQVM *v,SQInstruction *i);
+#define _JIT_HELPER(name) static SQInteger name(SQVM *v,SQInstruction *i)
+#define _JIT_BEGIN() v->ci->_ip = i + 1
+
+_JIT_HELPER(jit_load) { _JIT_BEGIN(); TARGET = v->ci->_literals[arg1]; return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_loadint) { _JIT_BEGIN(); TARGET = (SQInteger)((SQInt32)arg1); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_loadfloat) { _JIT_BEGIN(); TARGET = *((const SQFloat *)&arg1); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_dload) { _JIT_BEGIN(); TARGET = v->ci->_literals[arg1]; STK(arg2) = v->ci->_literals[arg3]; return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_loadbool) { _JIT_BEGIN(); TARGET = arg1?true:false; return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_move) { _JIT_BEGIN(); TARGET = STK(arg1); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_dmove) { _JIT_BEGIN(); STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_loadnulls) { _JIT_BEGIN(); for(SQInt32 n=0; n < arg1; n++) STK(arg0+n).Null(); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_prepcall)
+{
+    _JIT_BEGIN();
+    SQObjectPtr &key = _i_.op == _OP_PREPCALLK?(v->ci->_literals)[arg1]:STK(arg1);
+    SQObjectPtr &o = STK(arg2);
+    if (sq_type(o) == OT_INSTANCE ? !v->InlineCacheGet(_instance(o), key, v->temp_reg)
+        : sq_type(o) != OT_TABLE || !v->InlineCacheGetTable(_table(o), key, v->temp_reg)) {
+        _JIT_GUARD(v->Get(o, key, v->temp_reg,0,arg2));
+    }
+    STK(arg3) = o;
+    _Swap(TARGET,v->temp_reg);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_getk)
+{
+    _JIT_BEGIN();
+    if (sq_type(STK(arg2)) == OT_INSTANCE && v->InlineCacheGet(_instance(STK(arg2)), v->ci->_literals[arg1], TARGET)) return SQ_JIT_NEXT;
+    if (sq_type(STK(arg2)) == OT_TABLE && v->InlineCacheGetTable(_table(STK(arg2)), v->ci->_literals[arg1], TARGET)) return SQ_JIT_NEXT;
+    _JIT_GUARD(v->Get(STK(arg2), v->ci->_literals[arg1], v->temp_reg, 0,arg2));
+    _Swap(TARGET,v->temp_reg);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_get)
+{
+    _JIT_BEGIN();
+    if (sq_type(STK(arg1)) == OT_INSTANCE && v->InlineCacheGet(_instance(STK(arg1)), STK(arg2), TARGET)) return SQ_JIT_NEXT;
+    _JIT_GUARD(v->Get(STK(arg1), STK(arg2), v->temp_reg, 0,arg1));
+    _Swap(TARGET,v->temp_reg);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_set)
+{
+    _JIT_BEGIN();
+    if (sq_type(STK(arg1)) != OT_INSTANCE || !v->InlineCacheSet(_instance(STK(arg1)), STK(arg2), STK(arg3))) {
+        _JIT_GUARD(v->Set(STK(arg1), STK(arg2), STK(arg3),arg1));
+    }
+    if (arg0 != 0xFF) TARGET = STK(arg3);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_newslot)
+{
+    _JIT_BEGIN();
+    _JIT_GUARD(v->NewSlot(STK(arg1), STK(arg2), STK(arg3),false));
+    _JIT_GUARD(SQ_MEMCHECK(_ss(v),v));
+    if(arg0 != 0xFF) TARGET = STK(arg3);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_newslota)
+{
+    _JIT_BEGIN();
+    _JIT_GUARD(v->NewSlotA(STK(arg1),STK(arg2),STK(arg3),(arg0&NEW_SLOT_ATTRIBUTES_FLAG) ? STK(arg2-1) : SQObjectPtr(),(arg0&NEW_SLOT_STATIC_FLAG)?true:false,false));
+    _JIT_GUARD(SQ_MEMCHECK(_ss(v),v));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_delete) { _JIT_BEGIN(); _JIT_GUARD(v->DeleteSlot(STK(arg1), STK(arg2), TARGET)); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_eq)
+{
+    _JIT_BEGIN();
+    bool res;
+    _JIT_GUARD(v->IsEqual(STK(arg2),COND_LITERAL,res));
+    TARGET = res?true:false;
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_ne)
+{
+    _JIT_BEGIN();
+    bool res;
+    _JIT_GUARD(v->IsEqual(STK(arg2),COND_LITERAL,res));
+    TARGET = (!res)?true:false;
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_add) { _JIT_BEGIN(); _JIT_GUARD(v->ARITH_OP('+',TARGET,STK(arg2),STK(arg1))); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_sub) { _JIT_BEGIN(); _JIT_GUARD(v->ARITH_OP('-',TARGET,STK(arg2),STK(arg1))); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_mul) { _JIT_BEGIN(); _JIT_GUARD(v->ARITH_OP('*',TARGET,STK(arg2),STK(arg1))); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_div) { _JIT_BEGIN(); _JIT_GUARD(v->ARITH_OP('/',TARGET,STK(arg2),STK(arg1))); return SQ_JIT_NEXT; }
+//as in the interpreter a failing modulo doesn't throw
+_JIT_HELPER(jit_mod) { _JIT_BEGIN(); v->ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_bitw) { _JIT_BEGIN(); _JIT_GUARD(v->BW_OP(arg3,TARGET,STK(arg2),STK(arg1))); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_loadroot)
+{
+    _JIT_BEGIN();
+    SQWeakRef *w = _closure(v->ci->_closure)->_root;
+    if(sq_type(w->_obj) != OT_NULL) {
+        TARGET = w->_obj;
+    } else {
+        TARGET = v->_roottable;
+    }
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_jcmp)
+{
+    _JIT_BEGIN();
+    _JIT_GUARD(v->CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),v->temp_reg));
+    if(SQVM::IsFalse(v->temp_reg)) _JIT_JUMP(sarg1);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_jz)
+{
+    _JIT_BEGIN();
+    if(SQVM::IsFalse(STK(arg0))) _JIT_JUMP(sarg1);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_getouter)
+{
+    _JIT_BEGIN();
+    SQOuter *otr = _outer(_closure(v->ci->_closure)->_outervalues[arg1]);
+    TARGET = *(otr->_valptr);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_setouter)
+{
+    _JIT_BEGIN();
+    SQOuter *otr = _outer(_closure(v->ci->_closure)->_outervalues[arg1]);
+    *(otr->_valptr) = STK(arg2);
+    if(arg0 != 0xFF) TARGET = STK(arg2);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_newobj)
+{
+    _JIT_BEGIN();
+    switch(arg3) {
+        case NOT_TABLE: TARGET = SQTable::Create(_ss(v), arg1); break;
+        case NOT_ARRAY: TARGET = SQArray::Create(_ss(v), 0); _array(TARGET)->Reserve(arg1); break;
+        case NOT_CLASS: _JIT_GUARD(v->CLASS_OP(TARGET,arg1,arg2)); break;
+        default: assert(0); break;
+    }
+    _JIT_GUARD(SQ_MEMCHECK(_ss(v),v));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_appendarray)
+{
+    _JIT_BEGIN();
+    SQObject val;
+    val._unVal.raw = 0;
+    switch(arg2) {
+    case AAT_STACK: val = STK(arg1); break;
+    case AAT_LITERAL: val = v->ci->_literals[arg1]; break;
+    case AAT_INT: val._type = OT_INTEGER; val._unVal.nInteger = (SQInteger)((SQInt32)arg1); break;
+    case AAT_FLOAT: val._type = OT_FLOAT; val._unVal.fFloat = *((const SQFloat *)&arg1); break;
+    case AAT_BOOL: val._type = OT_BOOL; val._unVal.nInteger = arg1; break;
+    default: val._type = OT_INTEGER; assert(0); break;
+    }
+    _array(STK(arg0))->Append(val);
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_comparith)
+{
+    _JIT_BEGIN();
+    SQInteger selfidx = (((SQUnsignedInteger)arg1&0xFFFF0000)>>16);
+    _JIT_GUARD(v->DerefInc(arg3, TARGET, STK(selfidx), STK(arg2), STK(arg1&0x0000FFFF), false, selfidx));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_inc) { _JIT_BEGIN(); SQObjectPtr o(sarg3); _JIT_GUARD(v->DerefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1)); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_pinc) { _JIT_BEGIN(); SQObjectPtr o(sarg3); _JIT_GUARD(v->DerefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1)); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_incl)
+{
+    _JIT_BEGIN();
+    SQObjectPtr &a = STK(arg1);
+    SQObjectPtr o(sarg3);
+    _JIT_GUARD(v->ARITH_OP('+',a,a,o));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_pincl)
+{
+    _JIT_BEGIN();
+    SQObjectPtr &a = STK(arg1);
+    if(sq_type(a) == OT_INTEGER) {
+        TARGET = a;
+        a._unVal.nInteger = _integer(a) + sarg3;
+    }
+    else {
+        SQObjectPtr o(sarg3); _JIT_GUARD(v->PLOCAL_INC('+',TARGET, STK(arg1), o));
+    }
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_forloop)
+{
+    _JIT_BEGIN();
+    SQObjectPtr &a = STK(arg0);
+    if(arg1 & FORLOOP_SUB) { SQObjectPtr o(-sarg3); _JIT_GUARD(v->ARITH_OP('-',a,a,o)); }
+    else { SQObjectPtr o(sarg3); _JIT_GUARD(v->ARITH_OP('+',a,a,o)); }
+    _JIT_GUARD(v->CMP_OP(FORLOOP_CMP(arg1),STK(arg0),(arg1 & FORLOOP_LITERAL)?v->ci->_literals[arg2]:STK(arg2),v->temp_reg));
+    if(!SQVM::IsFalse(v->temp_reg)) _JIT_JUMP(FORLOOP_JUMP(sarg1));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_jmptable) { _JIT_BEGIN(); _JIT_JUMP(v->JMPTABLE_OP(_i_,TARGET)); }
+
+_JIT_HELPER(jit_cmp) { _JIT_BEGIN(); _JIT_GUARD(v->CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET)); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_exists)
+{
+    _JIT_BEGIN();
+    TARGET = v->Get(STK(arg1), STK(arg2), v->temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false;
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_instanceof)
+{
+    _JIT_BEGIN();
+    if(sq_type(STK(arg1)) != OT_CLASS) {
+        v->Raise_Error(_SC("cannot apply instanceof between a %s and a %s"),GetTypeName(STK(arg1)),GetTypeName(STK(arg2)));
+        return SQ_JIT_THROW;
+    }
+    TARGET = (sq_type(STK(arg2)) == OT_INSTANCE) ? (_instance(STK(arg2))->InstanceOf(_class(STK(arg1)))?true:false) : false;
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_and)
+{
+    _JIT_BEGIN();
+    if(SQVM::IsFalse(STK(arg2))) {
+        TARGET = STK(arg2);
+        _JIT_JUMP(sarg1);
+    }
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_or)
+{
+    _JIT_BEGIN();
+    if(!SQVM::IsFalse(STK(arg2))) {
+        TARGET = STK(arg2);
+        _JIT_JUMP(sarg1);
+    }
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_neg) { _JIT_BEGIN(); _JIT_GUARD(v->NEG_OP(TARGET,STK(arg1))); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_not) { _JIT_BEGIN(); TARGET = SQVM::IsFalse(STK(arg1)); return SQ_JIT_NEXT; }
+
+_JIT_HELPER(jit_bwnot)
+{
+    _JIT_BEGIN();
+    if(sq_type(STK(arg1)) == OT_INTEGER) {
+        SQInteger t = _integer(STK(arg1));
+        TARGET = SQInteger(~t);
+        return SQ_JIT_NEXT;
+    }
+    v->Raise_Error(_SC("attempt to perform a bitwise op on a %s"), GetTypeName(STK(arg1)));
+    return SQ_JIT_THROW;
+}
+
+_JIT_HELPER(jit_closure)
+{
+    _JIT_BEGIN();
+    SQFunctionProto *fp = _closure(v->ci->_closure)->_function;
+    _JIT_GUARD(v->CLOSURE_OP(TARGET,fp->_functions[arg1]._unVal.pFunctionProto,arg2));
+    _JIT_GUARD(SQ_MEMCHECK(_ss(v),v));
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_foreach)
+{
+    int tojump;
+    if(sq_type(STK(arg0)) == OT_GENERATOR) {
+        //resuming a generator is left to the interpreter
+        v->ci->_ip = i;
+        return SQ_JIT_EXIT;
+    }
+    _JIT_BEGIN();
+    _JIT_GUARD(v->FOREACH_OP(STK(arg0),STK(arg2),STK(arg2+1),STK(arg2+2),arg2,sarg1,tojump));
+    _JIT_JUMP(tojump);
+}
+
+_JIT_HELPER(jit_clone) { _JIT_BEGIN(); _JIT_GUARD(v->Clone(STK(arg1), TARGET)); _JIT_GUARD(SQ_MEMCHECK(_ss(v),v)); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_typeof) { _JIT_BEGIN(); _JIT_GUARD(v->TypeOf(STK(arg1), TARGET)); return SQ_JIT_NEXT; }
+_JIT_HELPER(jit_throw) { _JIT_BEGIN(); v->Raise_Error(TARGET); return SQ_JIT_THROW; }
+
+_JIT_HELPER(jit_getbase)
+{
+    _JIT_BEGIN();
+    SQClosure *clo = _closure(v->ci->_closure);
+    if(clo->_base) {
+        TARGET = clo->_base;
+    }
+    else {
+        TARGET.Null();
+    }
+    return SQ_JIT_NEXT;
+}
+
+_JIT_HELPER(jit_close) { _JIT_BEGIN(); if(v->_openouters) v->CloseOuters(&(STK(arg1))); return SQ_JIT_NEXT; }
+
+/////////////////////////////////////////////////////////////////////////////
+//x86-64 code emitter
+
+enum SQJitReg { RAX = 0, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum SQJitCond { CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF };
+
+#define REFCOUNTED_MASK SQOBJECT_REF_COUNTED
+
+//scalar single or double precision SSE2 instructions, depending on SQFloat
+#ifdef SQUSEDOUBLE
+#define SSE_PREFIX 0xF2
+#else
+#define SSE_PREFIX 0xF3
+#endif
+
+//jumps to a pc or to one of the shared stubs
+#define STUB_EPILOGUE -1
+#define STUB_DISPATCH -2
+
+struct SQJitFixup
+{
+    SQJitFixup() {}
+    SQJitFixup(SQInteger at,SQInteger target) { _at = at; _target = target; }
+    SQInteger _at;
+    SQInteger _target;
+};
+
+struct SQJitAssembler
+{
+    void Byte(SQInteger b) { _code.push_back((unsigned char)b); }
+    void Int32(SQInt32 n) { for(SQInteger k = 0; k < 4; k++) Byte((n >> (k * 8)) & 0xFF); }
+    void Int64(SQInteger n) { for(SQInteger k = 0; k < 8; k++) Byte((n >> (k * 8)) & 0xFF); }
+    SQInteger Pos() { return (SQInteger)_code.size(); }
+    void Rex(bool w,SQInteger reg,SQInteger base)
+    {
+        SQInteger r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+        if(r != 0x40) Byte(r);
+    }
+    //opcodes above 0xFF are two bytes opcodes(0x0F xx)
+    void Op(SQInteger opc) { if(opc > 0xFF) Byte(opc >> 8); Byte(opc & 0xFF); }
+    //[base+disp32]
+    void Mem(SQInteger reg,SQInteger base,SQInteger disp)
+    {
+        Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if((base & 7) == RSP) Byte(0x24);
+        Int32((SQInt32)disp);
+    }
+    //op reg,[base+disp] / op [base+disp],reg
+    void OpMem(SQInteger opc,bool w,SQInteger reg,SQInteger base,SQInteger disp) { Rex(w,reg,base); Op(opc); Mem(reg,base,disp); }
+    //op [base+disp],imm
+    void OpMemImm32(SQInteger opc,SQInteger ext,bool w,SQInteger base,SQInteger disp,SQInt32 imm) { Rex(w,0,base); Op(opc); Mem(ext,base,disp); Int32(imm); }
+    void OpMemImm8(SQInteger opc,SQInteger ext,bool w,SQInteger base,SQInteger disp,SQInteger imm) { Rex(w,0,base); Op(opc); Mem(ext,base,disp); Byte(imm); }
+    //op rm,reg
+    void OpReg(SQInteger opc,bool w,SQInteger reg,SQInteger rm) { Rex(w,reg,rm); Op(opc); Byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+    void OpRegImm32(SQInteger opc,SQInteger ext,bool w,SQInteger rm,SQInt32 imm) { OpReg(opc,w,ext,rm); Int32(imm); }
+    void MovImm64(SQInteger reg,SQInteger imm) { Rex(true,0,reg); Byte(0xB8 | (reg & 7)); Int64(imm); }
+    void MovPtr(SQInteger reg,const void *p) { MovImm64(reg,(SQInteger)(size_t)p); }
+    void Push(SQInteger reg) { Rex(false,0,reg); Byte(0x50 | (reg & 7)); }
+    void Pop(SQInteger reg) { Rex(false,0,reg); Byte(0x58 | (reg & 7)); }
+    //the rel32 is resolved by Patch(), returns its position
+    SQInteger Jmp() { Byte(0xE9); Int32(0); return Pos(); }
+    SQInteger Jcc(SQInteger cc) { Byte(0x0F); Byte(0x80 | cc); Int32(0); return Pos(); }
+    void Patch(SQInteger at,SQInteger target)
+    {
+        SQInt32 rel = (SQInt32)(target - at);
+        memcpy(&_code._vals[at - 4],&rel,sizeof(rel));
+    }
+    sqvector<unsigned char> _code;
+};
+
+#define _JTYPE(a) ((SQInteger)(a) * (SQInteger)sizeof(SQObjectPtr) + _typeoff)
+#define _JVAL(a) ((SQInteger)(a) * (SQInteger)sizeof(SQObjectPtr) + _valoff)
+
+struct SQJitCompiler
+{
+    SQJitCompiler(SQVM *v,SQFunctionProto *func)
+    {
+        SQVM::CallInfo dummy;
+        SQObject o;
+        _func = func;
+        _typeoff = (SQInteger)((char *)&o._type - (char *)&o);
+        _valoff = (SQInteger)((char *)&o._unVal - (char *)&o);
+        _stackoff = (SQInteger)((char *)&v->_stack._vals - (char *)v);
+        _stackbaseoff = (SQInteger)((char *)&v->_stackbase - (char *)v);
+        _cioff = (SQInteger)((char *)&v->ci - (char *)v);
+        _debughookoff = (SQInteger)((char *)&v->_debughook - (char *)v);
+        _ipoff = (SQInteger)((char *)&dummy._ip - (char *)&dummy);
+    }
+    void JumpTo(SQInteger at,SQInteger target) { _fixups.push_back(SQJitFixup(at,target)); }
+    //r12 = &_stack._vals[_stackbase]
+    void ReloadBase()
+    {
+        _a.OpMem(0x8B,true,RAX,RBX,_stackoff);
+        _a.OpMem(0x8B,true,RDX,RBX,_stackbaseoff);
+        _a.OpReg(0xC1,true,4,RDX); _a.Byte(4); //shl rdx,4(sizeof(SQObjectPtr) == 16)
+        _a.OpReg(0x89,true,RAX,R12);
+        _a.OpReg(0x01,true,RDX,R12);
+    }
+    void CallHelper(SQJitHelper h,SQInstruction *i)
+    {
+        _a.OpReg(0x89,true,RBX,RDI);
+        _a.MovPtr(RSI,i);
+        _a.MovPtr(RAX,(const void *)h);
+        _a.Byte(0xFF); _a.Byte(0xD0); //call rax
+        _a.OpReg(0x89,true,RAX,R14);
+        ReloadBase();
+        _a.OpReg(0x85,true,R14,R14);
+        JumpTo(_a.Jcc(CC_NE),STUB_DISPATCH);
+    }
+    //gives back the control to the interpreter at pc
+    void ExitAt(SQInteger pc)
+    {
+        _a.OpMem(0x8B,true,RAX,RBX,_cioff);
+        _a.MovPtr(RCX,&_func->_instructions[pc]);
+        _a.OpMem(0x89,true,RCX,RAX,_ipoff);
+        _a.MovImm64(R14,SQ_JIT_EXIT);
+        JumpTo(_a.Jmp(),STUB_EPILOGUE);
+    }
+    //jumps to slow if the type of the stack slot a isn't t
+    SQInteger CheckType(SQInteger a,SQObjectType t)
+    {
+        _a.OpMemImm32(0x81,7,false,R12,_JTYPE(a),t);
+        return _a.Jcc(CC_NE);
+    }
+    //jumps to slow if a and b aren't both integers
+    SQInteger CheckIntegers(SQInteger a,SQInteger b)
+    {
+        _a.OpMem(0x8B,false,RAX,R12,_JTYPE(a));
+        _a.OpMem(0x0B,false,RAX,R12,_JTYPE(b));
+        _a.OpRegImm32(0x81,7,false,RAX,OT_INTEGER);
+        return _a.Jcc(CC_NE);
+    }
+    //jumps to slow if the stack slot a holds a refcounted object(its release needs the slow path)
+    SQInteger CheckScalar(SQInteger a)
+    {
+        _a.OpMemImm32(0xF7,0,false,R12,_JTYPE(a),REFCOUNTED_MASK);
+        return _a.Jcc(CC_NE);
+    }
+    //stack[a] = rax, with rax of type t
+    void StoreScalar(SQInteger a,SQObjectType t)
+    {
+        _a.OpMemImm32(0xC7,0,false,R12,_JTYPE(a),t);
+        _a.OpMem(0x89,true,RAX,R12,_JVAL(a));
+    }
+    //emits the helper call of the slow path and patches the jumps to it
+    void SlowPath(SQInteger *slow,SQInteger nslow,SQJitHelper h,SQInstruction *i)
+    {
+        SQInteger done = _a.Jmp();
+        for(SQInteger k = 0; k < nslow; k++) _a.Patch(slow[k],_a.Pos());
+        CallHelper(h,i);
+        _a.Patch(done,_a.Pos());
+    }
+    //int-int and float-float run inline, anything else calls h
+    void Arith(SQInstruction *i,SQInteger iopc,SQInteger fopc,SQJitHelper h)
+    {
+        SQInteger slow[2],done[2];
+        _a.OpMem(0x8B,false,RAX,R12,_JTYPE(arg2));
+        _a.OpMem(0x0B,false,RAX,R12,_JTYPE(arg1));
+        slow[0] = CheckScalar(arg0);
+        _a.OpRegImm32(0x81,7,false,RAX,OT_INTEGER);
+        SQInteger notint = _a.Jcc(CC_NE);
+        _a.OpMem(0x8B,true,RAX,R12,_JVAL(arg2));
+        _a.OpMem(iopc,true,RAX,R12,_JVAL(arg1));
+        StoreScalar(arg0,OT_INTEGER);
+        done[0] = _a.Jmp();
+        _a.Patch(notint,_a.Pos());
+        _a.OpRegImm32(0x81,7,false,RAX,OT_FLOAT);
+        slow[1] = _a.Jcc(CC_NE);
+        _a.Byte(SSE_PREFIX); _a.OpMem(0x0F10,false,0,R12,_JVAL(arg2)); //movs xmm0,o1
+        _a.Byte(SSE_PREFIX); _a.OpMem(fopc,false,0,R12,_JVAL(arg1)); //op xmm0,o2
+        //the unused bits of _unVal are 0 like after SQ_OBJECT_RAWINIT()
+        _a.Byte(0x66); _a.Rex(sizeof(SQFloat) == 8,0,RAX); _a.Op(0x0F7E); _a.Byte(0xC0); //mov rax,xmm0
+        StoreScalar(arg0,OT_FLOAT);
+        done[1] = _a.Jmp();
+        for(SQInteger k = 0; k < 2; k++) _a.Patch(slow[k],_a.Pos());
+        CallHelper(h,i);
+        for(SQInteger k = 0; k < 2; k++) _a.Patch(done[k],_a.Pos());
+    }
+    void Emit(SQInteger pc);
+    SQJitCode *Compile();
+
+    SQJitAssembler _a;
+    SQFunctionProto *_func;
+    sqvector<SQInteger> _labels;
+    sqvector<SQJitFixup> _fixups;
+    SQInteger _typeoff,_valoff;
+    SQInteger _stackoff,_stackbaseoff,_cioff,_debughookoff,_ipoff;
+};
+
+//condition that skips the branch of a JCMP(the comparison is false)
+static SQInteger JCmpSkipCond(SQInteger cmpop)
+{
+    switch(cmpop) {
+        case CMP_G: return CC_LE;
+        case CMP_GE: return CC_L;
+        case CMP_L: return CC_GE;
+        case CMP_LE: return CC_G;
+        default: return CC_E; //CMP_3W, the result is an integer false when 0
+    }
+}
+
+static SQInteger CmpCond(SQInteger cmpop)
+{
+    switch(cmpop) {
+        case CMP_G: return CC_G;
+        case CMP_GE: return CC_GE;
+        case CMP_L: return CC_L;
+        default: return CC_LE;
+    }
+}
+
+static SQJitHelper HelperOf(SQInteger op)
+{
+    switch(op) {
+        case _OP_LOAD: return jit_load;
+        case _OP_LOADINT: return jit_loadint;
+        case _OP_LOADFLOAT: return jit_loadfloat;
+        case _OP_DLOAD: return jit_dload;
+        case _OP_PREPCALL: case _OP_PREPCALLK: return jit_prepcall;
+        case _OP_GETK: return jit_getk;
+        case _OP_MOVE: return jit_move;
+        case _OP_NEWSLOT: return jit_newslot;
+        case _OP_DELETE: return jit_delete;
+        case _OP_SET: return jit_set;
+        case _OP_GET: return jit_get;
+        case _OP_EQ: return jit_eq;
+        case _OP_NE: return jit_ne;
+        case _OP_ADD: case _OP_ADDI: case _OP_ADDF: return jit_add;
+        case _OP_SUB: case _OP_SUBI: case _OP_SUBF: return jit_sub;
+        case _OP_MUL: case _OP_MULI: case _OP_MULF: return jit_mul;
+        case _OP_DIV: return jit_div;
+        case _OP_MOD: return jit_mod;
+        case _OP_BITW: return jit_bitw;
+        case _OP_LOADNULLS: return jit_loadnulls;
+        case _OP_LOADROOT: return jit_loadroot;
+        case _OP_LOADBOOL: return jit_loadbool;
+        case _OP_DMOVE: return jit_dmove;
+        case _OP_JCMP: case _OP_JCMPI: case _OP_JCMPF: return jit_jcmp;
+        case _OP_JZ: return jit_jz;
+        case _OP_SETOUTER: return jit_setouter;
+        case _OP_GETOUTER: return jit_getouter;
+        case _OP_NEWOBJ: return jit_newobj;
+        case _OP_APPENDARRAY: return jit_appendarray;
+        case _OP_COMPARITH: return jit_comparith;
+        case _OP_INC: return jit_inc;
+        case _OP_INCL: return jit_incl;
+        case _OP_PINC: return jit_pinc;
+        case _OP_PINCL: return jit_pincl;
+        case _OP_CMP: case _OP_CMPI: case _OP_CMPF: return jit_cmp;
+        case _OP_EXISTS: return jit_exists;
+        case _OP_INSTANCEOF: return jit_instanceof;
+        case _OP_AND: return jit_and;
+        case _OP_OR: return jit_or;
+        case _OP_NEG: return jit_neg;
+        case _OP_NOT: return jit_not;
+        case _OP_BWNOT: return jit_bwnot;
+        case _OP_CLOSURE: return jit_closure;
+        case _OP_FOREACH: return jit_foreach;
+        case _OP_CLONE: return jit_clone;
+        case _OP_TYPEOF: return jit_typeof;
+        case _OP_THROW: return jit_throw;
+        case _OP_NEWSLOTA: return jit_newslota;
+        case _OP_GETBASE: return jit_getbase;
+        case _OP_CLOSE: return jit_close;
+        case _OP_FORLOOP: return jit_forloop;
+        case _OP_JMPTABLE: case _OP_JMPHASH: return jit_jmptable;
+        default: return NULL;
+    }
+}
+
+void SQJitCompiler::Emit(SQInteger pc)
+{
+    SQInstruction *i = &_func->_instructions[pc];
+    SQInteger slow[3];
+    switch(_i_.op) {
+    case _OP_LINE: {
+        _a.OpMemImm8(0x80,7,false,RBX,_debughookoff,0);
+        SQInteger nohook = _a.Jcc(CC_E);
+        ExitAt(pc);
+        _a.Patch(nohook,_a.Pos());
+        }
+        return;
+    case _OP_LOADINT:
+    case _OP_LOADBOOL:
+        slow[0] = CheckScalar(arg0);
+        if(_i_.op == _OP_LOADINT) {
+            _a.OpMemImm32(0xC7,0,true,R12,_JVAL(arg0),(SQInt32)arg1);
+            _a.OpMemImm32(0xC7,0,false,R12,_JTYPE(arg0),OT_INTEGER);
+        }
+        else {
+            _a.OpMemImm32(0xC7,0,true,R12,_JVAL(arg0),arg1 ? 1 : 0);
+            _a.OpMemImm32(0xC7,0,false,R12,_JTYPE(arg0),OT_BOOL);
+        }
+        SlowPath(slow,1,HelperOf(_i_.op),i);
+        return;
+    case _OP_MOVE:
+        _a.OpMem(0x8B,false,RAX,R12,_JTYPE(arg1));
+        _a.OpMem(0x0B,false,RAX,R12,_JTYPE(arg0));
+        _a.OpRegImm32(0xF7,0,false,RAX,REFCOUNTED_MASK);
+        slow[0] = _a.Jcc(CC_NE);
+        _a.OpMem(0x8B,false,RAX,R12,_JTYPE(arg1));
+        _a.OpMem(0x89,false,RAX,R12,_JTYPE(arg0));
+        _a.OpMem(0x8B,true,RAX,R12,_JVAL(arg1));
+        _a.OpMem(0x89,true,RAX,R12,_JVAL(arg0));
+        SlowPath(slow,1,jit_move,i);
+        return;
+    case _OP_ADD: case _OP_ADDI: case _OP_ADDF: Arith(i,0x03,0x0F58,jit_add); return;
+    case _OP_SUB: case _OP_SUBI: case _OP_SUBF: Arith(i,0x2B,0x0F5C,jit_sub); return;
+    case _OP_MUL: case _OP_MULI: case _OP_MULF: Arith(i,0x0FAF,0x0F59,jit_mul); return;
+    case _OP_CMP: case _OP_CMPI:
+        if(arg3 == CMP_3W) break;
+        slow[0] = CheckIntegers(arg2,arg1);
+        slow[1] = CheckScalar(arg0);
+        _a.OpMem(0x8B,true,RCX,R12,_JVAL(arg2));
+        _a.OpMem(0x3B,true,RCX,R12,_JVAL(arg1));
+        _a.Byte(0x0F); _a.Byte(0x90 | CmpCond(arg3)); _a.Byte(0xC0); //setcc al
+        _a.Byte(0x0F); _a.Byte(0xB6); _a.Byte(0xC0); //movzx eax,al
+        StoreScalar(arg0,OT_BOOL);
+        SlowPath(slow,2,jit_cmp,i);
+        return;
+    case _OP_JCMP: case _OP_JCMPI:
+        slow[0] = CheckIntegers(arg2,arg0);
+        _a.OpMem(0x8B,true,RAX,R12,_JVAL(arg2));
+        _a.OpMem(0x3B,true,RAX,R12,_JVAL(arg0));
+        JumpTo(_a.Jcc(JCmpSkipCond(arg3)),pc + 1 + sarg1);
+        SlowPath(slow,1,jit_jcmp,i);
+        return;
+    case _OP_JZ:
+        //besides floats IsFalse() only checks the value for 0
+        _a.OpMemImm32(0x81,7,false,R12,_JTYPE(arg0),OT_FLOAT);
+        slow[0] = _a.Jcc(CC_E);
+        _a.OpMemImm32(0x81,7,true,R12,_JVAL(arg0),0);
+        JumpTo(_a.Jcc(CC_E),pc + 1 + sarg1);
+        SlowPath(slow,1,jit_jz,i);
+        return;
+    case _OP_JMP:
+        JumpTo(_a.Jmp(),pc + 1 + sarg1);
+        return;
+    case _OP_INCL:
+        slow[0] = CheckType(arg1,OT_INTEGER);
+        _a.OpMemImm32(0x81,0,true,R12,_JVAL(arg1),(SQInt32)sarg3);
+        SlowPath(slow,1,jit_incl,i);
+        return;
+    case _OP_PINCL:
+        slow[0] = CheckType(arg1,OT_INTEGER);
+        slow[1] = CheckScalar(arg0);
+        _a.OpMem(0x8B,true,RAX,R12,_JVAL(arg1));
+        StoreScalar(arg0,OT_INTEGER);
+        _a.OpMemImm32(0x81,0,true,R12,_JVAL(arg1),(SQInt32)sarg3);
+        SlowPath(slow,2,jit_pincl,i);
+        return;
+    case _OP_FORLOOP:
+        if(arg1 & FORLOOP_LITERAL) {
+            slow[0] = CheckType(arg0,OT_INTEGER);
+            _a.MovImm64(RCX,_integer(_func->_literals[arg2]));
+        }
+        else {
+            slow[0] = CheckIntegers(arg0,arg2);
+        }
+        _a.OpMemImm32(0x81,0,true,R12,_JVAL(arg0),(SQInt32)sarg3);
+        _a.OpMem(0x8B,true,RAX,R12,_JVAL(arg0));
+        if(arg1 & FORLOOP_LITERAL) _a.OpReg(0x39,true,RCX,RAX);
+        else _a.OpMem(0x3B,true,RAX,R12,_JVAL(arg2));
+        JumpTo(_a.Jcc(CmpCond(FORLOOP_CMP(arg1))),pc + 1 + FORLOOP_JUMP(sarg1));
+        SlowPath(slow,1,jit_forloop,i);
+        return;
+    default:
+        break;
+    }
+    SQJitHelper h = HelperOf(_i_.op);
+    if(h) {
+        CallHelper(h,i);
+    }
+    else {
+        ExitAt(pc);
+    }
+}
+
+SQJitCode *SQJitCompiler::Compile()
+{
+    SQInteger n = _func->_ninstructions;
+    //entry(v,target,base,targets), keeps the stack aligned to 16 bytes for the helpers
+    _a.Push(RBP); _a.Push(RBX); _a.Push(R12); _a.Push(R13); _a.Push(R14);
+    _a.OpReg(0x89,true,RDI,RBX);
+    _a.OpReg(0x89,true,RDX,R12);
+    _a.OpReg(0x89,true,RCX,R13);
+    _a.Byte(0xFF); _a.Byte(0xE6); //jmp rsi
+    _labels.resize(n);
+    for(SQInteger pc = 0; pc < n; pc++) {
+        _labels[pc] = _a.Pos();
+        Emit(pc);
+    }
+    //a helper returned SQ_JIT_JUMP: continue from ci->_ip, else leave
+    SQInteger dispatch = _a.Pos();
+    _a.OpRegImm32(0x81,7,true,R14,SQ_JIT_JUMP);
+    JumpTo(_a.Jcc(CC_NE),STUB_EPILOGUE);
+    _a.OpMem(0x8B,true,RAX,RBX,_cioff);
+    _a.OpMem(0x8B,true,RAX,RAX,_ipoff);
+    _a.MovPtr(RCX,_func->_instructions);
+    _a.OpReg(0x29,true,RCX,RAX);
+    //sizeof(SQInstruction) == sizeof(void *), so the offset is the same in _targets
+    _a.Byte(0x41); _a.Byte(0xFF); _a.Byte(0x64); _a.Byte(0x05); _a.Byte(0x00); //jmp [r13+rax]
+    SQInteger epilogue = _a.Pos();
+    _a.OpReg(0x89,true,R14,RAX);
+    _a.Pop(R14); _a.Pop(R13); _a.Pop(R12); _a.Pop(RBX); _a.Pop(RBP);
+    _a.Byte(0xC3); //ret
+    for(SQUnsignedInteger k = 0; k < _fixups.size(); k++) {
+        SQJitFixup &f = _fixups[k];
+        switch(f._target) {
+            case STUB_EPILOGUE: _a.Patch(f._at,epilogue); break;
+            case STUB_DISPATCH: _a.Patch(f._at,dispatch); break;
+            default: _a.Patch(f._at,_labels[f._target]); break;
+        }
+    }
+
+    SQUnsignedInteger size = _a._code.size();
+    void *mem = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+    if(mem == MAP_FAILED) return NULL;
+    memcpy(mem,_a._code._vals,size);
+    if(mprotect(mem,size,PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem,size);
+        return NULL;
+    }
+    SQJitCode *code = (SQJitCode *)SQ_MALLOC(sizeof(SQJitCode));
+    code->_code = (unsigned char *)mem;
+    code->_codesize = size;
+    code->_entry = (SQJitEntry)mem;
+    code->_instructions = _func->_instructions;
+    code->_ninstructions = n;
+    code->_targets = (void **)SQ_MALLOC(n * sizeof(void *));
+    for(SQInteger pc = 0; pc < n; pc++) {
+        code->_targets[pc] = code->_code + _labels[pc];
+    }
+    return code;
+}
+
+SQJitCode *sq_jit_compile(SQVM *v,SQFunctionProto *func)
+{
+    //generators keep their frame outside of the stack when suspended
+    if(func->_bgenerator) return NULL;
+    //without loops the time saved doesn't pay for entering and leaving the native code
+    bool loops = false;
+    for(SQInteger pc = 0; pc < func->_ninstructions && !loops; pc++) {
+        SQInstruction *i = &func->_instructions[pc];
+        loops = (_i_.op == _OP_JMP && sarg1 < 0) || _i_.op == _OP_FORLOOP;
+        //the jumps of a switch table go back to its cases
+        if(_i_.op == _OP_JMPTABLE || _i_.op == _OP_JMPHASH) pc += JMPTABLE_JUMPS(_i_);
+    }
+    if(!loops) return NULL;
+    SQJitCompiler c(v,func);
+    return c.Compile();
+}
+
+void sq_jit_free(SQJitCode *code)
+{
+    munmap(code->_code,code->_codesize);
+    SQ_FREE(code->_targets,code->_ninstructions * sizeof(void *));
+    SQ_FREE(code,sizeof(SQJitCode));
+}
+
+#endif //SQ_JIT
@@ -0,0 +1,50 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQJIT_H_
+#define _SQJIT_H_
+
+//the baseline JIT only emits x86-64 code for the System V calling convention
+//and only knows the tagged object layout
+#if defined(SQ_JIT) && (!(defined(__x86_64__) && defined(_SQ64) && !defined(_WIN32)) || defined(SQ_NANBOXING))
+#undef SQ_JIT
+#endif
+
+#ifdef SQ_JIT
+
+//number of calls/loop iterations before a function gets compiled
+#define SQ_JIT_THRESHOLD 200
+
+//results of a helper called by the native code
+#define SQ_JIT_NEXT 0
+#define SQ_JIT_JUMP 1
+//results of sq_jit_run()(and of a helper)
+#define SQ_JIT_THROW 2
+#define SQ_JIT_EXIT 3
+
+struct SQVM;
+struct SQFunctionProto;
+
+typedef SQInteger (*SQJitEntry)(SQVM *v,void *target,SQObjectPtr *base,void **targets);
+
+struct SQJitCode
+{
+    SQJitEntry _entry;
+    SQInstruction *_instructions;
+    SQInteger _ninstructions;
+    //native address of every instruction
+    void **_targets;
+    unsigned char *_code;
+    SQUnsignedInteger _codesize;
+};
+
+SQJitCode *sq_jit_compile(SQVM *v,SQFunctionProto *func);
+void sq_jit_free(SQJitCode *code);
+
+//runs the native code from ip on, returns when the interpreter has to take over from ci->_ip
+inline SQInteger sq_jit_run(SQVM *v,SQJitCode *code,SQInstruction *ip,SQObjectPtr *base)
+{
+    return code->_entry(v,code->_targets[ip - code->_instructions],base,code->_targets);
+}
+
+#endif //SQ_JIT
+
+#endif //_SQJIT_H_
@@ -11,6 +11,32 @@
 #include "sqclass.h"
 #include "sqclosure.h"
 
+#ifdef SQ_NANBOXING
+//type of every tag of a boxed object, tag 0 is -inf and the last entry is any other double
+const SQObjectType sq_nbtypes[33] = {
+    OT_FLOAT,
+    OT_NULL,
+    OT_INTEGER,
+    OT_BOOL,
+    OT_USERPOINTER,
+    OT_STRING,
+    OT_TABLE,
+    OT_ARRAY,
+    OT_USERDATA,
+    OT_CLOSURE,
+    OT_NATIVECLOSURE,
+    OT_GENERATOR,
+    OT_THREAD,
+    OT_FUNCPROTO,
+    OT_CLASS,
+    OT_INSTANCE,
+    OT_WEAKREF,
+    OT_OUTER,
+    OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL, //unused tags
+    OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL,OT_NULL,
+    OT_FLOAT
+};
+#endif
 
 const SQChar *IdType2Name(SQObjectType type)
 {
@@ -92,11 +118,7 @@ SQWeakRef *SQRefCounted::GetWeakRef(SQObjectType type)
 {
     if(!_weakref) {
         sq_new(_weakref,SQWeakRef);
-#if defined(SQUSEDOUBLE) && !defined(_SQ64)
-        _weakref->_obj._unVal.raw = 0; //clean the whole union on 32 bits with double
-#endif
-        _weakref->_obj._type = type;
-        _weakref->_obj._unVal.pRefCounted = this;
+        _setrefcounted(_weakref->_obj,type,this);
     }
     return _weakref;
 }
@@ -104,14 +126,13 @@ SQWeakRef *SQRefCounted::GetWeakRef(SQObjectType type)
 SQRefCounted::~SQRefCounted()
 {
     if(_weakref) {
-        _weakref->_obj._type = OT_NULL;
-        _weakref->_obj._unVal.pRefCounted = NULL;
+        _setnull(_weakref->_obj);
     }
 }
 
 void SQWeakRef::Release() {
-    if(ISREFCOUNTED(_obj._type)) {
-        _obj._unVal.pRefCounted->_weakref = NULL;
+    if(ISREFCOUNTED(sq_type(_obj))) {
+        _refcounted(_obj)->_weakref = NULL;
     }
     sq_delete(this,SQWeakRef);
 }
@@ -278,7 +299,7 @@ SQClosure::~SQClosure()
     __ObjRelease(_root);
     __ObjRelease(_env);
     __ObjRelease(_base);
-    REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+    REMOVE_FROM_CHAIN(_gcchain(this),this);
 }
 
 #define _CHECK_IO(exp)  { if(!exp)return false; }
@@ -326,10 +347,14 @@ bool WriteObject(HSQUIRRELVM v,SQUserPointer up,SQWRITEFUNC write,SQObjectPtr &o
         _CHECK_IO(SafeWrite(v,write,up,_stringval(o),sq_rsl(_string(o)->_len)));
         break;
     case OT_BOOL:
-    case OT_INTEGER:
-        _CHECK_IO(SafeWrite(v,write,up,&_integer(o),sizeof(SQInteger)));break;
-    case OT_FLOAT:
-        _CHECK_IO(SafeWrite(v,write,up,&_float(o),sizeof(SQFloat)));break;
+    case OT_INTEGER:{
+        SQInteger i = _integer(o);
+        _CHECK_IO(SafeWrite(v,write,up,&i,sizeof(SQInteger)));break;
+                    }
+    case OT_FLOAT:{
+        SQFloat f = _float(o);
+        _CHECK_IO(SafeWrite(v,write,up,&f,sizeof(SQFloat)));break;
+                  }
     case OT_NULL:
         break;
     default:
@@ -358,7 +383,7 @@ bool ReadObject(HSQUIRRELVM v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &o)
                     }
     case OT_BOOL:{
         SQInteger i;
-        _CHECK_IO(SafeRead(v,read,up,&i,sizeof(SQInteger))); o._type = OT_BOOL; o._unVal.nInteger = i; break;
+        _CHECK_IO(SafeRead(v,read,up,&i,sizeof(SQInteger))); o = i?true:false; break;
                     }
     case OT_FLOAT:{
         SQFloat f;
@@ -403,12 +428,62 @@ SQFunctionProto::SQFunctionProto(SQSharedState *ss)
 {
     _stacksize=0;
     _bgenerator=false;
-    INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);
+    _ninlinecaches=0;
+    _inlinecaches=NULL;
+    _inlinecachemap=NULL;
+#ifdef SQ_JIT
+    _jitcode=NULL;
+    _jithotness=0;
+#endif
+    INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this);
 }
 
 SQFunctionProto::~SQFunctionProto()
 {
-    REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+    REMOVE_FROM_CHAIN(_gcchain(this),this);
+}
+
+void SQFunctionProto::AllocInlineCaches()
+{
+    _inlinecachemap = (unsigned short *)SQ_SSMALLOC(_gcss(_sharedstate),_ninstructions * sizeof(unsigned short));
+    _ninlinecaches = 0;
+    for(SQInteger i = 0; i < _ninstructions; i++) {
+        _inlinecachemap[i] = 0;
+        switch(_instructions[i].op) {
+        case _OP_GET: case _OP_GETK: case _OP_SET: case _OP_PREPCALL: case _OP_PREPCALLK:
+            if(_ninlinecaches < SQ_INLINECACHE_MAX) {
+                _inlinecachemap[i] = (unsigned short)++_ninlinecaches;
+            }
+            break;
+        default: break;
+        }
+    }
+    _inlinecaches = (SQInlineCache *)SQ_SSMALLOC(_gcss(_sharedstate),_ninlinecaches * sizeof(SQInlineCache));
+    _CONSTRUCT_VECTOR(SQInlineCache,_ninlinecaches,_inlinecaches);
+}
+
+void SQFunctionProto::FreeInlineCaches()
+{
+    if(!_inlinecachemap) return;
+    _DESTRUCT_VECTOR(SQInlineCache,_ninlinecaches,_inlinecaches);
+    SQ_SSFREE(_gcss(_sharedstate),_inlinecaches,_ninlinecaches * sizeof(SQInlineCache));
+    SQ_SSFREE(_gcss(_sharedstate),_inlinecachemap,_ninstructions * sizeof(unsigned short));
+    _inlinecaches = NULL;
+    _inlinecachemap = NULL;
+    _ninlinecaches = 0;
+}
+
+//undoes the quickening done by the VM, so that saved bytecode only contains compiler opcodes
+static SQInteger GenericOpcode(SQInteger op)
+{
+    switch(op) {
+        case _OP_ADDI: case _OP_ADDF: return _OP_ADD;
+        case _OP_SUBI: case _OP_SUBF: return _OP_SUB;
+        case _OP_MULI: case _OP_MULF: return _OP_MUL;
+        case _OP_CMPI: case _OP_CMPF: return _OP_CMP;
+        case _OP_JCMPI: case _OP_JCMPF: return _OP_JCMP;
+        default: return op;
+    }
 }
 
 bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
@@ -462,7 +537,11 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
     _CHECK_IO(SafeWrite(v,write,up,_defaultparams,sizeof(SQInteger)*ndefaultparams));
 
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
-    _CHECK_IO(SafeWrite(v,write,up,_instructions,sizeof(SQInstruction)*ninstructions));
+    for(i=0;i<ninstructions;i++){
+        SQInstruction inst = _instructions[i];
+        inst.op = (unsigned char)GenericOpcode(inst.op);
+        _CHECK_IO(SafeWrite(v,write,up,&inst,sizeof(SQInstruction)));
+    }
 
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
     for(i=0;i<nfunctions;i++){
@@ -588,10 +667,16 @@ void SQTable::Mark(SQCollectable **chain)
 {
     START_MARK()
         if(_delegate) _delegate->Mark(chain);
-        SQInteger len = _numofnodes;
-        for(SQInteger i = 0; i < len; i++){
-            SQSharedState::MarkObject(_nodes[i].key, chain);
-            SQSharedState::MarkObject(_nodes[i].val, chain);
+        if(_shape) {
+            for(SQInteger i = 0; i < _usednodes; i++) SQSharedState::MarkObject(_values[i], chain);
+        }
+        else {
+            SQInteger len = _numofnodes;
+            for(SQInteger i = 0; i < len; i++){
+                SQSharedState::MarkObject(_nodes[i].key, chain);
+                SQSharedState::MarkObject(_nodes[i].val, chain);
+            }
+            for(SQInteger i = 0; i < _arraysize; i++) SQSharedState::MarkObject(_array[i], chain);
         }
     END_MARK()
 }
@@ -679,5 +764,165 @@ void SQUserData::Mark(SQCollectable **chain){
 
 void SQCollectable::UnMark() { _uiRef&=~MARK_FLAG; }
 
+void SQVM::Traverse(SQGCVISIT visit,void *ud)
+{
+    SQSharedState::TraverseObject(_lasterror,visit,ud);
+    SQSharedState::TraverseObject(_errorhandler,visit,ud);
+    SQSharedState::TraverseObject(_debughook_closure,visit,ud);
+    SQSharedState::TraverseObject(_roottable,visit,ud);
+    SQSharedState::TraverseObject(temp_reg,visit,ud);
+    for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::TraverseObject(_stack[i],visit,ud);
+    for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::TraverseObject(_callsstack[k]._closure,visit,ud);
+}
+
+void SQArray::Traverse(SQGCVISIT visit,void *ud)
+{
+    SQInteger len = _values.size();
+    for(SQInteger i = 0;i < len; i++) SQSharedState::TraverseObject(_values[i],visit,ud);
+}
+
+void SQTable::Traverse(SQGCVISIT visit,void *ud)
+{
+    if(_delegate) visit(_delegate,ud);
+    if(_shape) {
+        for(SQInteger i = 0; i < _usednodes; i++) SQSharedState::TraverseObject(_values[i],visit,ud);
+    }
+    else TraverseNodes(0,_arraysize + _numofnodes,visit,ud);
+}
+
+SQInteger SQTable::TraverseNodes(SQInteger pos,SQInteger n,SQGCVISIT visit,void *ud)
+{
+    SQInteger size = _arraysize + _numofnodes;
+    SQInteger end = pos + n;
+    if(end > size) end = size;
+    for(SQInteger i = pos; i < end; i++){
+        if(i < _arraysize) {
+            SQSharedState::TraverseObject(_array[i],visit,ud);
+            continue;
+        }
+        SQSharedState::TraverseObject(_nodes[i - _arraysize].key,visit,ud);
+        SQSharedState::TraverseObject(_nodes[i - _arraysize].val,visit,ud);
+    }
+    return end < size ? end : -1;
+}
+
+void SQClass::Traverse(SQGCVISIT visit,void *ud)
+{
+    visit(_members,ud);
+    if(_base) visit(_base,ud);
+    SQSharedState::TraverseObject(_attributes,visit,ud);
+    for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
+        SQSharedState::TraverseObject(_defaultvalues[i].val,visit,ud);
+        SQSharedState::TraverseObject(_defaultvalues[i].attrs,visit,ud);
+    }
+    for(SQUnsignedInteger j =0; j< _methods.size(); j++) {
+        SQSharedState::TraverseObject(_methods[j].val,visit,ud);
+        SQSharedState::TraverseObject(_methods[j].attrs,visit,ud);
+    }
+    for(SQUnsignedInteger k =0; k< MT_LAST; k++) {
+        SQSharedState::TraverseObject(_metamethods[k],visit,ud);
+    }
+}
+
+void SQInstance::Traverse(SQGCVISIT visit,void *ud)
+{
+    visit(_class,ud);
+    SQUnsignedInteger nvalues = _class->_defaultvalues.size();
+    for(SQUnsignedInteger i =0; i< nvalues; i++) {
+        SQSharedState::TraverseObject(_values[i],visit,ud);
+    }
+}
+
+void SQGenerator::Traverse(SQGCVISIT visit,void *ud)
+{
+    for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::TraverseObject(_stack[i],visit,ud);
+    SQSharedState::TraverseObject(_closure,visit,ud);
+}
+
+void SQFunctionProto::Traverse(SQGCVISIT visit,void *ud)
+{
+    for(SQInteger i = 0; i < _nliterals; i++) SQSharedState::TraverseObject(_literals[i],visit,ud);
+    for(SQInteger k = 0; k < _nfunctions; k++) SQSharedState::TraverseObject(_functions[k],visit,ud);
+}
+
+void SQClosure::Traverse(SQGCVISIT visit,void *ud)
+{
+    if(_base) visit(_base,ud);
+    SQFunctionProto *fp = _function;
+    visit(fp,ud);
+    for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::TraverseObject(_outervalues[i],visit,ud);
+    for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::TraverseObject(_defaultparams[k],visit,ud);
+}
+
+void SQNativeClosure::Traverse(SQGCVISIT visit,void *ud)
+{
+    for(SQUnsignedInteger i = 0; i < _noutervalues; i++) SQSharedState::TraverseObject(_outervalues[i],visit,ud);
+}
+
+void SQOuter::Traverse(SQGCVISIT visit,void *ud)
+{
+    if(_valptr == &_value) {
+      SQSharedState::TraverseObject(_value,visit,ud);
+    }
+}
+
+void SQUserData::Traverse(SQGCVISIT visit,void *ud)
+{
+    if(_delegate) visit(_delegate,ud);
+}
+
+SQInteger SQVM::MemSize()
+{
+    return sizeof(SQVM) + _stack.capacity() * sizeof(SQObjectPtr)
+        + _callstackdata.capacity() * sizeof(CallInfo) + _etraps.capacity() * sizeof(SQExceptionTrap);
+}
+
+SQInteger SQArray::MemSize()
+{
+    return sizeof(SQArray) + _values.capacity() * sizeof(SQObjectPtr);
+}
+
+SQInteger SQClass::MemSize()
+{
+    return sizeof(SQClass) + (_defaultvalues.capacity() + _methods.capacity()) * sizeof(SQClassMember);
+}
+
+SQInteger SQInstance::MemSize()
+{
+    return calcinstancesize(_class);
+}
+
+SQInteger SQGenerator::MemSize()
+{
+    return sizeof(SQGenerator) + _stack.capacity() * sizeof(SQObjectPtr) + _etraps.capacity() * sizeof(SQExceptionTrap);
+}
+
+SQInteger SQFunctionProto::MemSize()
+{
+    SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+    if(_inlinecachemap) size += _ninstructions * sizeof(unsigned short) + _ninlinecaches * sizeof(SQInlineCache);
+    return size;
+}
+
+SQInteger SQClosure::MemSize()
+{
+    return _CALC_CLOSURE_SIZE(_function);
+}
+
+SQInteger SQNativeClosure::MemSize()
+{
+    return _CALC_NATVIVECLOSURE_SIZE(_noutervalues) + _typecheck.capacity() * sizeof(SQInteger);
+}
+
+SQInteger SQOuter::MemSize()
+{
+    return sizeof(SQOuter);
+}
+
+SQInteger SQUserData::MemSize()
+{
+    return sq_aligning(sizeof(SQUserData)) + _size;
+}
+
 #endif
 
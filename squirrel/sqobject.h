@@ -14,6 +14,15 @@
 #define SQ_CLOSURESTREAM_PART (('P'<<24)|('A'<<16)|('R'<<8)|('T'))
 #define SQ_CLOSURESTREAM_TAIL (('T'<<24)|('A'<<16)|('I'<<8)|('L'))
 
+//the cycle collector needs the chains of the garbage collector
+#ifdef NO_GARBAGE_COLLECTOR
+#undef SQ_CYCLE_COLLECTOR
+#endif
+//the parallel marker runs the full collections of the mark and sweep collector
+#if defined(NO_GARBAGE_COLLECTOR) || defined(SQ_CYCLE_COLLECTOR)
+#undef SQ_PARALLEL_MARK
+#endif
+
 struct SQSharedState;
 
 enum SQMetaMethod{
@@ -105,31 +114,299 @@ struct SQWeakRef : SQRefCounted
 
 struct SQObjectPtr;
 
-#define __AddRef(type,unval) if(ISREFCOUNTED(type)) \
-        { \
-            unval.pRefCounted->_uiRef++; \
-        }
-
-#define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))  \
-        {   \
-            unval.pRefCounted->Release();   \
-        }
+#ifdef SQ_CYCLE_COLLECTOR
+struct SQCollectable;
+//a collectable whose reference count went down without reaching 0 can be part of a garbage cycle
+inline void sq_possiblecycle(SQRefCounted *) {}
+inline void sq_possiblecycle(SQCollectable *c);
+//same, for a refcounted object already known to be a collectable
+inline void sq_possiblecycleof(SQRefCounted *o);
 
 #define __ObjRelease(obj) { \
     if((obj)) { \
         (obj)->_uiRef--; \
         if((obj)->_uiRef == 0) \
             (obj)->Release(); \
+        else \
+            sq_possiblecycle(obj); \
         (obj) = NULL;   \
     } \
 }
+#else
+#define __ObjRelease(obj) { \
+    if((obj)) { \
+        (obj)->_uiRef--; \
+        if((obj)->_uiRef == 0) \
+            (obj)->Release(); \
+        (obj) = NULL;   \
+    } \
+}
+#endif
 
 #define __ObjAddRef(obj) { \
     (obj)->_uiRef++; \
 }
 
 #define is_delegable(t) (sq_type(t)&SQOBJECT_DELEGABLE)
-#define raw_type(obj) _RAW_TYPE((obj)._type)
+#define raw_type(obj) _RAW_TYPE(sq_type(obj))
+
+#ifdef SQ_NANBOXING
+//NaN-boxed objects(see tagSQObject in squirrel.h)
+//integers are 47 bits wide and wrap around, pointers must fit in 47 bits
+#define SQ_NB_PREFIX        ((SQRawObjectVal)0xFFF0000000000000ULL)
+#define SQ_NB_PAYLOAD       ((SQRawObjectVal)0x00007FFFFFFFFFFFULL)
+#define SQ_NB_CANONICALNAN  ((SQRawObjectVal)0x7FF8000000000000ULL)
+#define SQ_NB_TAGSHIFT      47
+#define SQ_NB_BOX(tag,payload) (SQ_NB_PREFIX | ((SQRawObjectVal)(tag) << SQ_NB_TAGSHIFT) | (payload))
+
+//tag 0 is -inf, tags from SQ_NBTAG_STRING on are reference counted
+#define SQ_NBTAG_NULL           1
+#define SQ_NBTAG_INTEGER        2
+#define SQ_NBTAG_BOOL           3
+#define SQ_NBTAG_USERPOINTER    4
+#define SQ_NBTAG_STRING         5
+#define SQ_NBTAG_TABLE          6
+#define SQ_NBTAG_ARRAY          7
+#define SQ_NBTAG_USERDATA       8
+#define SQ_NBTAG_CLOSURE        9
+#define SQ_NBTAG_NATIVECLOSURE  10
+#define SQ_NBTAG_GENERATOR      11
+#define SQ_NBTAG_THREAD         12
+#define SQ_NBTAG_FUNCPROTO      13
+#define SQ_NBTAG_CLASS          14
+#define SQ_NBTAG_INSTANCE       15
+#define SQ_NBTAG_WEAKREF        16
+#define SQ_NBTAG_OUTER          17
+
+#define SQ_NB_NULL          SQ_NB_BOX(SQ_NBTAG_NULL,0)
+#define SQ_NB_REFCOUNTED    SQ_NB_BOX(SQ_NBTAG_STRING,0)
+
+inline SQRawObjectVal _nbtag(SQObjectType type)
+{
+    switch(type) {
+    case OT_NULL: return SQ_NBTAG_NULL;
+    case OT_INTEGER: return SQ_NBTAG_INTEGER;
+    case OT_BOOL: return SQ_NBTAG_BOOL;
+    case OT_USERPOINTER: return SQ_NBTAG_USERPOINTER;
+    case OT_STRING: return SQ_NBTAG_STRING;
+    case OT_TABLE: return SQ_NBTAG_TABLE;
+    case OT_ARRAY: return SQ_NBTAG_ARRAY;
+    case OT_USERDATA: return SQ_NBTAG_USERDATA;
+    case OT_CLOSURE: return SQ_NBTAG_CLOSURE;
+    case OT_NATIVECLOSURE: return SQ_NBTAG_NATIVECLOSURE;
+    case OT_GENERATOR: return SQ_NBTAG_GENERATOR;
+    case OT_THREAD: return SQ_NBTAG_THREAD;
+    case OT_FUNCPROTO: return SQ_NBTAG_FUNCPROTO;
+    case OT_CLASS: return SQ_NBTAG_CLASS;
+    case OT_INSTANCE: return SQ_NBTAG_INSTANCE;
+    case OT_WEAKREF: return SQ_NBTAG_WEAKREF;
+    case OT_OUTER: return SQ_NBTAG_OUTER;
+    default: assert(0); return SQ_NBTAG_NULL;
+    }
+}
+
+inline SQRawObjectVal _nbinteger(SQInteger i)
+{
+    return SQ_NB_BOX(SQ_NBTAG_INTEGER,(SQRawObjectVal)i & SQ_NB_PAYLOAD);
+}
+
+inline SQRawObjectVal _nbfloat(SQFloat f)
+{
+    SQRawObjectVal val;
+    if(f != f) return SQ_NB_CANONICALNAN; //a negative NaN would look like a boxed value
+    memcpy(&val,&f,sizeof(val));
+    return val;
+}
+
+inline SQFloat _nbtofloat(SQRawObjectVal val)
+{
+    SQFloat f;
+    memcpy(&f,&val,sizeof(f));
+    return f;
+}
+
+inline SQRawObjectVal _nbpointer(SQRawObjectVal tag,const void *p)
+{
+    assert(((SQRawObjectVal)p & ~SQ_NB_PAYLOAD) == 0);
+    return SQ_NB_BOX(tag,(SQRawObjectVal)p);
+}
+
+#define __AddRef(val) if((val) >= SQ_NB_REFCOUNTED) \
+        { \
+            ((SQRefCounted *)((val) & SQ_NB_PAYLOAD))->_uiRef++; \
+        }
+
+#ifdef SQ_CYCLE_COLLECTOR
+//everything from the tables up is a collectable, but the weak references
+#define __Release(val) if((val) >= SQ_NB_REFCOUNTED)  \
+        {   \
+            if((--((SQRefCounted *)((val) & SQ_NB_PAYLOAD))->_uiRef)==0) \
+                ((SQRefCounted *)((val) & SQ_NB_PAYLOAD))->Release();   \
+            else if((val) >= SQ_NB_BOX(SQ_NBTAG_TABLE,0) && (((val) >> SQ_NB_TAGSHIFT) & 0x1F) != SQ_NBTAG_WEAKREF) \
+                sq_possiblecycleof((SQRefCounted *)((val) & SQ_NB_PAYLOAD)); \
+        }
+#else
+#define __Release(val) if((val) >= SQ_NB_REFCOUNTED && ((--((SQRefCounted *)((val) & SQ_NB_PAYLOAD))->_uiRef)==0))  \
+        {   \
+            ((SQRefCounted *)((val) & SQ_NB_PAYLOAD))->Release();   \
+        }
+#endif
+
+#define _nbpayload(obj) ((obj)._val & SQ_NB_PAYLOAD)
+
+#define _integer(obj) ((SQInteger)((obj)._val << (64 - SQ_NB_TAGSHIFT)) >> (64 - SQ_NB_TAGSHIFT))
+#define _float(obj) _nbtofloat((obj)._val)
+#define _string(obj) ((SQString *)_nbpayload(obj))
+#define _table(obj) ((SQTable *)_nbpayload(obj))
+#define _array(obj) ((SQArray *)_nbpayload(obj))
+#define _closure(obj) ((SQClosure *)_nbpayload(obj))
+#define _generator(obj) ((SQGenerator *)_nbpayload(obj))
+#define _nativeclosure(obj) ((SQNativeClosure *)_nbpayload(obj))
+#define _userdata(obj) ((SQUserData *)_nbpayload(obj))
+#define _userpointer(obj) ((SQUserPointer)_nbpayload(obj))
+#define _thread(obj) ((SQVM *)_nbpayload(obj))
+#define _funcproto(obj) ((SQFunctionProto *)_nbpayload(obj))
+#define _class(obj) ((SQClass *)_nbpayload(obj))
+#define _instance(obj) ((SQInstance *)_nbpayload(obj))
+#define _delegable(obj) ((SQDelegable *)_nbpayload(obj))
+#define _weakref(obj) ((SQWeakRef *)_nbpayload(obj))
+#define _outer(obj) ((SQOuter *)_nbpayload(obj))
+#define _refcounted(obj) ((SQRefCounted *)_nbpayload(obj))
+#define _rawval(obj) ((obj)._val)
+//the tag is part of the raw value
+#define _rawequal(o1,o2) (_rawval(o1) == _rawval(o2))
+
+//store a value in a SQObject without touching the reference counts
+#define _setnull(obj) { (obj)._val = SQ_NB_NULL; }
+#define _setinteger(obj,i) { (obj)._val = _nbinteger(i); }
+#define _setfloat(obj,f) { (obj)._val = _nbfloat(f); }
+#define _setbool(obj,b) { (obj)._val = SQ_NB_BOX(SQ_NBTAG_BOOL,(b)?1:0); }
+#define _setrefcounted(obj,t,p) { (obj)._val = _nbpointer(_nbtag(t),(SQRefCounted *)(p)); }
+
+/////////////////////////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////////////////
+#define _REF_TYPE_DECL(type,_class,tag) \
+    SQObjectPtr(_class * x) \
+    { \
+        assert(x); \
+        _val = _nbpointer(tag,x); \
+        ((SQRefCounted *)_nbpayload(*this))->_uiRef++; \
+    } \
+    inline SQObjectPtr& operator=(_class *x) \
+    {  \
+        SQRawObjectVal oldVal = _val; \
+        _val = _nbpointer(tag,x); \
+        ((SQRefCounted *)_nbpayload(*this))->_uiRef++; \
+        __Release(oldVal); \
+        return *this; \
+    }
+
+#define _SCALAR_TYPE_DECL(_class,box) \
+    SQObjectPtr(_class x) \
+    { \
+        _val = box; \
+    } \
+    inline SQObjectPtr& operator=(_class x) \
+    {  \
+        __Release(_val); \
+        _val = box; \
+        return *this; \
+    }
+struct SQObjectPtr : public SQObject
+{
+    SQObjectPtr()
+    {
+        _val = SQ_NB_NULL;
+    }
+    SQObjectPtr(const SQObjectPtr &o)
+    {
+        _val = o._val;
+        __AddRef(_val);
+    }
+    SQObjectPtr(const SQObject &o)
+    {
+        _val = o._val;
+        __AddRef(_val);
+    }
+    _REF_TYPE_DECL(OT_TABLE,SQTable,SQ_NBTAG_TABLE)
+    _REF_TYPE_DECL(OT_CLASS,SQClass,SQ_NBTAG_CLASS)
+    _REF_TYPE_DECL(OT_INSTANCE,SQInstance,SQ_NBTAG_INSTANCE)
+    _REF_TYPE_DECL(OT_ARRAY,SQArray,SQ_NBTAG_ARRAY)
+    _REF_TYPE_DECL(OT_CLOSURE,SQClosure,SQ_NBTAG_CLOSURE)
+    _REF_TYPE_DECL(OT_NATIVECLOSURE,SQNativeClosure,SQ_NBTAG_NATIVECLOSURE)
+    _REF_TYPE_DECL(OT_OUTER,SQOuter,SQ_NBTAG_OUTER)
+    _REF_TYPE_DECL(OT_GENERATOR,SQGenerator,SQ_NBTAG_GENERATOR)
+    _REF_TYPE_DECL(OT_STRING,SQString,SQ_NBTAG_STRING)
+    _REF_TYPE_DECL(OT_USERDATA,SQUserData,SQ_NBTAG_USERDATA)
+    _REF_TYPE_DECL(OT_WEAKREF,SQWeakRef,SQ_NBTAG_WEAKREF)
+    _REF_TYPE_DECL(OT_THREAD,SQVM,SQ_NBTAG_THREAD)
+    _REF_TYPE_DECL(OT_FUNCPROTO,SQFunctionProto,SQ_NBTAG_FUNCPROTO)
+
+    _SCALAR_TYPE_DECL(SQInteger,_nbinteger(x))
+    _SCALAR_TYPE_DECL(SQFloat,_nbfloat(x))
+    _SCALAR_TYPE_DECL(SQUserPointer,_nbpointer(SQ_NBTAG_USERPOINTER,x))
+    _SCALAR_TYPE_DECL(bool,SQ_NB_BOX(SQ_NBTAG_BOOL,x?1:0))
+
+    ~SQObjectPtr()
+    {
+        __Release(_val);
+    }
+
+    inline SQObjectPtr& operator=(const SQObjectPtr& obj)
+    {
+        SQRawObjectVal oldVal = _val;
+        _val = obj._val;
+        __AddRef(_val);
+        __Release(oldVal);
+        return *this;
+    }
+    inline SQObjectPtr& operator=(const SQObject& obj)
+    {
+        SQRawObjectVal oldVal = _val;
+        _val = obj._val;
+        __AddRef(_val);
+        __Release(oldVal);
+        return *this;
+    }
+    inline void Null()
+    {
+        SQRawObjectVal oldVal = _val;
+        _val = SQ_NB_NULL;
+        __Release(oldVal);
+    }
+    private:
+        SQObjectPtr(const SQChar *){} //safety
+};
+
+
+inline void _Swap(SQObject &a,SQObject &b)
+{
+    SQRawObjectVal oldVal = a._val;
+    a._val = b._val;
+    b._val = oldVal;
+}
+
+#else //SQ_NANBOXING
+
+#define __AddRef(type,unval) if(ISREFCOUNTED(type)) \
+        { \
+            unval.pRefCounted->_uiRef++; \
+        }
+
+#ifdef SQ_CYCLE_COLLECTOR
+#define __Release(type,unval) if(ISREFCOUNTED(type))  \
+        {   \
+            if((--unval.pRefCounted->_uiRef)==0) \
+                unval.pRefCounted->Release();   \
+            else if(!((type) & (_RT_STRING|_RT_WEAKREF))) \
+                sq_possiblecycleof(unval.pRefCounted); \
+        }
+#else
+#define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))  \
+        {   \
+            unval.pRefCounted->Release();   \
+        }
+#endif
 
 #define _integer(obj) ((obj)._unVal.nInteger)
 #define _float(obj) ((obj)._unVal.fFloat)
@@ -150,12 +427,16 @@ struct SQObjectPtr;
 #define _outer(obj) ((obj)._unVal.pOuter)
 #define _refcounted(obj) ((obj)._unVal.pRefCounted)
 #define _rawval(obj) ((obj)._unVal.raw)
+#define _rawequal(o1,o2) (_rawval(o1) == _rawval(o2) && sq_type(o1) == sq_type(o2))
 
-#define _stringval(obj) (obj)._unVal.pString->_val
-#define _userdataval(obj) ((SQUserPointer)sq_aligning((obj)._unVal.pUserData + 1))
+//store a value in a SQObject without touching the reference counts
+#define _setobject(obj,t,sym,x) { SQObjectValue _newval; _newval.raw = 0; _newval.sym = (x); (obj)._type = (t); (obj)._unVal = _newval; }
+#define _setnull(obj) _setobject(obj,OT_NULL,pUserPointer,NULL)
+#define _setinteger(obj,i) _setobject(obj,OT_INTEGER,nInteger,i)
+#define _setfloat(obj,f) _setobject(obj,OT_FLOAT,fFloat,f)
+#define _setbool(obj,b) _setobject(obj,OT_BOOL,nInteger,(b)?1:0)
+#define _setrefcounted(obj,t,p) _setobject(obj,t,pRefCounted,p)
 
-#define tofloat(num) ((sq_type(num)==OT_INTEGER)?(SQFloat)_integer(num):_float(num))
-#define tointeger(num) ((sq_type(num)==OT_FLOAT)?(SQInteger)_float(num):_integer(num))
 /////////////////////////////////////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////////////////
 #if defined(SQUSEDOUBLE) && !defined(_SQ64) || !defined(SQUSEDOUBLE) && defined(_SQ64)
@@ -306,34 +587,78 @@ inline void _Swap(SQObject &a,SQObject &b)
     b._type = tOldType;
     b._unVal = unOldVal;
 }
+#endif //SQ_NANBOXING
+
+#define _stringval(obj) _string(obj)->_val
+#define _userdataval(obj) ((SQUserPointer)sq_aligning(_userdata(obj) + 1))
+
+#define tofloat(num) ((sq_type(num)==OT_INTEGER)?(SQFloat)_integer(num):_float(num))
+#define tointeger(num) ((sq_type(num)==OT_FLOAT)?(SQInteger)_float(num):_integer(num))
 
 /////////////////////////////////////////////////////////////////////////////////////
 #ifndef NO_GARBAGE_COLLECTOR
 #define MARK_FLAG 0x80000000
+//values of SQCollectable::_gcrefs outside of a cycle search, old collectables
+//are GC_WHITE0 or GC_WHITE1(see SQSharedState::_gc_currentwhite)
+#define GC_YOUNG -1
+#define GC_REACHABLE -2
+#define GC_GRAY -3
+#define GC_WHITE0 -4
+#define GC_WHITE1 -5
+//in the candidates of the cycle collector(see SQSharedState::CollectCycles())
+#define GC_CANDIDATE -6
+struct SQCollectable;
+typedef void (*SQGCVISIT)(SQCollectable *c,void *ud);
 struct SQCollectable : public SQRefCounted {
     SQCollectable *_next;
     SQCollectable *_prev;
     SQSharedState *_sharedstate;
+    //generation and color, or the references left from outside while searching for cycles
+    SQInteger _gcrefs;
     virtual SQObjectType GetType()=0;
     virtual void Release()=0;
     virtual void Mark(SQCollectable **chain)=0;
+    //calls visit for every collectable referenced through a reference count
+    virtual void Traverse(SQGCVISIT visit,void *ud)=0;
+    //bytes of the collectable and of the buffers it owns(see sq_getheapstats())
+    virtual SQInteger MemSize()=0;
     void UnMark();
     virtual void Finalize()=0;
+#ifdef SQ_CYCLE_COLLECTOR
+    void PossibleCycle();
+#endif
     static void AddToChain(SQCollectable **chain,SQCollectable *c);
     static void RemoveFromChain(SQCollectable **chain,SQCollectable *c);
 };
 
+#ifdef SQ_CYCLE_COLLECTOR
+inline void sq_possiblecycle(SQCollectable *c)
+{
+    if(c->_gcrefs != GC_CANDIDATE) c->PossibleCycle();
+}
+
+inline void sq_possiblecycleof(SQRefCounted *o)
+{
+    sq_possiblecycle(static_cast<SQCollectable *>(o));
+}
+#endif
+
 
 #define ADD_TO_CHAIN(chain,obj) AddToChain(chain,obj)
 #define REMOVE_FROM_CHAIN(chain,obj) {if(!(_uiRef&MARK_FLAG))RemoveFromChain(chain,obj);}
 #define CHAINABLE_OBJ SQCollectable
-#define INIT_CHAIN() {_next=NULL;_prev=NULL;_sharedstate=ss;}
+#define INIT_CHAIN() {_next=NULL;_prev=NULL;SQCollectable::_sharedstate=ss;_gcrefs=GC_YOUNG;}
+#define _gcchain(obj) (obj)->_sharedstate->GCChain(obj)
+//shared state charged for the memory of a collectable(see sq_ss_malloc())
+#define _gcss(ss) (ss)
 #else
 
 #define ADD_TO_CHAIN(chain,obj) ((void)0)
 #define REMOVE_FROM_CHAIN(chain,obj) ((void)0)
 #define CHAINABLE_OBJ SQRefCounted
 #define INIT_CHAIN() ((void)0)
+//without a garbage collector the collectables don't know their shared state
+#define _gcss(ss) NULL
 #endif
 
 struct SQDelegable : public CHAINABLE_OBJ {
@@ -99,7 +99,23 @@ enum SQOpcode
     _OP_THROW=              0x39,
     _OP_NEWSLOTA=           0x3A,
     _OP_GETBASE=            0x3B,
-    _OP_CLOSE=              0x3C
+    _OP_CLOSE=              0x3C,
+    //type specialized variants, only written by the VM over the generic opcode (quickening)
+    _OP_ADDI=               0x3D,
+    _OP_ADDF=               0x3E,
+    _OP_SUBI=               0x3F,
+    _OP_SUBF=               0x40,
+    _OP_MULI=               0x41,
+    _OP_MULF=               0x42,
+    _OP_CMPI=               0x43,
+    _OP_CMPF=               0x44,
+    _OP_JCMPI=              0x45,
+    _OP_JCMPF=              0x46,
+    //counted loops, the step, the bound check and the jump back of a for
+    _OP_FORLOOP=            0x47,
+    //switch dispatch, followed by an _OP_JMP for every slot and the one taken when no case matches
+    _OP_JMPTABLE=           0x48,
+    _OP_JMPHASH=            0x49
 };
 
 struct SQInstructionDesc {
@@ -129,4 +145,23 @@ typedef sqvector<SQInstruction> SQInstructionVec;
 #define NEW_SLOT_ATTRIBUTES_FLAG    0x01
 #define NEW_SLOT_STATIC_FLAG        0x02
 
+//_OP_FORLOOP arg1: the CmpOP in the low 3 bits, the flags and the jump in the bits above
+#define FORLOOP_LITERAL             0x08 //arg2 is a literal, not a stack slot
+#define FORLOOP_SUB                 0x10 //the step is a '-=', sarg3 is its opposite
+#define FORLOOP_ARG1(jump,cmp,flags) ((SQInt32)((jump) * 32) | (cmp) | (flags))
+#define FORLOOP_CMP(arg1)           ((CmpOP)((arg1) & 0x07))
+#define FORLOOP_JUMP(sarg1)         ((sarg1) >> 5)
+
+//_OP_JMPTABLE arg1: the label of the first slot, arg2 and arg3: the number of slots
+//_OP_JMPHASH arg2: log2 of the number of slots, the _OP_JMP of a slot keeps in arg0, arg2 and arg3
+//the literal of its label + 1, 0 if the slot is free
+#define JMPTABLE_SIZE(i)            ((SQInteger)(i)._arg2 | ((SQInteger)(i)._arg3 << 8))
+#define JMPHASH_SIZE(i)             ((SQInteger)1 << (i)._arg2)
+#define JMPHASH_KEY(i)              ((SQInteger)(i)._arg0 | ((SQInteger)(i)._arg2 << 8) | ((SQInteger)(i)._arg3 << 16))
+#define JMPHASH_SLOT(h,bits)        ((SQInteger)(((SQUnsignedInteger32)(h) * 2654435769u) >> (32 - (bits))))
+#define JMPTABLE_JUMPS(i)           (((i).op == _OP_JMPTABLE ? JMPTABLE_SIZE(i) : JMPHASH_SIZE(i)) + 1)
+//the labels of a table are integers a float holds exactly, so a float finds the case == would
+#define JMPTABLE_MAXKEY             ((SQInteger)(sizeof(SQFloat) == sizeof(SQInt32) ? 0x7FFFFF : \
+                                        (sizeof(SQInteger) == sizeof(SQInt32) ? 0x7FFFFFFF : 0xFFFFFFFFFFFFFLL)))
+
 #endif // _SQOPCODES_H_
@@ -0,0 +1,286 @@
+/*
+    see copyright notice in squirrel.h
+*/
+#include "sqpcheader.h"
+
+#ifdef SQ_PARALLEL_MARK
+#include <thread>
+#include <mutex>
+#include <atomic>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/*
+    parallel full collection(see sq_setgcthreads()): the mutator is paused, every worker
+    marks from a private stack and offers part of it to the others, which steal it when
+    they run out of work. The marks are the MARK_FLAG of the reference counts, set with an
+    atomic or, while the calling thread splits _gc_chain in segments. Then every worker sweeps
+    a segment: the marked collectables lose the mark and take the other white, like at the end
+    of an incremental cycle, so they can be released while the garbage is freed.
+*/
+
+//collectables moved at once from the private stack of a worker to the stealable one
+#define GC_PARCHUNK 256
+//distance between two possible segment boundaries of _gc_chain
+#define GC_PARSEGMENT 1024
+
+//sets the mark of c, true if it wasn't already set
+static inline bool gc_trymark(SQCollectable *c)
+{
+#if defined(_MSC_VER)
+#ifdef _SQ64
+    return !(_InterlockedOr64((volatile __int64 *)&c->_uiRef,MARK_FLAG) & MARK_FLAG);
+#else
+    return !(_InterlockedOr((volatile long *)&c->_uiRef,MARK_FLAG) & MARK_FLAG);
+#endif
+#else
+    if(__atomic_load_n(&c->_uiRef,__ATOMIC_RELAXED) & MARK_FLAG) return false;
+    return !(__atomic_fetch_or(&c->_uiRef,(SQUnsignedInteger)MARK_FLAG,__ATOMIC_RELAXED) & MARK_FLAG);
+#endif
+}
+
+struct SQParallelMark;
+
+struct SQMarkWorker
+{
+    SQMarkWorker() { _nshared = 0; _first = _last = _live = _livetail = _dead = _deadtail = NULL; }
+    void Mark();
+    bool Refill();
+    void Share();
+    bool Steal(SQMarkWorker *w);
+    void Sweep();
+    SQParallelMark *_pm;
+    SQInteger _id;
+    //only the worker touches its stack
+    sqvector<SQCollectable *> _stack;
+    //what the other workers can steal, guarded by _lock
+    std::mutex _lock;
+    sqvector<SQCollectable *> _shared;
+    std::atomic<SQInteger> _nshared;
+    //segment of _gc_chain swept by the worker, from _first up to _last excluded
+    SQCollectable *_first;
+    SQCollectable *_last;
+    SQCollectable *_live;
+    SQCollectable *_livetail;
+    SQCollectable *_dead;
+    SQCollectable *_deadtail;
+};
+
+struct SQParallelMark
+{
+    SQMarkWorker *_workers;
+    SQInteger _nworkers;
+    //workers that have run out of work, the mark is over when they all have
+    std::atomic<SQInteger> _idle;
+    //color of the marked collectables after the sweep
+    SQInteger _black;
+};
+
+static void gc_parmark(SQCollectable *c,void *ud)
+{
+    if(!gc_trymark(c)) return;
+    SQMarkWorker *w = (SQMarkWorker *)ud;
+    w->_stack.push_back(c);
+    //a big array or table gives away part of its content while it is being traversed
+    if((w->_stack.size() % GC_PARCHUNK) == 0 && w->_nshared.load(std::memory_order_relaxed) == 0) w->Share();
+}
+
+void SQMarkWorker::Share()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    SQUnsignedInteger n = _stack.size() / 2;
+    if(n > GC_PARCHUNK) n = GC_PARCHUNK;
+    for(SQUnsignedInteger i = 0; i < n; i++) {
+        _shared.push_back(_stack.back());
+        _stack.pop_back();
+    }
+    _nshared = (SQInteger)_shared.size();
+}
+
+bool SQMarkWorker::Steal(SQMarkWorker *w)
+{
+    std::lock_guard<std::mutex> guard(w->_lock);
+    SQUnsignedInteger n = w->_shared.size();
+    if(!n) return false;
+    for(SQUnsignedInteger i = 0; i < n; i++) _stack.push_back(w->_shared[i]);
+    w->_shared.resize(0);
+    w->_nshared = 0;
+    return true;
+}
+
+/*
+    takes back the shared collectables or steals some from the other workers,
+    false once all the workers are out of work.
+    Only the owner adds to a shared stack, so an idle worker has nothing left to steal.
+*/
+bool SQMarkWorker::Refill()
+{
+    if(_nshared.load() && Steal(this)) return true;
+    _pm->_idle++;
+    for(;;) {
+        for(SQInteger i = 1; i < _pm->_nworkers; i++) {
+            SQMarkWorker *w = &_pm->_workers[(_id + i) % _pm->_nworkers];
+            if(!w->_nshared.load()) continue;
+            _pm->_idle--;
+            if(Steal(w)) return true;
+            _pm->_idle++;
+        }
+        if(_pm->_idle.load() == _pm->_nworkers) return false;
+        std::this_thread::yield();
+    }
+}
+
+void SQMarkWorker::Mark()
+{
+    do {
+        while(_stack.size()) {
+            SQCollectable *c = _stack.back();
+            _stack.pop_back();
+            c->Traverse(gc_parmark,this);
+            if(_stack.size() > GC_PARCHUNK && _nshared.load(std::memory_order_relaxed) == 0) Share();
+        }
+    } while(Refill());
+}
+
+//splits the segment in the marked collectables and the garbage
+void SQMarkWorker::Sweep()
+{
+    SQCollectable *t = _first;
+    while(t != _last) {
+        SQCollectable *nx = t->_next;
+        bool marked = (t->_uiRef & MARK_FLAG) != 0;
+        SQCollectable **head = marked ? &_live : &_dead;
+        SQCollectable **tail = marked ? &_livetail : &_deadtail;
+        if(marked) {
+            t->UnMark();
+            t->_gcrefs = _pm->_black;
+        }
+        t->_prev = *tail;
+        t->_next = NULL;
+        if(*tail) (*tail)->_next = t;
+        else *head = t;
+        *tail = t;
+        t = nx;
+    }
+}
+
+//runs f on the workers from the second on, each on a thread of its own
+static void gc_startworkers(SQParallelMark &pm,void (SQMarkWorker::*f)(),sqvector<std::thread *> &threads)
+{
+    for(SQInteger i = 1; i < pm._nworkers; i++) {
+        SQMarkWorker *w = &pm._workers[i];
+        threads.push_back(new std::thread([w,f]() { (w->*f)(); }));
+    }
+}
+
+static void gc_joinworkers(sqvector<std::thread *> &threads)
+{
+    for(SQUnsignedInteger i = 0; i < threads.size(); i++) {
+        threads[i]->join();
+        delete threads[i];
+    }
+    threads.resize(0);
+}
+
+//appends the list head..tail to chain, whose last collectable is last
+static void gc_splice(SQCollectable **chain,SQCollectable **last,SQCollectable *head,SQCollectable *tail)
+{
+    if(!head) return;
+    if(*last) (*last)->_next = head;
+    else *chain = head;
+    head->_prev = *last;
+    *last = tail;
+}
+
+SQInteger SQSharedState::ParallelCollect()
+{
+    SQInteger start = GCClock();
+    SQParallelMark pm;
+    pm._nworkers = _gc_threads;
+    pm._idle = 0;
+    pm._black = GC_WHITE0 + GC_WHITE1 - _gc_currentwhite;
+    pm._workers = (SQMarkWorker *)SQ_MALLOC(sizeof(SQMarkWorker) * pm._nworkers);
+    for(SQInteger i = 0; i < pm._nworkers; i++) {
+        new (&pm._workers[i]) SQMarkWorker();
+        pm._workers[i]._pm = &pm;
+        pm._workers[i]._id = i;
+    }
+
+    //the roots can be stolen by any worker while this thread splits the chain in segments
+    SQMarkWorker *first = &pm._workers[0];
+    VisitRoots(gc_parmark,first);
+    while(first->_stack.size()) {
+        first->_shared.push_back(first->_stack.back());
+        first->_stack.pop_back();
+    }
+    first->_nshared = (SQInteger)first->_shared.size();
+    sqvector<std::thread *> threads;
+    gc_startworkers(pm,&SQMarkWorker::Mark,threads);
+
+    sqvector<SQCollectable *> bounds;
+    SQInteger count = 0;
+    for(SQCollectable *t = _gc_chain; t; t = t->_next) {
+        if((count++ % GC_PARSEGMENT) == 0) bounds.push_back(t);
+    }
+    SQInteger nbounds = (SQInteger)bounds.size();
+    for(SQInteger i = 0; i < pm._nworkers; i++) {
+        SQInteger from = nbounds * i / pm._nworkers;
+        SQInteger to = nbounds * (i + 1) / pm._nworkers;
+        pm._workers[i]._first = from < nbounds ? bounds[from] : NULL;
+        pm._workers[i]._last = to < nbounds ? bounds[to] : NULL;
+    }
+    first->Mark();
+    gc_joinworkers(threads);
+    SQInteger marked = GCClock();
+    _gc_marktime = marked - start;
+
+    gc_startworkers(pm,&SQMarkWorker::Sweep,threads);
+    first->Sweep();
+    gc_joinworkers(threads);
+
+    SQCollectable *garbage = NULL;
+    SQCollectable *glast = NULL;
+    SQCollectable *blast = NULL;
+    for(SQInteger i = 0; i < pm._nworkers; i++) {
+        SQMarkWorker *w = &pm._workers[i];
+        gc_splice(&_gc_black,&blast,w->_live,w->_livetail);
+        gc_splice(&garbage,&glast,w->_dead,w->_deadtail);
+    }
+    for(SQInteger i = 0; i < pm._nworkers; i++) pm._workers[i].~SQMarkWorker();
+    SQ_FREE(pm._workers,sizeof(SQMarkWorker) * pm._nworkers);
+    _gc_chain = garbage;
+
+    SQInteger n = 0;
+    _threshold = SQ_NOTHRESHOLD;
+    SQCollectable *t = _gc_chain;
+    SQCollectable *nx = NULL;
+    if(t) {
+        t->_uiRef++;
+        while(t) {
+            t->Finalize();
+            nx = t->_next;
+            if(nx) nx->_uiRef++;
+            if(--t->_uiRef == 0)
+                t->Release();
+            t = nx;
+            n++;
+        }
+    }
+
+    //what the release hooks have kept alive
+    while(_gc_chain) {
+        t = _gc_chain;
+        SQCollectable::RemoveFromChain(&_gc_chain,t);
+        t->_gcrefs = pm._black;
+        SQCollectable::AddToChain(&_gc_black,t);
+    }
+    _gc_chain = _gc_black;
+    _gc_black = NULL;
+    _gc_currentwhite = pm._black;
+    SetThreshold();
+    _gc_sweeptime = GCClock() - marked;
+    return n;
+}
+
+#endif
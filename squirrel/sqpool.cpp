@@ -0,0 +1,139 @@
+/*
+    see copyright notice in squirrel.h
+*/
+#include "sqpcheader.h"
+
+#ifndef NO_MEMORY_POOL
+
+SQMemPool::SQMemPool()
+{
+    for(SQInteger i = 0; i < SQ_POOL_NCLASSES; i++) _pages[i] = NULL;
+    _arenas = NULL;
+    _lastarena = NULL;
+    _emptyarena = NULL;
+    _narenas = 0;
+    _npages = 0;
+    _nblocks = 0;
+    _blockbytes = 0;
+    _nallocs = 0;
+}
+
+SQMemPool::~SQMemPool()
+{
+    SQPoolArena *a = _arenas;
+    while(a) {
+        SQPoolArena *next = a->_next;
+        sq_vm_free(a,SQ_POOL_ARENASIZE);
+        a = next;
+    }
+    if(_emptyarena) sq_vm_free(_emptyarena,SQ_POOL_ARENASIZE);
+}
+
+SQPoolArena *SQMemPool::NewArena()
+{
+    SQPoolArena *a = _emptyarena;
+    if(a) {
+        _emptyarena = NULL;
+    }
+    else {
+        a = (SQPoolArena *)sq_vm_malloc(SQ_POOL_ARENASIZE);
+        if(!a) return NULL;
+        _narenas++;
+    }
+    //the pages are aligned to their size, so a block finds its page by masking its address
+    size_t first = ((size_t)(a + 1) + (SQ_POOL_PAGESIZE - 1)) & ~((size_t)SQ_POOL_PAGESIZE - 1);
+    a->_nextpage = (unsigned char *)first;
+    a->_npages = (SQInteger)((((size_t)a) + SQ_POOL_ARENASIZE - first) / SQ_POOL_PAGESIZE);
+    a->_nfreepages = a->_npages;
+    a->_freepages = NULL;
+    a->_prev = NULL;
+    a->_next = _arenas;
+    if(_arenas) _arenas->_prev = a;
+    else _lastarena = a;
+    _arenas = a;
+    return a;
+}
+
+void SQMemPool::MoveArena(SQPoolArena *a,bool head)
+{
+    if(head ? a == _arenas : a == _lastarena) return;
+    //unlink
+    if(a->_prev) a->_prev->_next = a->_next;
+    else _arenas = a->_next;
+    if(a->_next) a->_next->_prev = a->_prev;
+    else _lastarena = a->_prev;
+    //and link again at one of the ends
+    if(head) {
+        a->_prev = NULL;
+        a->_next = _arenas;
+        if(_arenas) _arenas->_prev = a;
+        else _lastarena = a;
+        _arenas = a;
+    }
+    else {
+        a->_next = NULL;
+        a->_prev = _lastarena;
+        if(_lastarena) _lastarena->_next = a;
+        else _arenas = a;
+        _lastarena = a;
+    }
+}
+
+SQPoolPage *SQMemPool::NewPage(SQInteger cls)
+{
+    SQPoolArena *a = _arenas;
+    if(!a || !a->_nfreepages) {
+        a = NewArena();
+        if(!a) return NULL;
+    }
+    SQPoolPage *page = a->_freepages;
+    if(page) {
+        a->_freepages = page->_next;
+    }
+    else {
+        page = (SQPoolPage *)a->_nextpage;
+        a->_nextpage += SQ_POOL_PAGESIZE;
+    }
+    if(--a->_nfreepages == 0) MoveArena(a,false);
+    page->_arena = a;
+    page->_class = cls;
+    page->_used = 0;
+    page->_freeblocks = NULL;
+    page->_nextblock = SQ_POOL_PAGEHEADER;
+    page->_prev = NULL;
+    page->_next = _pages[cls];
+    if(_pages[cls]) _pages[cls]->_prev = page;
+    _pages[cls] = page;
+    _npages++;
+    return page;
+}
+
+void SQMemPool::Unlink(SQPoolPage *page)
+{
+    if(page->_prev) page->_prev->_next = page->_next;
+    else _pages[page->_class] = page->_next;
+    if(page->_next) page->_next->_prev = page->_prev;
+}
+
+void SQMemPool::FreePage(SQPoolPage *page)
+{
+    SQPoolArena *a = page->_arena;
+    page->_next = a->_freepages;
+    a->_freepages = page;
+    _npages--;
+    if(a->_nfreepages++ == 0) MoveArena(a,true);
+    if(a->_nfreepages == a->_npages) {
+        //back to the system, but one empty arena is kept to absorb the next growth
+        if(a->_prev) a->_prev->_next = a->_next;
+        else _arenas = a->_next;
+        if(a->_next) a->_next->_prev = a->_prev;
+        else _lastarena = a->_prev;
+        if(_emptyarena) {
+            sq_vm_free(a,SQ_POOL_ARENASIZE);
+            _narenas--;
+        }
+        else _emptyarena = a;
+    }
+}
+
+#endif //NO_MEMORY_POOL
@@ -0,0 +1,119 @@
+/*  see copyright notice in squirrel.h */
+#ifndef _SQPOOL_H_
+#define _SQPOOL_H_
+
+#ifndef NO_MEMORY_POOL
+
+//size classes, bigger blocks go straight to sq_vm_malloc()
+#define SQ_POOL_GRANULARITY 16
+#define SQ_POOL_MAXBLOCK 512
+#define SQ_POOL_NCLASSES (SQ_POOL_MAXBLOCK / SQ_POOL_GRANULARITY)
+#define SQ_POOL_CLASS(size) ((size) ? ((size) - 1) / SQ_POOL_GRANULARITY : 0)
+#define SQ_POOL_BLOCKSIZE(cls) (((cls) + 1) * SQ_POOL_GRANULARITY)
+//the blocks of a size class are carved from aligned pages, the pages from arenas
+#define SQ_POOL_PAGESIZE 4096
+#define SQ_POOL_ARENASIZE (256*1024)
+
+struct SQPoolArena;
+
+struct SQPoolPage
+{
+    //pages of the same size class with free blocks, or free pages of the arena
+    SQPoolPage *_next;
+    SQPoolPage *_prev;
+    SQPoolArena *_arena;
+    void *_freeblocks;
+    SQUnsignedInteger _used;
+    //offset of the first block never allocated
+    SQUnsignedInteger _nextblock;
+    SQInteger _class;
+};
+
+#define SQ_POOL_PAGEHEADER ((sizeof(SQPoolPage) + (SQ_POOL_GRANULARITY - 1)) & ~(SQ_POOL_GRANULARITY - 1))
+
+struct SQPoolArena
+{
+    SQPoolArena *_next;
+    SQPoolArena *_prev;
+    SQPoolPage *_freepages;
+    //first page never used
+    unsigned char *_nextpage;
+    SQInteger _nfreepages;
+    SQInteger _npages;
+};
+
+/*
+    per shared state allocator for the small blocks: every size class keeps a list
+    of the pages that have free blocks, a page that gets empty goes back to its arena
+    and an arena that gets empty goes back to the system(one is kept for reuse)
+*/
+struct SQMemPool
+{
+    SQMemPool();
+    ~SQMemPool();
+    void *Alloc(SQUnsignedInteger size)
+    {
+        SQInteger cls = SQ_POOL_CLASS(size);
+        SQPoolPage *page = _pages[cls];
+        if(!page && !(page = NewPage(cls))) return NULL;
+        void *p = page->_freeblocks;
+        if(p) {
+            page->_freeblocks = *((void **)p);
+        }
+        else {
+            p = ((unsigned char *)page) + page->_nextblock;
+            page->_nextblock += SQ_POOL_BLOCKSIZE(cls);
+        }
+        page->_used++;
+        if(!page->_freeblocks && page->_nextblock + SQ_POOL_BLOCKSIZE(cls) > SQ_POOL_PAGESIZE) {
+            //full, out of the list
+            _pages[cls] = page->_next;
+            if(page->_next) page->_next->_prev = NULL;
+        }
+        _nblocks++;
+        _blockbytes += SQ_POOL_BLOCKSIZE(cls);
+        _nallocs++;
+        return p;
+    }
+    void Free(void *p,SQUnsignedInteger size)
+    {
+        SQInteger cls = SQ_POOL_CLASS(size);
+        SQPoolPage *page = (SQPoolPage *)((size_t)p & ~((size_t)SQ_POOL_PAGESIZE - 1));
+        assert(page->_class == cls && page->_used > 0);
+        bool wasfull = !page->_freeblocks && page->_nextblock + SQ_POOL_BLOCKSIZE(cls) > SQ_POOL_PAGESIZE;
+        *((void **)p) = page->_freeblocks;
+        page->_freeblocks = p;
+        _nblocks--;
+        _blockbytes -= SQ_POOL_BLOCKSIZE(cls);
+        if(--page->_used == 0) {
+            if(!wasfull) Unlink(page);
+            FreePage(page);
+        }
+        else if(wasfull) {
+            page->_prev = NULL;
+            page->_next = _pages[cls];
+            if(_pages[cls]) _pages[cls]->_prev = page;
+            _pages[cls] = page;
+        }
+    }
+    SQInteger _narenas;
+    SQInteger _npages;
+    SQInteger _nblocks;
+    SQInteger _blockbytes;
+    SQInteger _nallocs;
+private:
+    SQPoolPage *NewPage(SQInteger cls);
+    void FreePage(SQPoolPage *page);
+    void Unlink(SQPoolPage *page);
+    SQPoolArena *NewArena();
+    void MoveArena(SQPoolArena *a,bool head);
+    SQPoolPage *_pages[SQ_POOL_NCLASSES];
+    //the arenas with free pages come first
+    SQPoolArena *_arenas;
+    SQPoolArena *_lastarena;
+    SQPoolArena *_emptyarena;
+};
+
+#endif //NO_MEMORY_POOL
+
+#endif //_SQPOOL_H_
@@ -0,0 +1,224 @@
+/*
+    see copyright notice in squirrel.h
+*/
+#include "sqpcheader.h"
+#ifndef NO_GARBAGE_COLLECTOR
+#include "sqvm.h"
+#include "sqstring.h"
+#include "sqtable.h"
+#include "sqclass.h"
+#include "sqfuncproto.h"
+#include "sqclosure.h"
+
+/*
+    heap snapshot(see sq_writeheapsnapshot()): the nodes are the collectables of every chain,
+    the edges the references their Traverse() visits and the roots the collectables
+    VisitRoots() visits, the ones a full collection marks from. The strings are leaves shared
+    by the whole heap, only their number and size are written.
+    The heap isn't changed: the nodes are numbered in maps of their own, not in _gcrefs.
+*/
+
+//bytes written at once through the SQWRITEFUNC
+#define SNAP_BUFSIZE 16384
+
+struct SQSnapshotWriter
+{
+    SQSnapshotWriter(SQWRITEFUNC w,SQUserPointer up) { _w = w; _up = up; _len = 0; _ok = true; }
+    void Write(const void *p,SQInteger size)
+    {
+        const unsigned char *s = (const unsigned char *)p;
+        while(size > 0 && _ok) {
+            SQInteger n = SNAP_BUFSIZE - _len;
+            if(n > size) n = size;
+            memcpy(_buf + _len,s,n);
+            _len += n;
+            s += n;
+            size -= n;
+            if(_len == SNAP_BUFSIZE) Flush();
+        }
+    }
+    void WriteInt(SQInteger i) { Write(&i,sizeof(i)); }
+    void WriteInt32(SQUnsignedInteger32 i) { Write(&i,sizeof(i)); }
+    void Flush()
+    {
+        if(_ok && _len && _w(_up,_buf,_len) != _len) _ok = false;
+        _len = 0;
+    }
+    SQWRITEFUNC _w;
+    SQUserPointer _up;
+    unsigned char _buf[SNAP_BUFSIZE];
+    SQInteger _len;
+    bool _ok;
+};
+
+//index of a pointer, open addressing
+struct SQSnapshotMap
+{
+    void Init(SQInteger n)
+    {
+        SQInteger size = 16;
+        while(size < n * 2) size <<= 1;
+        _keys.resize(size,NULL);
+        _values.resize(size,-1);
+        _mask = size - 1;
+    }
+    SQInteger Pos(void *p)
+    {
+        SQInteger pos = (SQInteger)((((SQUnsignedInteger)p) >> 3) * 2654435761u) & _mask;
+        while(_keys[pos] && _keys[pos] != p) pos = (pos + 1) & _mask;
+        return pos;
+    }
+    void Set(void *p,SQInteger i)
+    {
+        SQInteger pos = Pos(p);
+        _keys[pos] = p;
+        _values[pos] = i;
+    }
+    SQInteger Get(void *p) { return _values[Pos(p)]; }
+    sqvector<void *> _keys;
+    sqvector<SQInteger> _values;
+    SQInteger _mask;
+};
+
+struct SQSnapshot
+{
+    SQSnapshotMap _index;
+    sqvector<SQCollectable *> _nodes;
+    //name of every node, NULL if it hasn't one
+    sqvector<SQString *> _nodenames;
+    sqvector<SQInteger> _edges;
+};
+
+static void snap_edge(SQCollectable *c,void *ud)
+{
+    SQSnapshot *s = (SQSnapshot *)ud;
+    SQInteger i = s->_index.Get(c);
+    if(i >= 0) s->_edges.push_back(i);
+}
+
+static SQString *snap_string(const SQObjectPtr &o)
+{
+    return sq_type(o) == OT_STRING ? _string(o) : NULL;
+}
+
+static SQString *snap_funcname(const SQObjectPtr &closure)
+{
+    return sq_type(closure) == OT_CLOSURE ? snap_string(_closure(closure)->_function->_name) : NULL;
+}
+
+//the name slot of the attributes of the class, if it has one
+static SQString *snap_classname(SQClass *c)
+{
+    if(sq_type(c->_attributes) != OT_TABLE) return NULL;
+    SQObjectPtr name;
+    if(!_table(c->_attributes)->GetStr(_SC("name"),4,name)) return NULL;
+    return snap_string(name);
+}
+
+bool SQSharedState::WriteHeapSnapshot(SQWRITEFUNC w,SQUserPointer up)
+{
+    SQSnapshot s;
+    SQCollectable *chains[] = { _gc_chain, _gc_young, _gc_gray, _gc_black,
+#ifdef SQ_CYCLE_COLLECTOR
+        _gc_candidates,
+#endif
+    };
+    SQInteger nchains = sizeof(chains) / sizeof(chains[0]);
+    SQInteger n = 0;
+    for(SQInteger i = 0; i < nchains; i++) {
+        for(SQCollectable *t = chains[i]; t; t = t->_next) n++;
+    }
+    s._index.Init(n);
+    s._nodes.reserve(n);
+    for(SQInteger i = 0; i < nchains; i++) {
+        for(SQCollectable *t = chains[i]; t; t = t->_next) {
+            s._index.Set(t,s._nodes.size());
+            s._nodes.push_back(t);
+        }
+    }
+
+    //the functions have their own names, the classes the one of their attributes or of a slot holding them
+    s._nodenames.resize(n,NULL);
+    for(SQInteger i = 0; i < n; i++) {
+        SQCollectable *t = s._nodes[i];
+        switch(t->GetType()) {
+        case OT_CLOSURE: s._nodenames[i] = snap_string(((SQClosure *)t)->_function->_name); break;
+        case OT_NATIVECLOSURE: s._nodenames[i] = snap_string(((SQNativeClosure *)t)->_name); break;
+        case OT_FUNCPROTO: s._nodenames[i] = snap_string(((SQFunctionProto *)t)->_name); break;
+        case OT_GENERATOR: s._nodenames[i] = snap_funcname(((SQGenerator *)t)->_closure); break;
+        case OT_CLASS: s._nodenames[i] = snap_classname((SQClass *)t); break;
+        default: break;
+        }
+    }
+    for(SQInteger i = 0; i < n; i++) {
+        if(s._nodes[i]->GetType() != OT_TABLE) continue;
+        SQTable *t = (SQTable *)s._nodes[i];
+        SQObjectPtr pos, key, val;
+        SQInteger next;
+        while((next = t->Next(false,pos,key,val)) != -1) {
+            pos = next;
+            if(sq_type(val) != OT_CLASS || sq_type(key) != OT_STRING) continue;
+            SQInteger c = s._index.Get(_class(val));
+            if(c >= 0 && !s._nodenames[c]) s._nodenames[c] = _string(key);
+        }
+    }
+    for(SQInteger i = 0; i < n; i++) {
+        if(s._nodes[i]->GetType() != OT_INSTANCE) continue;
+        SQInteger c = s._index.Get(((SQInstance *)s._nodes[i])->_class);
+        if(c >= 0) s._nodenames[i] = s._nodenames[c];
+    }
+
+    //the names are written once, the nodes refer to them by index
+    SQSnapshotMap names;
+    sqvector<SQString *> namelist;
+    names.Init(n);
+    sqvector<SQInteger> nameidx;
+    nameidx.resize(n,-1);
+    for(SQInteger i = 0; i < n; i++) {
+        SQString *name = s._nodenames[i];
+        if(!name) continue;
+        SQInteger idx = names.Get(name);
+        if(idx < 0) {
+            idx = namelist.size();
+            names.Set(name,idx);
+            namelist.push_back(name);
+        }
+        nameidx[i] = idx;
+    }
+
+    SQSnapshotWriter wr(w,up);
+    wr.WriteInt32(SQ_HEAPSNAPSHOT_TAG);
+    wr.WriteInt32(SQ_HEAPSNAPSHOT_VERSION);
+    wr.WriteInt32(sizeof(SQInteger));
+    wr.WriteInt32(sizeof(SQChar));
+    wr.WriteInt(namelist.size());
+    for(SQUnsignedInteger i = 0; i < namelist.size(); i++) {
+        wr.WriteInt(namelist[i]->_len);
+        wr.Write(namelist[i]->_val,namelist[i]->_len * sizeof(SQChar));
+    }
+    wr.WriteInt(n);
+    for(SQInteger i = 0; i < n && wr._ok; i++) {
+        SQCollectable *t = s._nodes[i];
+        s._edges.resize(0);
+        t->Traverse(snap_edge,&s);
+        wr.WriteInt(t->GetType());
+        wr.WriteInt(t->MemSize());
+        wr.WriteInt(nameidx[i]);
+        wr.WriteInt(s._edges.size());
+        if(s._edges.size()) wr.Write(&s._edges[0],s._edges.size() * sizeof(SQInteger));
+    }
+    s._edges.resize(0);
+    VisitRoots(snap_edge,&s);
+    wr.WriteInt(s._edges.size());
+    if(s._edges.size()) wr.Write(&s._edges[0],s._edges.size() * sizeof(SQInteger));
+    SQTypeStats strings = { OT_STRING, 0, 0 };
+    SQTypeStats weakrefs = { OT_WEAKREF, 0, 0 };
+    SQInteger slots, used;
+    _stringtable->GetStats(slots,used,strings,weakrefs);
+    wr.WriteInt(strings.objects);
+    wr.WriteInt(strings.bytes);
+    wr.Flush();
+    return wr._ok;
+}
+
+#endif
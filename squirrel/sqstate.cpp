@@ -2,6 +2,7 @@
     see copyright notice in squirrel.h
 */
 #include "sqpcheader.h"
+#include <time.h>
 #include "sqopcodes.h"
 #include "sqvm.h"
 #include "sqfuncproto.h"
@@ -12,7 +13,52 @@
 #include "squserdata.h"
 #include "sqclass.h"
 
-SQSharedState::SQSharedState()
+void *sq_ss_malloc(SQSharedState *ss,SQUnsignedInteger size)
+{
+    if(!ss) return sq_vm_malloc(size);
+    ss->_allocated += size;
+#ifndef NO_MEMORY_POOL
+    if(size <= SQ_POOL_MAXBLOCK) return ss->_pool.Alloc(size);
+#endif
+    return sq_vm_malloc(size);
+}
+
+void *sq_ss_realloc(SQSharedState *ss,void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size)
+{
+    if(!ss) return sq_vm_realloc(p,oldsize,size);
+    ss->_allocated += size - oldsize;
+#ifndef NO_MEMORY_POOL
+    if(p && oldsize <= SQ_POOL_MAXBLOCK && size <= SQ_POOL_MAXBLOCK && SQ_POOL_CLASS(oldsize) == SQ_POOL_CLASS(size))
+        return p;
+    if(!p || oldsize <= SQ_POOL_MAXBLOCK || size <= SQ_POOL_MAXBLOCK) {
+        void *newp = size <= SQ_POOL_MAXBLOCK ? ss->_pool.Alloc(size) : sq_vm_malloc(size);
+        if(p && newp) {
+            memcpy(newp,p,oldsize < size ? oldsize : size);
+            if(oldsize <= SQ_POOL_MAXBLOCK) ss->_pool.Free(p,oldsize);
+            else sq_vm_free(p,oldsize);
+        }
+        return newp;
+    }
+#endif
+    return sq_vm_realloc(p,oldsize,size);
+}
+
+void sq_ss_free(SQSharedState *ss,void *p,SQUnsignedInteger size)
+{
+    if(!ss) { sq_vm_free(p,size); return; }
+    ss->_allocated -= size;
+    if(ss->_mem_overlimit && ss->_allocated < ss->_mem_hardlimit) {
+        //back under the hard limit, crossing it again raises a new error(see CheckMemory())
+        ss->_mem_overlimit = ss->_mem_exhausted = false;
+        if(ss->_threshold > ss->_mem_hardlimit) ss->_threshold = ss->_mem_hardlimit;
+    }
+#ifndef NO_MEMORY_POOL
+    if(size <= SQ_POOL_MAXBLOCK) { ss->_pool.Free(p,size); return; }
+#endif
+    sq_vm_free(p,size);
+}
+
+SQSharedState::SQSharedState() : _allocated(0), _refs_table(this)
 {
     _compilererrorhandler = NULL;
     _printfunc = NULL;
@@ -21,6 +67,15 @@ SQSharedState::SQSharedState()
     _notifyallexceptions = false;
     _foreignptr = NULL;
     _releasehook = NULL;
+    _threshold = SQ_NOTHRESHOLD;
+    _mem_softlimit = 0;
+    _mem_hardlimit = 0;
+    _mem_emergency = 0;
+    _mem_overlimit = false;
+    _mem_exhausted = false;
+    _mem_reserve = 0;
+    _mem_hook = NULL;
+    _lastclassid = 0;
 }
 
 #define newsysstring(s) {   \
@@ -95,12 +150,46 @@ void SQSharedState::Init()
     _scratchpadsize=0;
 #ifndef NO_GARBAGE_COLLECTOR
     _gc_chain=NULL;
+    _gc_young=NULL;
+    _gc_gray=NULL;
+    _gc_black=NULL;
+    _gc_currentwhite=GC_WHITE0;
+    _gc_phase=SQ_GCPHASE_IDLE;
+    _gc_marked=0;
+    _gc_rootsmarked=false;
+    _gc_scanpos=0;
+    _gc_estimate=0;
+    _gc_collected=0;
+    _gc_auto=true;
+    _gc_pause=GC_DEFAULTPAUSE;
+    _gc_stepmul=GC_DEFAULTSTEPMUL;
+    _gc_threshold=SQ_NOTHRESHOLD;
+    _gc_hook=NULL;
+    _gc_fullcollections=0;
+    _gc_youngcollections=0;
+    _gc_cycles=0;
+    _gc_marktime=0;
+    _gc_sweeptime=0;
+    _gc_youngtime=0;
+    _gc_cycletime=0;
+    _gc_cycleclock=0;
+#ifdef SQ_PARALLEL_MARK
+    _gc_threads=1;
+#endif
+#ifdef SQ_CYCLE_COLLECTOR
+    _gc_candidates=NULL;
+    _gc_sweepcolor=GC_REACHABLE;
+#endif
 #endif
-    _stringtable = (SQStringTable*)SQ_MALLOC(sizeof(SQStringTable));
+    _stringtable = (SQStringTable*)SQ_SSMALLOC(this,sizeof(SQStringTable));
     new (_stringtable) SQStringTable(this);
-    sq_new(_metamethods,SQObjectPtrVec);
-    sq_new(_systemstrings,SQObjectPtrVec);
-    sq_new(_types,SQObjectPtrVec);
+    _metamethods = (SQObjectPtrVec*)SQ_SSMALLOC(this,sizeof(SQObjectPtrVec));
+    new (_metamethods) SQObjectPtrVec(this);
+    _systemstrings = (SQObjectPtrVec*)SQ_SSMALLOC(this,sizeof(SQObjectPtrVec));
+    new (_systemstrings) SQObjectPtrVec(this);
+    _types = (SQObjectPtrVec*)SQ_SSMALLOC(this,sizeof(SQObjectPtrVec));
+    new (_types) SQObjectPtrVec(this);
+    _rootshape = SQShape::Create(_gcss(this));
     _metamethodsmap = SQTable::Create(this,MT_LAST-1);
     //adding type strings to avoid memory trashing
     //types names
@@ -152,10 +241,17 @@ void SQSharedState::Init()
     _class_default_delegate = CreateDefaultDelegate(this,_class_default_delegate_funcz);
     _instance_default_delegate = CreateDefaultDelegate(this,_instance_default_delegate_funcz);
     _weakref_default_delegate = CreateDefaultDelegate(this,_weakref_default_delegate_funcz);
+    SetThreshold();
 }
 
 SQSharedState::~SQSharedState()
 {
+#ifndef NO_GARBAGE_COLLECTOR
+    _gc_auto = false;
+    _gc_hook = NULL;
+#endif
+    _mem_softlimit = _mem_hardlimit = 0;
+    _threshold = SQ_NOTHRESHOLD;
     if(_releasehook) { _releasehook(_foreignptr,0); _releasehook = NULL; }
     _constructoridx.Null();
     _table(_registry)->Finalize();
@@ -182,6 +278,12 @@ SQSharedState::~SQSharedState()
     _weakref_default_delegate.Null();
     _refs_table.Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
+    StopCycle();
+    PromoteYoung();
+#ifdef SQ_CYCLE_COLLECTOR
+    MergeCandidates();
+    _gc_sweepcolor = _gc_currentwhite;
+#endif
     SQCollectable *t = _gc_chain;
     SQCollectable *nx = NULL;
     if(t) {
@@ -201,12 +303,14 @@ SQSharedState::~SQSharedState()
         _gc_chain->Release();
     }
 #endif
+    _rootshape->Prune(_gcss(this),_rootshape,true);
+    _rootshape->Release(_gcss(this));
 
-    sq_delete(_types,SQObjectPtrVec);
-    sq_delete(_systemstrings,SQObjectPtrVec);
-    sq_delete(_metamethods,SQObjectPtrVec);
-    sq_delete(_stringtable,SQStringTable);
-    if(_scratchpad)SQ_FREE(_scratchpad,_scratchpadsize);
+    sq_ssdelete(this,_types,SQObjectPtrVec);
+    sq_ssdelete(this,_systemstrings,SQObjectPtrVec);
+    sq_ssdelete(this,_metamethods,SQObjectPtrVec);
+    sq_ssdelete(this,_stringtable,SQStringTable);
+    if(_scratchpad)SQ_SSFREE(this,_scratchpad,_scratchpadsize);
 }
 
 
@@ -221,6 +325,88 @@ SQInteger SQSharedState::GetMetaMethodIdxByName(const SQObjectPtr &name)
     return -1;
 }
 
+/*
+    called at the VM safe points once _allocated reaches _threshold(see SQ_MEMCHECK()):
+    runs the automatic gc step and the emergency collection past the soft limit.
+    Past the hard limit, after a full collection and the memory limit hook, returns false
+    with an error raised on vm(if any). The error handlers then get a reserve of an eighth
+    of the limit, after that every check fails without collecting again until the heap
+    goes back under the limit(see sq_ss_free()).
+*/
+bool SQSharedState::CheckMemory(SQVM *vm)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    if(_allocated >= _gc_threshold) AutoStep(vm);
+    if(_mem_softlimit && _allocated >= _mem_emergency) {
+        CollectGarbage(vm);
+        //while the heap stays past the soft limit the next emergency collection waits for an eighth of it
+        _mem_emergency = _allocated < _mem_softlimit ? _mem_softlimit : _allocated + _mem_softlimit / 8;
+    }
+#endif
+    if(_mem_hardlimit && _allocated >= _mem_hardlimit && !_mem_exhausted
+        && (!_mem_overlimit || _allocated >= _mem_reserve)) {
+#ifndef NO_GARBAGE_COLLECTOR
+        CollectGarbage(vm);
+#endif
+        if(_mem_hook && _allocated >= _mem_hardlimit) {
+            //the hook can change the limits, the threshold is set again on the way out
+            _threshold = SQ_NOTHRESHOLD;
+            _mem_hook(vm ? vm : _thread(_root_vm),(SQInteger)_allocated,(SQInteger)_mem_hardlimit);
+        }
+        if(_mem_hardlimit && _allocated >= _mem_hardlimit) {
+            if(!_mem_overlimit) {
+                _mem_overlimit = true;
+                _mem_reserve = _allocated + _mem_hardlimit / 8;
+                return MemoryError(vm);
+            }
+            if(_allocated >= _mem_reserve) {
+                _mem_exhausted = true;
+                return MemoryError(vm);
+            }
+        }
+    }
+    else if(_mem_exhausted && _allocated >= _mem_hardlimit) {
+        return MemoryError(vm);
+    }
+    if(!_mem_hardlimit || _allocated < _mem_hardlimit) _mem_overlimit = _mem_exhausted = false;
+    SetThreshold();
+    return true;
+}
+
+bool SQSharedState::MemoryError(SQVM *vm)
+{
+    SetThreshold();
+    if(vm) vm->Raise_Error(_SC("out of memory"));
+    return false;
+}
+
+void SQSharedState::SetThreshold()
+{
+    _threshold = SQ_NOTHRESHOLD;
+#ifndef NO_GARBAGE_COLLECTOR
+    SQUnsignedInteger next = _allocated + GC_STEPSIZE;
+    if(!_gc_auto) {
+        _gc_threshold = SQ_NOTHRESHOLD;
+    }
+    else if(_gc_phase == SQ_GCPHASE_IDLE) {
+        //the next cycle starts when the heap has grown by _gc_pause percent
+        _gc_threshold = _allocated / 100 * _gc_pause;
+        if(_gc_threshold < next) _gc_threshold = next;
+    }
+    else _gc_threshold = next;
+    _threshold = _gc_threshold;
+    if(_mem_softlimit && _mem_emergency < _threshold) _threshold = _mem_emergency;
+#endif
+    if(_mem_hardlimit) {
+        SQUnsignedInteger limit = _mem_hardlimit;
+        if(_mem_overlimit && !_mem_exhausted) {
+            limit = _mem_reserve;
+            if(_allocated + SQ_MEMLIMITSTEP < limit) limit = _allocated + SQ_MEMLIMITSTEP;
+        }
+        if(limit < _threshold) _threshold = limit;
+    }
+}
+
 #ifndef NO_GARBAGE_COLLECTOR
 
 void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **chain)
@@ -241,6 +427,24 @@ void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **chain)
     }
 }
 
+void SQSharedState::TraverseObject(SQObjectPtr &o,SQGCVISIT visit,void *ud)
+{
+    switch(sq_type(o)){
+    case OT_TABLE:visit(_table(o),ud);break;
+    case OT_ARRAY:visit(_array(o),ud);break;
+    case OT_USERDATA:visit(_userdata(o),ud);break;
+    case OT_CLOSURE:visit(_closure(o),ud);break;
+    case OT_NATIVECLOSURE:visit(_nativeclosure(o),ud);break;
+    case OT_GENERATOR:visit(_generator(o),ud);break;
+    case OT_THREAD:visit(_thread(o),ud);break;
+    case OT_CLASS:visit(_class(o),ud);break;
+    case OT_INSTANCE:visit(_instance(o),ud);break;
+    case OT_OUTER:visit(_outer(o),ud);break;
+    case OT_FUNCPROTO:visit(_funcproto(o),ud);break;
+    default: break; //shutup compiler
+    }
+}
+
 void SQSharedState::RunMark(SQVM* SQ_UNUSED_ARG(vm),SQCollectable **tchain)
 {
     SQVM *vms = _thread(_root_vm);
@@ -269,6 +473,11 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
     SQInteger n=0;
     SQCollectable *tchain=NULL;
 
+    StopCycle();
+    PromoteYoung();
+#ifdef SQ_CYCLE_COLLECTOR
+    MergeCandidates();
+#endif
     RunMark(vm,&tchain);
 
     SQCollectable *resurrected = _gc_chain;
@@ -285,8 +494,7 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
             SQObjectType type = t->GetType();
             if(type != OT_FUNCPROTO && type != OT_OUTER) {
                 SQObject sqo;
-                sqo._type = type;
-                sqo._unVal.pRefCounted = t;
+                _setrefcounted(sqo,type,t);
                 ret->Append(sqo);
             }
             t = t->_next;
@@ -318,13 +526,41 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
     return n;
 }
 
+#ifdef SQ_CYCLE_COLLECTOR
+SQInteger SQSharedState::CollectGarbage(SQVM *SQ_UNUSED_ARG(vm))
+{
+    SQInteger n = CollectCycles(SQ_GCKIND_FULL);
+    SetThreshold();
+    return n;
+}
+#else
 SQInteger SQSharedState::CollectGarbage(SQVM *vm)
+{
+    StopCycle();
+    GCEvent(SQ_GCEVENT_BEGIN,SQ_GCKIND_FULL,0);
+    PromoteYoung();
+#ifdef SQ_PARALLEL_MARK
+    SQInteger n = _gc_threads > 1 ? ParallelCollect() : MarkAndSweep(vm);
+#else
+    SQInteger n = MarkAndSweep(vm);
+#endif
+    _gc_fullcollections++;
+    GCEvent(SQ_GCEVENT_END,SQ_GCKIND_FULL,n);
+    return n;
+}
+
+//the full collection on the calling thread, it times its phases
+SQInteger SQSharedState::MarkAndSweep(SQVM *vm)
 {
     SQInteger n = 0;
     SQCollectable *tchain = NULL;
 
+    SQInteger start = GCClock();
     RunMark(vm,&tchain);
+    SQInteger marked = GCClock();
+    _gc_marktime = marked - start;
 
+    _threshold = SQ_NOTHRESHOLD;
     SQCollectable *t = _gc_chain;
     SQCollectable *nx = NULL;
     if(t) {
@@ -346,12 +582,478 @@ SQInteger SQSharedState::CollectGarbage(SQVM *vm)
         t = t->_next;
     }
     _gc_chain = tchain;
+    SetThreshold();
+    _gc_sweeptime = GCClock() - marked;
+
+    return n;
+}
+#endif
 
+void SQSharedState::PromoteYoung()
+{
+    if(!_gc_young) return;
+    SQCollectable *last = _gc_young;
+    last->_gcrefs = _gc_currentwhite;
+    while(last->_next) {
+        last = last->_next;
+        last->_gcrefs = _gc_currentwhite;
+    }
+    last->_next = _gc_chain;
+    if(_gc_chain) _gc_chain->_prev = last;
+    _gc_chain = _gc_young;
+    _gc_young = NULL;
+}
+
+static void gc_subtractref(SQCollectable *c,void *SQ_UNUSED_ARG(ud))
+{
+    if(c->_gcrefs > 0) c->_gcrefs--;
+}
+
+static void gc_reach(SQCollectable *c,void *ud)
+{
+    if(c->_gcrefs >= 0) {
+        c->_gcrefs = GC_REACHABLE;
+        ((sqvector<SQCollectable *> *)ud)->push_back(c);
+    }
+}
+
+/*
+    frees the cycles among the collectables of chain without tracing anything else:
+    every reference a collectable of the chain holds to another one is subtracted
+    from the reference count of the latter, what is left comes from the rest of the heap,
+    the roots or the C stack. The collectables reachable from those are moved to dest.
+*/
+SQInteger SQSharedState::FreeCycles(SQCollectable **chain,SQInteger color,SQCollectable **dest,SQInteger destcolor)
+{
+    SQInteger n = 0;
+    SQCollectable *t;
+    for(t = *chain; t; t = t->_next) t->_gcrefs = (SQInteger)t->_uiRef;
+    for(t = *chain; t; t = t->_next) t->Traverse(gc_subtractref,NULL);
+
+    sqvector<SQCollectable *> gray;
+    for(t = *chain; t; t = t->_next) {
+        if(t->_gcrefs > 0) {
+            t->_gcrefs = GC_REACHABLE;
+            gray.push_back(t);
+            while(gray.size()) {
+                SQCollectable *c = gray.back();
+                gray.pop_back();
+                c->Traverse(gc_reach,&gray);
+            }
+        }
+    }
+
+    t = *chain;
+    while(t) {
+        SQCollectable *nx = t->_next;
+        if(t->_gcrefs == GC_REACHABLE) {
+            SQCollectable::RemoveFromChain(chain,t);
+            t->_gcrefs = destcolor;
+            SQCollectable::AddToChain(dest,t);
+        }
+        else t->_gcrefs = color;
+        t = nx;
+    }
+
+    //no automatic step from the release hooks while the chain is being freed
+    SQUnsignedInteger threshold = _threshold;
+    _threshold = SQ_NOTHRESHOLD;
+#ifdef SQ_CYCLE_COLLECTOR
+    _gc_sweepcolor = color;
+#endif
+    t = *chain;
+    SQCollectable *nx = NULL;
+    if(t) {
+        t->_uiRef++;
+        while(t) {
+            t->Finalize();
+            nx = t->_next;
+            if(nx) nx->_uiRef++;
+            if(--t->_uiRef == 0)
+                t->Release();
+            t = nx;
+            n++;
+        }
+    }
+#ifdef SQ_CYCLE_COLLECTOR
+    _gc_sweepcolor = GC_REACHABLE;
+#endif
+    _threshold = threshold;
+    return n;
+}
+
+SQInteger SQSharedState::CollectYoung(SQVM *SQ_UNUSED_ARG(vm))
+{
+    GCEvent(SQ_GCEVENT_BEGIN,SQ_GCKIND_YOUNG,0);
+    SQInteger start = GCClock();
+    SQInteger n;
+    if(_gc_phase == SQ_GCPHASE_MARK)
+        n = FreeCycles(&_gc_young,GC_YOUNG,&_gc_black,GC_WHITE0 + GC_WHITE1 - _gc_currentwhite);
+    else
+        n = FreeCycles(&_gc_young,GC_YOUNG,&_gc_chain,_gc_currentwhite);
+    _gc_youngtime = GCClock() - start;
+    _gc_youngcollections++;
+    GCEvent(SQ_GCEVENT_END,SQ_GCKIND_YOUNG,n);
     return n;
 }
+
+static void gc_markgray(SQCollectable *c,void *ud)
+{
+    SQSharedState *ss = (SQSharedState *)ud;
+    if(c->_gcrefs == ss->_gc_currentwhite) {
+        SQCollectable::RemoveFromChain(&ss->_gc_chain,c);
+        c->_gcrefs = GC_GRAY;
+        SQCollectable::AddToChain(&ss->_gc_gray,c);
+    }
+}
+
+//calls visit for the roots of the shared state
+void SQSharedState::VisitRoots(SQGCVISIT visit,void *ud)
+{
+    visit(_thread(_root_vm),ud);
+    _refs_table.Traverse(visit,ud);
+    TraverseObject(_registry,visit,ud);
+    TraverseObject(_consts,visit,ud);
+    TraverseObject(_metamethodsmap,visit,ud);
+    TraverseObject(_table_default_delegate,visit,ud);
+    TraverseObject(_array_default_delegate,visit,ud);
+    TraverseObject(_string_default_delegate,visit,ud);
+    TraverseObject(_number_default_delegate,visit,ud);
+    TraverseObject(_generator_default_delegate,visit,ud);
+    TraverseObject(_thread_default_delegate,visit,ud);
+    TraverseObject(_closure_default_delegate,visit,ud);
+    TraverseObject(_class_default_delegate,visit,ud);
+    TraverseObject(_instance_default_delegate,visit,ud);
+    TraverseObject(_weakref_default_delegate,visit,ud);
+}
+
+/*
+    the mutator runs between the steps without write barriers, so a white collectable
+    can end up referenced only by black ones. Instead of trusting the marks the white
+    collectables are just the candidates of a FreeCycles(), that also sees the
+    references from black and young collectables, the roots and the C stack.
+*/
+void SQSharedState::FinishCycle()
+{
+    SQInteger start = GCClock();
+    SQInteger black = GC_WHITE0 + GC_WHITE1 - _gc_currentwhite;
+    _gc_collected = FreeCycles(&_gc_chain,_gc_currentwhite,&_gc_black,black);
+    while(_gc_chain) {
+        SQCollectable *t = _gc_chain;
+        SQCollectable::RemoveFromChain(&_gc_chain,t);
+        t->_gcrefs = black;
+        SQCollectable::AddToChain(&_gc_black,t);
+    }
+    _gc_chain = _gc_black;
+    _gc_black = NULL;
+    _gc_currentwhite = black;
+    _gc_estimate = _gc_marked;
+    _gc_phase = SQ_GCPHASE_IDLE;
+    SetThreshold();
+    _gc_cycletime = _gc_cycleclock + GCClock() - start;
+    _gc_cycles++;
+    GCEvent(SQ_GCEVENT_END,SQ_GCKIND_CYCLE,_gc_collected);
+}
+
+SQInteger SQSharedState::GCStep(SQVM *SQ_UNUSED_ARG(vm),SQInteger SQ_UNUSED_ARG(budget_us))
+{
+#ifdef SQ_CYCLE_COLLECTOR
+    //the cycle collector isn't incremental, the step collects all the candidates
+    CollectCycles(SQ_GCKIND_CYCLE);
+    SetThreshold();
+#else
+    RunStep(-1,budget_us);
+#endif
+    return _gc_phase;
+}
+
+//a step paid by the allocations of the mutator(see CheckMemory())
+void SQSharedState::AutoStep(SQVM *SQ_UNUSED_ARG(vm))
+{
+#ifdef SQ_CYCLE_COLLECTOR
+    if(_gc_auto) CollectCycles(SQ_GCKIND_CYCLE);
+#else
+    if(_gc_auto) RunStep(GC_STEPSIZE / GC_STEPUNIT * _gc_stepmul / 100,-1);
+#endif
+    SetThreshold();
+}
+
+//true when a step has done maxwork units or, looked at every 64 units, run past its deadline
+static bool gc_stepover(SQInteger work,SQInteger maxwork,SQInteger &nextcheck,bool timed,clock_t deadline)
+{
+    if(maxwork >= 0 && work >= maxwork) return true;
+    if(!timed || work < nextcheck) return false;
+    nextcheck = work + 64;
+    return clock() >= deadline;
+}
+
+//runs the incremental cycle for maxwork units of work(-1 unlimited) and budget_us microseconds(-1 unlimited)
+void SQSharedState::RunStep(SQInteger maxwork,SQInteger budget_us)
+{
+    if(_gc_phase == SQ_GCPHASE_IDLE) {
+        GCEvent(SQ_GCEVENT_BEGIN,SQ_GCKIND_CYCLE,0);
+        _gc_phase = SQ_GCPHASE_MARK;
+        _gc_marked = 0;
+        _gc_rootsmarked = false;
+        _gc_cycleclock = 0;
+    }
+    SQInteger start = GCClock();
+    bool done = MarkStep(maxwork,budget_us);
+    _gc_cycleclock += GCClock() - start;
+    if(done) FinishCycle();
+}
+
+//true once the gray collectables are over
+bool SQSharedState::MarkStep(SQInteger maxwork,SQInteger budget_us)
+{
+    bool timed = budget_us >= 0;
+    clock_t deadline = timed ? clock() + (clock_t)((double)budget_us * CLOCKS_PER_SEC / 1000000) : 0;
+    SQInteger work = 0;
+    SQInteger nextcheck = 64;
+    //the young generation joins the cycle before the roots are marked
+    while(!_gc_rootsmarked) {
+        SQCollectable *t = _gc_young;
+        if(!t) {
+            VisitRoots(gc_markgray,this);
+            _gc_rootsmarked = true;
+            break;
+        }
+        SQCollectable::RemoveFromChain(&_gc_young,t);
+        t->_gcrefs = _gc_currentwhite;
+        SQCollectable::AddToChain(&_gc_chain,t);
+        if(gc_stepover(++work,maxwork,nextcheck,timed,deadline)) return false;
+    }
+    for(;;) {
+        if(sq_type(_gc_scan) != OT_NULL) {
+            if(ScanChunk()) _gc_scan.Null();
+            work += GC_SCANCHUNK / 4;
+        }
+        else if(_gc_gray) {
+            SQCollectable *t = _gc_gray;
+            SQCollectable::RemoveFromChain(&_gc_gray,t);
+            t->_gcrefs = GC_WHITE0 + GC_WHITE1 - _gc_currentwhite;
+            SQCollectable::AddToChain(&_gc_black,t);
+            _gc_marked++;
+            //big arrays and tables are scanned across several steps
+            SQObjectType type = t->GetType();
+            if(type == OT_ARRAY && ((SQArray *)t)->_values.size() > GC_SCANCHUNK) {
+                _gc_scan = (SQArray *)t;
+                _gc_scanpos = 0;
+            }
+            else if(type == OT_TABLE && ((SQTable *)t)->CountUsed() > GC_SCANCHUNK) {
+                _gc_scan = (SQTable *)t;
+                _gc_scanpos = 0;
+                if(((SQTable *)t)->_delegate) gc_markgray(((SQTable *)t)->_delegate,this);
+            }
+            else t->Traverse(gc_markgray,this);
+        }
+        else break;
+        if(gc_stepover(++work,maxwork,nextcheck,timed,deadline)) return false;
+    }
+    return true;
+}
+
+//scans the next GC_SCANCHUNK slots of _gc_scan, returns true when it is done
+bool SQSharedState::ScanChunk()
+{
+    if(sq_type(_gc_scan) == OT_ARRAY) {
+        SQInteger end = _gc_scanpos + GC_SCANCHUNK;
+        SQObjectPtrVec &values = _array(_gc_scan)->_values;
+        SQInteger size = values.size();
+        if(end > size) end = size;
+        for(SQInteger i = _gc_scanpos; i < end; i++) TraverseObject(values[i],gc_markgray,this);
+        _gc_scanpos = end;
+        return end == size;
+    }
+    _gc_scanpos = _table(_gc_scan)->TraverseNodes(_gc_scanpos,GC_SCANCHUNK,gc_markgray,this);
+    return _gc_scanpos < 0;
+}
+
+//drops the marks of an unfinished incremental cycle
+void SQSharedState::StopCycle()
+{
+    if(_gc_phase == SQ_GCPHASE_IDLE) return;
+    _gc_scan.Null();
+    SQCollectable **chains[] = { &_gc_gray, &_gc_black };
+    for(SQInteger i = 0; i < 2; i++) {
+        SQCollectable **chain = chains[i];
+        while(*chain) {
+            SQCollectable *t = *chain;
+            SQCollectable::RemoveFromChain(chain,t);
+            t->_gcrefs = _gc_currentwhite;
+            SQCollectable::AddToChain(&_gc_chain,t);
+        }
+    }
+    _gc_phase = SQ_GCPHASE_IDLE;
+    GCEvent(SQ_GCEVENT_END,SQ_GCKIND_CYCLE,0);
+}
+
+SQInteger SQSharedState::GCClock()
+{
+    return (SQInteger)((double)clock() * 1000000 / CLOCKS_PER_SEC);
+}
+
+//the order of SQHeapStats::types
+static const SQObjectType gc_heaptypes[SQ_HEAPSTATS_NTYPES] = {
+    OT_STRING, OT_TABLE, OT_ARRAY, OT_USERDATA, OT_CLOSURE, OT_NATIVECLOSURE, OT_GENERATOR,
+    OT_THREAD, OT_FUNCPROTO, OT_CLASS, OT_INSTANCE, OT_WEAKREF, OT_OUTER
+};
+#define GC_HEAPSTRING 0
+#define GC_HEAPWEAKREF 11
+
+static SQTypeStats *gc_typestats(SQHeapStats *s,SQObjectType type)
+{
+    for(SQInteger i = 0; i < SQ_HEAPSTATS_NTYPES; i++) {
+        if(gc_heaptypes[i] == type) return &s->types[i];
+    }
+    return NULL;
+}
+
+//walks the chains and the string table, the weak references are the ones of live objects
+void SQSharedState::GetHeapStats(SQHeapStats *s)
+{
+    for(SQInteger i = 0; i < SQ_HEAPSTATS_NTYPES; i++) {
+        s->types[i].type = gc_heaptypes[i];
+        s->types[i].objects = 0;
+        s->types[i].bytes = 0;
+    }
+    SQTypeStats &weakrefs = s->types[GC_HEAPWEAKREF];
+    SQCollectable *chains[] = { _gc_chain, _gc_young, _gc_gray, _gc_black,
+#ifdef SQ_CYCLE_COLLECTOR
+        _gc_candidates,
+#endif
+    };
+    for(SQUnsignedInteger i = 0; i < sizeof(chains) / sizeof(chains[0]); i++) {
+        for(SQCollectable *t = chains[i]; t; t = t->_next) {
+            SQTypeStats *ts = gc_typestats(s,t->GetType());
+            ts->objects++;
+            ts->bytes += t->MemSize();
+            if(t->_weakref) {
+                weakrefs.objects++;
+                weakrefs.bytes += sizeof(SQWeakRef);
+            }
+        }
+    }
+    _stringtable->GetStats(s->stringslots,s->stringsused,s->types[GC_HEAPSTRING],weakrefs);
+    _refs_table.GetStats(s->refslots,s->refsused);
+    s->fullcollections = _gc_fullcollections;
+    s->youngcollections = _gc_youngcollections;
+    s->cycles = _gc_cycles;
+    s->marktime = _gc_marktime;
+    s->sweeptime = _gc_sweeptime;
+    s->youngtime = _gc_youngtime;
+    s->cycletime = _gc_cycletime;
+}
+
+#ifdef SQ_CYCLE_COLLECTOR
+static void gc_pin(SQCollectable *c,void *ud)
+{
+    SQSharedState *ss = (SQSharedState *)ud;
+    if(c->_gcrefs == GC_CANDIDATE) {
+        SQCollectable::RemoveFromChain(&ss->_gc_candidates,c);
+        c->_gcrefs = ss->_gc_currentwhite;
+        SQCollectable::AddToChain(&ss->_gc_chain,c);
+    }
+    c->_uiRef |= MARK_FLAG;
+}
+
+static void gc_unpin(SQCollectable *c,void *SQ_UNUSED_ARG(ud))
+{
+    c->UnMark();
+}
+
+//the roots are alive, flagged they keep the search of the cycles from spreading over the whole heap
+void SQSharedState::PinRoots(bool pin)
+{
+    SQGCVISIT visit = pin ? gc_pin : gc_unpin;
+    VisitRoots(visit,this);
+    TraverseObject(_thread(_root_vm)->_roottable,visit,this);
+}
+
+struct SQCycleSearch
+{
+    SQSharedState *_ss;
+    sqvector<SQCollectable *> _stack;
+};
+
+static void gc_addcandidate(SQCollectable *c,void *ud)
+{
+    if(c->_gcrefs == GC_CANDIDATE || (c->_uiRef & MARK_FLAG)) return;
+    SQCycleSearch *cs = (SQCycleSearch *)ud;
+    SQSharedState *ss = cs->_ss;
+    SQCollectable::RemoveFromChain(ss->GCChain(c),c);
+    c->_gcrefs = GC_CANDIDATE;
+    SQCollectable::AddToChain(&ss->_gc_candidates,c);
+    cs->_stack.push_back(c);
+}
+
+/*
+    trial deletion(Bacon and Rajan) of the candidates, the collectables whose reference count
+    went down without reaching 0 since the last collection, and of what they reach.
+    A cycle can only become garbage when the last reference from outside of it goes away,
+    so one of its collectables is among the candidates; the rest of the heap isn't scanned.
+*/
+SQInteger SQSharedState::CollectCycles(SQInteger kind)
+{
+    //the automatic steps don't count as collections when there is nothing to look at
+    if(!_gc_candidates && kind == SQ_GCKIND_CYCLE) return 0;
+    GCEvent(SQ_GCEVENT_BEGIN,kind,0);
+    SQInteger start = GCClock();
+    PinRoots(true);
+    SQCycleSearch cs;
+    cs._ss = this;
+    SQInteger n = 0;
+    for(SQCollectable *t = _gc_candidates; t; t = t->_next) cs._stack.push_back(t);
+    while(cs._stack.size()) {
+        SQCollectable *c = cs._stack.back();
+        cs._stack.pop_back();
+        c->Traverse(gc_addcandidate,&cs);
+        n++;
+    }
+    PinRoots(false);
+    _gc_estimate = n;
+    SQInteger searched = GCClock();
+    _gc_collected = FreeCycles(&_gc_candidates,GC_CANDIDATE,&_gc_chain,_gc_currentwhite);
+    SQInteger end = GCClock();
+    if(kind == SQ_GCKIND_FULL) {
+        _gc_marktime = searched - start;
+        _gc_sweeptime = end - searched;
+        _gc_fullcollections++;
+    }
+    else {
+        _gc_cycletime = end - start;
+        _gc_cycles++;
+    }
+    GCEvent(SQ_GCEVENT_END,kind,_gc_collected);
+    return _gc_collected;
+}
+
+//gives the candidates back to the old generation
+void SQSharedState::MergeCandidates()
+{
+    while(_gc_candidates) {
+        SQCollectable *t = _gc_candidates;
+        SQCollectable::RemoveFromChain(&_gc_candidates,t);
+        t->_gcrefs = _gc_currentwhite;
+        SQCollectable::AddToChain(&_gc_chain,t);
+    }
+}
+#endif
 #endif
 
 #ifndef NO_GARBAGE_COLLECTOR
+#ifdef SQ_CYCLE_COLLECTOR
+void SQCollectable::PossibleCycle()
+{
+    SQSharedState *ss = _sharedstate;
+    //marked or being freed, it is in a chain that can't change
+    if((_uiRef & MARK_FLAG) || _gcrefs == ss->_gc_sweepcolor) return;
+    RemoveFromChain(ss->GCChain(this),this);
+    _gcrefs = GC_CANDIDATE;
+    AddToChain(&ss->_gc_candidates,this);
+}
+#endif
+
 void SQCollectable::AddToChain(SQCollectable **chain,SQCollectable *c)
 {
     c->_prev = NULL;
@@ -378,22 +1080,23 @@ SQChar* SQSharedState::GetScratchPad(SQInteger size)
         if (_scratchpadsize < size) {
             newsize = (SQInteger)((SQUnsignedInteger)size + (size >> 1));
             newsize = sq_max(newsize, size); //check for overflow
-            _scratchpad = (SQChar*)SQ_REALLOC(_scratchpad, _scratchpadsize, newsize);
+            _scratchpad = (SQChar*)SQ_SSREALLOC(this,_scratchpad, _scratchpadsize, newsize);
             _scratchpadsize = newsize;
 
         }
         else if ((_scratchpadsize >> 5) >= size) {
             newsize = _scratchpadsize >> 1;
             newsize = sq_max(newsize, size); //check for overflow
-            _scratchpad = (SQChar*)SQ_REALLOC(_scratchpad, _scratchpadsize, newsize);
+            _scratchpad = (SQChar*)SQ_SSREALLOC(this,_scratchpad, _scratchpadsize, newsize);
             _scratchpadsize = newsize;
         }
     }
     return _scratchpad;
 }
 
-RefTable::RefTable()
+RefTable::RefTable(SQSharedState *ss)
 {
+    _sharedstate = ss;
     AllocNodes(4);
 }
 
@@ -408,7 +1111,7 @@ void RefTable::Finalize()
 
 RefTable::~RefTable()
 {
-    SQ_FREE(_buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
+    SQ_SSFREE(_sharedstate,_buckets,(_numofslots * sizeof(RefNode *)) + (_numofslots * sizeof(RefNode)));
 }
 
 #ifndef NO_GARBAGE_COLLECTOR
@@ -422,6 +1125,15 @@ void RefTable::Mark(SQCollectable **chain)
         nodes++;
     }
 }
+
+void RefTable::Traverse(SQGCVISIT visit,void *ud)
+{
+    RefNode *nodes = (RefNode *)_nodes;
+    for(SQUnsignedInteger n = 0; n < _numofslots; n++) {
+        SQSharedState::TraverseObject(nodes->obj,visit,ud);
+        nodes++;
+    }
+}
 #endif
 
 void RefTable::AddRef(SQObject &obj)
@@ -491,7 +1203,7 @@ void RefTable::Resize(SQUnsignedInteger size)
         t++;
     }
     assert(nfound == oldnumofslots);
-    SQ_FREE(oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
+    SQ_SSFREE(_sharedstate,oldbucks,(oldnumofslots * sizeof(RefNode *)) + (oldnumofslots * sizeof(RefNode)));
 }
 
 RefTable::RefNode *RefTable::Add(SQHash mainpos,SQObject &obj)
@@ -513,7 +1225,7 @@ RefTable::RefNode *RefTable::Get(SQObject &obj,SQHash &mainpos,RefNode **prev,bo
     mainpos = ::HashObj(obj)&(_numofslots-1);
     *prev = NULL;
     for (ref = _buckets[mainpos]; ref; ) {
-        if(_rawval(ref->obj) == _rawval(obj) && sq_type(ref->obj) == sq_type(obj))
+        if(_rawequal(ref->obj,obj))
             break;
         *prev = ref;
         ref = ref->next;
@@ -533,7 +1245,7 @@ void RefTable::AllocNodes(SQUnsignedInteger size)
 {
     RefNode **bucks;
     RefNode *nodes;
-    bucks = (RefNode **)SQ_MALLOC((size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
+    bucks = (RefNode **)SQ_SSMALLOC(_sharedstate,(size * sizeof(RefNode *)) + (size * sizeof(RefNode)));
     nodes = (RefNode *)&bucks[size];
     RefNode *temp = nodes;
     SQUnsignedInteger n;
@@ -567,28 +1279,45 @@ SQStringTable::SQStringTable(SQSharedState *ss)
     _sharedstate = ss;
     AllocNodes(4);
     _slotused = 0;
+    _internlimit = STRING_DEFAULTINTERNLIMIT;
+    _numoflong = 0;
+    _longbytes = 0;
 }
 
 SQStringTable::~SQStringTable()
 {
-    SQ_FREE(_strings,sizeof(SQString*)*_numofslots);
+    SQ_SSFREE(_sharedstate,_strings,sizeof(SQString*)*_numofslots);
     _strings = NULL;
 }
 
 void SQStringTable::AllocNodes(SQInteger size)
 {
     _numofslots = size;
-    _strings = (SQString**)SQ_MALLOC(sizeof(SQString*)*_numofslots);
+    _strings = (SQString**)SQ_SSMALLOC(_sharedstate,sizeof(SQString*)*_numofslots);
     memset(_strings,0,sizeof(SQString*)*_numofslots);
 }
 
+//a string of len chars out of the table, the caller fills it
+SQString *SQStringTable::Alloc(SQInteger len,SQHash hash)
+{
+    SQString *t = (SQString *)SQ_SSMALLOC(_sharedstate,sq_rsl(len) + sizeof(SQString));
+    new (t) SQString;
+    t->_sharedstate = _sharedstate;
+    t->_val[len] = _SC('\0');
+    t->_len = len;
+    t->_hash = hash;
+    t->_next = NULL;
+    return t;
+}
+
 SQString* SQStringTable::Concat(const SQChar* a, SQInteger alen, const SQChar* b, SQInteger blen)
 {
     SQHash newhash = ::_hashstr2(a, alen, b, blen);
     SQHash h = newhash & (_numofslots - 1);
     SQString* s;
     SQInteger len = alen + blen;
-    for (s = _strings[h]; s; s = s->_next) {
+    bool interns = Interns(len);
+    for (s = interns ? _strings[h] : NULL; s; s = s->_next) {
         if (s->_len == len) {
             if ((!memcmp(a, s->_val, sq_rsl(alen)))
                 && (!memcmp(b, &s->_val[alen], sq_rsl(blen)))) {
@@ -597,21 +1326,22 @@ SQString* SQStringTable::Concat(const SQChar* a, SQInteger alen, const SQChar* b
         }
     }
     //
-    SQString* t = (SQString*)SQ_MALLOC(sq_rsl(len) + sizeof(SQString));
-    new (t) SQString;
-    t->_sharedstate = _sharedstate;
+    SQString* t = Alloc(len, newhash);
     memcpy(t->_val, a, sq_rsl(alen));
     memcpy(&t->_val[alen], b, sq_rsl(blen));
-    t->_val[len] = _SC('\0');
-    t->_len = len;
-    t->_hash = newhash;
-    t->_next = _strings[h];
-    _strings[h] = t;
-    _slotused++;
 #ifdef _DEBUG
     SQHash old_newhash = ::_hashstr(t->_val, t->_len);
     assert(old_newhash == newhash);
 #endif
+    if (!interns) {
+        t->_interned = false;
+        _numoflong++;
+        _longbytes += t->AllocSize();
+        return t;
+    }
+    t->_next = _strings[h];
+    _strings[h] = t;
+    _slotused++;
     if (_slotused > _numofslots)  /* too crowded? */
         Resize(_numofslots * 2);
     return t;
@@ -622,6 +1352,15 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
     if(len<0)
         len = (SQInteger)scstrlen(news);
     SQHash newhash = ::_hashstr(news,len);
+    if(!Interns(len)) {
+        //hashed by a sample of the chars, the long strings are stored without looking for a copy
+        SQString *t = Alloc(len,newhash);
+        memcpy(t->_val,news,sq_rsl(len));
+        t->_interned = false;
+        _numoflong++;
+        _longbytes += t->AllocSize();
+        return t;
+    }
     SQHash h = newhash&(_numofslots-1);
     SQString *s;
     for (s = _strings[h]; s; s = s->_next){
@@ -629,13 +1368,8 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
             return s; //found
     }
 
-    SQString *t = (SQString *)SQ_MALLOC(sq_rsl(len)+sizeof(SQString));
-    new (t) SQString;
-    t->_sharedstate = _sharedstate;
+    SQString *t = Alloc(len,newhash);
     memcpy(t->_val,news,sq_rsl(len));
-    t->_val[len] = _SC('\0');
-    t->_len = len;
-    t->_hash = newhash;
     t->_next = _strings[h];
     _strings[h] = t;
     _slotused++;
@@ -659,10 +1393,10 @@ void SQStringTable::Resize(SQInteger size)
             p = next;
         }
     }
-    SQ_FREE(oldtable,oldsize*sizeof(SQString*));
+    SQ_SSFREE(_sharedstate,oldtable,oldsize*sizeof(SQString*));
 }
 
-void SQStringTable::Remove(SQString *bs)
+void SQStringTable::Unlink(SQString *bs)
 {
     SQString *s;
     SQString *prev=NULL;
@@ -675,9 +1409,6 @@ void SQStringTable::Remove(SQString *bs)
             else
                 _strings[h] = s->_next;
             _slotused--;
-            SQInteger slen = s->_len;
-            s->~SQString();
-            SQ_FREE(s,sizeof(SQString) + sq_rsl(slen));
             return;
         }
         prev = s;
@@ -685,3 +1416,86 @@ void SQStringTable::Remove(SQString *bs)
     }
     assert(0);//if this fail something is wrong
 }
+
+void SQStringTable::Remove(SQString *bs)
+{
+    SQInteger size = bs->AllocSize();
+    if(bs->_interned) Unlink(bs);
+    else {
+        _numoflong--;
+        _longbytes -= size;
+    }
+    bs->~SQString();
+    SQ_SSFREE(_sharedstate,bs,size);
+}
+
+/*
+    appends b to the string str, that only str refers to, without copying it: the string
+    leaves the table, grows in a buffer that doubles and comes back with the new content.
+    If the new content is already interned str takes the existing string, past the intern
+    limit the string stays out of the table.
+*/
+void SQStringTable::Append(SQObjectPtr &str,const SQChar *b,SQInteger blen)
+{
+    SQString *s = _string(str);
+    SQInteger len = s->_len + blen;
+    SQInteger oldsize = s->AllocSize();
+    SQInteger size = sizeof(SQString) + sq_rsl(_buildercapacity(len));
+    s->_uiRef++;
+    str.Null();
+    if(s->_interned) Unlink(s);
+    else {
+        _numoflong--;
+        _longbytes -= oldsize;
+    }
+    if(size != oldsize)
+        s = (SQString *)SQ_SSREALLOC(_sharedstate,s,oldsize,size);
+    s->_builder = true;
+    memcpy(&s->_val[s->_len],b,sq_rsl(blen));
+    s->_val[len] = _SC('\0');
+    s->_len = len;
+    s->_hash = ::_hashstr(s->_val,len);
+    if(!Interns(len)) {
+        s->_interned = false;
+        _numoflong++;
+        _longbytes += size;
+        str = s;
+        s->_uiRef--;
+        return;
+    }
+    s->_interned = true;
+    SQHash h = s->_hash&(_numofslots-1);
+    for(SQString *t = _strings[h]; t; t = t->_next) {
+        if(t->_len == len && (!memcmp(t->_val,s->_val,sq_rsl(len)))) {
+            s->~SQString();
+            SQ_SSFREE(_sharedstate,s,size);
+            str = t;
+            return;
+        }
+    }
+    s->_next = _strings[h];
+    _strings[h] = s;
+    _slotused++;
+    str = s;
+    s->_uiRef--;
+    if (_slotused > _numofslots)  /* too crowded? */
+        Resize(_numofslots*2);
+}
+
+void SQStringTable::GetStats(SQInteger &slots,SQInteger &used,SQTypeStats &strings,SQTypeStats &weakrefs)
+{
+    slots = (SQInteger)_numofslots;
+    used = (SQInteger)_slotused;
+    for(SQUnsignedInteger i = 0; i < _numofslots; i++) {
+        for(SQString *s = _strings[i]; s; s = s->_next) {
+            strings.objects++;
+            strings.bytes += s->AllocSize();
+            if(s->_weakref) {
+                weakrefs.objects++;
+                weakrefs.bytes += sizeof(SQWeakRef);
+            }
+        }
+    }
+    strings.objects += _numoflong;
+    strings.bytes += _longbytes;
+}
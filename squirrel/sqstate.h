@@ -4,10 +4,14 @@
 
 #include "squtils.h"
 #include "sqobject.h"
+#include "sqpool.h"
 struct SQString;
 struct SQTable;
+struct SQShape;
 //max number of character for a printed number
 #define NUMBER_MAX_CHAR 50
+//default of sq_setinternlimit()
+#define STRING_DEFAULTINTERNLIMIT 4096
 
 struct SQStringTable
 {
@@ -15,13 +19,25 @@ struct SQStringTable
     ~SQStringTable();
     SQString *Add(const SQChar *,SQInteger len);
     SQString* Concat(const SQChar* a, SQInteger alen, const SQChar* b, SQInteger blen);
+    void Append(SQObjectPtr &str,const SQChar *b,SQInteger blen);
     void Remove(SQString *);
+    //the strings longer than maxlen chars are left out of the table, a negative maxlen interns them all
+    void SetInternLimit(SQInteger maxlen) { _internlimit = maxlen; }
+    //count and bytes of the strings, the weak references to them are added to weakrefs
+    void GetStats(SQInteger &slots,SQInteger &used,SQTypeStats &strings,SQTypeStats &weakrefs);
 private:
     void Resize(SQInteger size);
     void AllocNodes(SQInteger size);
+    void Unlink(SQString *bs);
+    SQString *Alloc(SQInteger len,SQHash hash);
+    bool Interns(SQInteger len) { return _internlimit < 0 || len <= _internlimit; }
     SQString **_strings;
     SQUnsignedInteger _numofslots;
     SQUnsignedInteger _slotused;
+    SQInteger _internlimit;
+    //strings out of the table and their bytes
+    SQInteger _numoflong;
+    SQInteger _longbytes;
     SQSharedState *_sharedstate;
 };
 
@@ -31,15 +47,17 @@ struct RefTable {
         SQUnsignedInteger refs;
         struct RefNode *next;
     };
-    RefTable();
+    RefTable(SQSharedState *ss);
     ~RefTable();
     void AddRef(SQObject &obj);
     SQBool Release(SQObject &obj);
     SQUnsignedInteger GetRefCount(SQObject &obj);
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
 #endif
     void Finalize();
+    void GetStats(SQInteger &slots,SQInteger &used) { slots = _numofslots; used = _slotused; }
 private:
     RefNode *Get(SQObject &obj,SQHash &mainpos,RefNode **prev,bool add);
     RefNode *Add(SQHash mainpos,SQObject &obj);
@@ -50,6 +68,7 @@ private:
     RefNode *_nodes;
     RefNode *_freelist;
     RefNode **_buckets;
+    SQSharedState *_sharedstate;
 };
 
 #define ADD_STRING(ss,str,len) ss->_stringtable->Add(str,len)
@@ -57,6 +76,23 @@ private:
 
 struct SQObjectPtr;
 
+#ifndef NO_GARBAGE_COLLECTOR
+//slots of a big array or table scanned at once by an incremental step
+#define GC_SCANCHUNK 256
+//bytes allocated between two automatic steps
+#define GC_STEPSIZE (8*1024)
+//bytes of heap a unit of marking work stands for
+#define GC_STEPUNIT 64
+//defaults of sq_setgcparams()
+#define GC_DEFAULTPAUSE 200
+#define GC_DEFAULTSTEPMUL 200
+//most threads of a parallel full collection(see sq_setgcthreads())
+#define GC_MAXTHREADS 64
+#endif
+#define SQ_NOTHRESHOLD (~((SQUnsignedInteger)0))
+//bytes allocated between two checks of a heap past the hard limit, while its error handlers run
+#define SQ_MEMLIMITSTEP (8*1024)
+
 struct SQSharedState
 {
     SQSharedState();
@@ -65,12 +101,84 @@ struct SQSharedState
 public:
     SQChar* GetScratchPad(SQInteger size);
     SQInteger GetMetaMethodIdxByName(const SQObjectPtr &name);
+    bool CheckMemory(SQVM *vm);
+    bool MemoryError(SQVM *vm);
+    void SetThreshold();
+    //true if n more items of the given size stay within the hard limit
+    bool CanAllocate(SQUnsignedInteger n,SQUnsignedInteger size)
+    {
+        if(!_mem_hardlimit) return true;
+        return _allocated < _mem_hardlimit && n <= (_mem_hardlimit - _allocated) / size;
+    }
 #ifndef NO_GARBAGE_COLLECTOR
     SQInteger CollectGarbage(SQVM *vm);
     void RunMark(SQVM *vm,SQCollectable **tchain);
     SQInteger ResurrectUnreachable(SQVM *vm);
+    SQInteger CollectYoung(SQVM *vm);
+    SQInteger GCStep(SQVM *vm,SQInteger budget_us);
+    void AutoStep(SQVM *vm);
+    void PromoteYoung();
+    void StopCycle();
     static void MarkObject(SQObjectPtr &o,SQCollectable **chain);
+    static void TraverseObject(SQObjectPtr &o,SQGCVISIT visit,void *ud);
+    void GetHeapStats(SQHeapStats *s);
+    bool WriteHeapSnapshot(SQWRITEFUNC w,SQUserPointer up);
+    //processor time in microseconds, the durations of sq_getheapstats()
+    static SQInteger GCClock();
+    void GCEvent(SQInteger event,SQInteger kind,SQInteger collected)
+    {
+        if(_gc_hook) _gc_hook(_thread(_root_vm),event,kind,collected);
+    }
+#ifdef SQ_CYCLE_COLLECTOR
+    SQInteger CollectCycles(SQInteger kind);
+    void MergeCandidates();
+#endif
+    SQCollectable **GCChain(SQCollectable *c)
+    {
+#ifdef SQ_CYCLE_COLLECTOR
+        if(c->_gcrefs == GC_CANDIDATE) return &_gc_candidates;
+#endif
+        if(c->_gcrefs == _gc_currentwhite) return &_gc_chain;
+        if(c->_gcrefs < GC_GRAY) return &_gc_black;
+        if(c->_gcrefs == GC_GRAY) return &_gc_gray;
+        return &_gc_young;
+    }
+private:
+    SQInteger MarkAndSweep(SQVM *vm);
+    void RunStep(SQInteger maxwork,SQInteger budget_us);
+    bool MarkStep(SQInteger maxwork,SQInteger budget_us);
+    void VisitRoots(SQGCVISIT visit,void *ud);
+    bool ScanChunk();
+    void FinishCycle();
+    SQInteger FreeCycles(SQCollectable **chain,SQInteger color,SQCollectable **dest,SQInteger destcolor);
+#ifdef SQ_CYCLE_COLLECTOR
+    void PinRoots(bool pin);
 #endif
+#ifdef SQ_PARALLEL_MARK
+    SQInteger ParallelCollect();
+#endif
+public:
+#endif
+#ifndef NO_MEMORY_POOL
+    //first, it has to outlive every other member
+    SQMemPool _pool;
+#endif
+    //bytes currently allocated through sq_ss_malloc() and friends
+    SQUnsignedInteger _allocated;
+    //the VM calls CheckMemory() at its safe points once _allocated reaches _threshold
+    SQUnsignedInteger _threshold;
+    //limits set by sq_setmemlimits(), 0 if not set
+    SQUnsignedInteger _mem_softlimit;
+    SQUnsignedInteger _mem_hardlimit;
+    //next emergency collection
+    SQUnsignedInteger _mem_emergency;
+    //the hard limit error has been raised and the heap is still past it
+    bool _mem_overlimit;
+    //where the reserve of the error handlers ends
+    SQUnsignedInteger _mem_reserve;
+    //the reserve has been used up as well
+    bool _mem_exhausted;
+    SQMEMLIMITHOOK _mem_hook;
     SQObjectPtrVec *_metamethods;
     SQObjectPtr _metamethodsmap;
     SQObjectPtrVec *_systemstrings;
@@ -80,8 +188,48 @@ public:
     SQObjectPtr _registry;
     SQObjectPtr _consts;
     SQObjectPtr _constructoridx;
+    //empty shape of the tables, root of the shape tree(see SQShape)
+    SQShape *_rootshape;
 #ifndef NO_GARBAGE_COLLECTOR
     SQCollectable *_gc_chain;
+    SQCollectable *_gc_young;
+    //incremental cycle(see GCStep())
+    SQCollectable *_gc_gray;
+    SQCollectable *_gc_black;
+    SQInteger _gc_currentwhite;
+    SQInteger _gc_phase;
+    SQInteger _gc_marked;
+    bool _gc_rootsmarked;
+    SQObjectPtr _gc_scan;
+    SQInteger _gc_scanpos;
+    SQInteger _gc_estimate;
+    SQInteger _gc_collected;
+    //automatic steps, run once _allocated reaches _gc_threshold
+    bool _gc_auto;
+    SQInteger _gc_pause;
+    SQInteger _gc_stepmul;
+    SQUnsignedInteger _gc_threshold;
+    //telemetry(see sq_getheapstats()), times in microseconds
+    SQGCHOOK _gc_hook;
+    SQInteger _gc_fullcollections;
+    SQInteger _gc_youngcollections;
+    SQInteger _gc_cycles;
+    SQInteger _gc_marktime;
+    SQInteger _gc_sweeptime;
+    SQInteger _gc_youngtime;
+    SQInteger _gc_cycletime;
+    //steps of the running incremental cycle so far
+    SQInteger _gc_cycleclock;
+#ifdef SQ_PARALLEL_MARK
+    //threads of the full collections
+    SQInteger _gc_threads;
+#endif
+#ifdef SQ_CYCLE_COLLECTOR
+    //collectables whose reference count went down since the last collection
+    SQCollectable *_gc_candidates;
+    //color of the collectables being freed, they can't become candidates
+    SQInteger _gc_sweepcolor;
+#endif
 #endif
     SQObjectPtr _root_vm;
     SQObjectPtr _table_default_delegate;
@@ -112,11 +260,15 @@ public:
     bool _notifyallexceptions;
     SQUserPointer _foreignptr;
     SQRELEASEHOOK _releasehook;
+    SQUnsignedInteger _lastclassid;
 private:
     SQChar *_scratchpad;
     SQInteger _scratchpadsize;
 };
 
+//to be used only where a script could call collectgarbage() as well, false if the hard limit has been hit
+#define SQ_MEMCHECK(ss,vm) ((ss)->_allocated < (ss)->_threshold || (ss)->CheckMemory(vm))
+
 #define _sp(s) (_sharedstate->GetScratchPad(s))
 #define _spval (_sharedstate->GetScratchPad(-1))
 
@@ -32,22 +32,40 @@ inline SQHash _hashstr2(const SQChar* as, size_t al, const SQChar* bs, size_t bl
     return h;
 }
 
+//chars allocated for a string grown in place, at least len
+inline SQInteger _buildercapacity(SQInteger len)
+{
+    SQInteger cap = 32;
+    while(cap < len) cap <<= 1;
+    return cap;
+}
+
 struct SQString : public SQRefCounted
 {
-    SQString(){}
+    SQString(){ _builder = false; _interned = true; }
     ~SQString(){}
 public:
     static SQString *Create(SQSharedState *ss, const SQChar *, SQInteger len = -1 );
     static SQString* Concat(SQSharedState* ss, const SQChar* a, SQInteger alen, const SQChar* b, SQInteger blen);
     SQInteger Next(const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
     void Release();
+    SQInteger AllocSize() { return sizeof(SQString) + sq_rsl(_builder ? _buildercapacity(_len) : _len); }
     SQSharedState *_sharedstate;
     SQString *_next; //chain for the string table
     SQInteger _len;
     SQHash _hash;
+    bool _builder; //grown by SQStringTable::Append(), it has room for _buildercapacity(_len) chars
+    bool _interned; //false for the strings longer than the intern limit(see sq_setinternlimit())
     SQChar _val[1];
 };
 
+//the strings that aren't interned are equal to the ones with the same chars
+inline bool _streq(SQString *a,SQString *b)
+{
+    return a == b || ((!a->_interned || !b->_interned) && a->_len == b->_len && a->_hash == b->_hash
+        && !memcmp(a->_val,b->_val,sq_rsl(a->_len)));
+}
+
 
 
 #endif //_SQSTRING_H_
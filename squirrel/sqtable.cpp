@@ -7,179 +7,540 @@ see copyright notice in squirrel.h
 #include "sqfuncproto.h"
 #include "sqclosure.h"
 
-SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
+//overflow nodes past the home positions, a probe that gets to the end grows the table
+#define OVERFLOW_NODES(size) ((size) / 2 < SQ_TABLE_GROUP ? (size) / 2 : SQ_TABLE_GROUP)
+//a table of size home positions holds at most MAX_USED(size) nodes
+#define MAX_USED(size) ((size) - (size) / 8)
+#define ALLOC_SIZE(nodes) ((nodes) * sizeof(_HashNode) + (nodes) + SQ_TABLE_GROUP)
+#define ARRAY_WORDS(size) (((size) + SQ_TABLE_WORDBITS - 1) / SQ_TABLE_WORDBITS)
+#define ARRAY_ALLOC_SIZE(size) ((size) * sizeof(SQObjectPtr) + sizeof(SQInteger) + ARRAY_WORDS(size) * sizeof(SQUnsignedInteger))
+
+SQShape *SQShape::AddKey(SQSharedState *ss,const SQObjectPtr &key)
+{
+    SQString *str = _string(key);
+    for(SQShape **c = &_children; *c; c = &(*c)->_sibling) {
+        SQShape *s = *c;
+        if(s->_key == str) {
+            //to the front, tables built the same way find it first
+            *c = s->_sibling;
+            s->_sibling = _children;
+            _children = s;
+            if(s->_uiRef++ == 0) {
+                Root()->_nunused--;
+                _nunusedchildren--;
+            }
+            return s;
+        }
+    }
+    if(_nchildren >= SQ_SHAPE_MAXCHILDREN) {
+        if(!_nunusedchildren) return NULL;
+        Prune(ss,Root(),false);
+    }
+    SQShape *s = Create(ss);
+    if(_keys && _keys->_used == _nkeys) {
+        s->_keys = _keys;
+    }
+    else {
+        //the keys after ours belong to another branch
+        sq_ssnew(ss,s->_keys,SQShapeKeys);
+        for(SQInteger i = 0; i < _nkeys; i++) s->_keys->_keys[i] = _keys->_keys[i];
+        memcpy(s->_keys->_ctrl,_keys->_ctrl,_nkeys);
+    }
+    s->_keys->_uiRef++;
+    s->_keys->_keys[_nkeys] = key;
+    s->_keys->_ctrl[_nkeys] = SQ_TABLE_H2(str->_hash);
+    s->_keys->_used = _nkeys + 1;
+    s->_key = str;
+    s->_nkeys = _nkeys + 1;
+    s->_parent = this;
+    _uiRef++;
+    s->_sibling = _children;
+    _children = s;
+    _nchildren++;
+    Root()->_nshapes++;
+    return s;
+}
+
+void SQShape::Unused(SQSharedState *ss)
+{
+    if(!_parent) {
+        //the root, released with the shared state
+        Free(ss);
+        return;
+    }
+    SQShape *root = Root();
+    root->_nunused++;
+    _parent->_nunusedchildren++;
+    //a chain has at most SQ_SHAPE_MAXKEYS shapes, a pruning frees at least one per unused
+    if(root->_nunused > SQ_SHAPE_MINUNUSED && root->_nunused * SQ_SHAPE_MAXKEYS > root->_nshapes)
+        root->Prune(ss,root,true);
+}
+
+void SQShape::Prune(SQSharedState *ss,SQShape *root,bool deep)
+{
+    SQShape **c = &_children;
+    while(*c) {
+        SQShape *s = *c;
+        if(deep) s->Prune(ss,root,true);
+        if(s->_uiRef == 0) {
+            *c = s->_sibling;
+            _nchildren--;
+            _nunusedchildren--;
+            s->Free(ss);
+            root->_nshapes--;
+            root->_nunused--;
+            if(--_uiRef == 0) {
+                root->_nunused++;
+                _parent->_nunusedchildren++;
+            }
+        }
+        else c = &s->_sibling;
+    }
+}
+
+void SQShape::Free(SQSharedState *ss)
+{
+    if(_keys) {
+        if(_keys->_used == _nkeys) {
+            //the parent can append in place again
+            _keys->_used--;
+            _keys->_keys[_nkeys - 1].Null();
+            _keys->_ctrl[_nkeys - 1] = SQ_TABLE_EMPTY;
+        }
+        if(--_keys->_uiRef == 0) sq_ssdelete(ss,_keys,SQShapeKeys);
+    }
+    sq_ssdelete(ss,this,SQShape);
+}
+
+SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize,SQShape *shape)
 {
-    SQInteger pow2size=MINPOWER2;
-    while(nInitialSize>pow2size)pow2size=pow2size<<1;
-    AllocNodes(pow2size);
-    _usednodes = 0;
-    _delegate = NULL;
     INIT_CHAIN();
-    ADD_TO_CHAIN(&_sharedstate->_gc_chain,this);
+    _shape = shape;
+    _values = NULL;
+    _valcap = 0;
+    if(shape) {
+        shape->AddRef();
+        _nodes = NULL;
+        _ctrl = NULL;
+        _numofnodes = 0;
+        _hashmask = 0;
+        _usednodes = 0;
+        if(nInitialSize) AllocValues(nInitialSize);
+    }
+    else {
+        SQInteger pow2size=MINPOWER2;
+        while(nInitialSize>MAX_USED(pow2size))pow2size=pow2size<<1;
+        AllocNodes(pow2size);
+    }
+    _delegate = NULL;
+    ADD_TO_CHAIN(&_sharedstate->_gc_young,this);
 }
 
-void SQTable::Remove(const SQObjectPtr &key)
+void SQTable::AllocValues(SQInteger n)
+{
+    SQObjectPtr *values = (SQObjectPtr *)SQ_SSMALLOC(_gcss(_sharedstate),n * sizeof(SQObjectPtr));
+    if(_usednodes) memcpy((void *)values,(void *)_values,_usednodes * sizeof(SQObjectPtr));
+    for(SQInteger i = _usednodes; i < n; i++) new (&values[i]) SQObjectPtr;
+    //the values moved, only the memory is left
+    if(_values) SQ_SSFREE(_gcss(_sharedstate),_values,_valcap * sizeof(SQObjectPtr));
+    _values = values;
+    _valcap = n;
+}
+
+void SQTable::FreeValues(SQObjectPtr *values,SQInteger n)
 {
+    for(SQInteger i = 0; i < n; i++) values[i].~SQObjectPtr();
+    if(values) SQ_SSFREE(_gcss(_sharedstate),values,n * sizeof(SQObjectPtr));
+}
 
-    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+//from shape mode to a hash table big enough for nSize keys
+void SQTable::ToHash(SQInteger nSize)
+{
+    SQShape *shape = _shape;
+    SQObjectPtr *values = _values;
+    SQInteger nvalues = _valcap;
+    SQInteger pow2size = MINPOWER2;
+    while(nSize > MAX_USED(pow2size)) pow2size <<= 1;
+    SQInteger n = _usednodes;
+    _shape = NULL;
+    _values = NULL;
+    _valcap = 0;
+    AllocNodes(pow2size);
+    for(SQInteger i = 0; i < n; i++) {
+        const SQObjectPtr &key = shape->Key(i);
+        while(!Insert(key,values[i],HashObj(key)))
+            Resize((_hashmask+1)*2,_arraysize);
+    }
+    FreeValues(values,nvalues);
+    shape->Release(_gcss(_sharedstate));
+}
+
+void SQTable::Remove(const SQObjectPtr &key)
+{
+    if(_shape) {
+        SQInteger i;
+        if(sq_type(key) != OT_STRING || (i = _shape->Find(key)) < 0)
+            return;
+        if(i == _usednodes - 1) {
+            //the last key, back to the previous shape
+            SQShape *shape = _shape;
+            _shape = shape->_parent;
+            _shape->AddRef();
+            _usednodes--;
+            SQObjectPtr dead = _values[i];
+            _values[i].Null();
+            shape->Release(_gcss(_sharedstate));
+            return;
+        }
+        ToHash(_usednodes);
+    }
+    if (InArray(key)) {
+        SQInteger i = _integer(key);
+        if (ArraySet(i)) {
+            ArrayBits()[i / SQ_TABLE_WORDBITS] &= ~((SQUnsignedInteger)1 << (i % SQ_TABLE_WORDBITS));
+            ArrayUsed()--;
+            SQObjectPtr dead = _array[i];
+            _array[i].Null();
+        }
+        return;
+    }
+    _HashNode *n = _Get(key, HashObj(key));
     if (n) {
-        n->val.Null();
-        n->key.Null();
-        _usednodes--;
+        Erase(n - _nodes);
         Rehash(false);
     }
 }
 
 void SQTable::AllocNodes(SQInteger nSize)
 {
-    _HashNode *nodes=(_HashNode *)SQ_MALLOC(sizeof(_HashNode)*nSize);
-    for(SQInteger i=0;i<nSize;i++){
-        _HashNode &n = nodes[i];
-        new (&n) _HashNode;
-        n.next=NULL;
+    SQInteger n = nSize + OVERFLOW_NODES(nSize);
+    _HashNode *nodes=(_HashNode *)SQ_SSMALLOC(_gcss(_sharedstate),ALLOC_SIZE(n));
+    for(SQInteger i=0;i<n;i++){
+        new (&nodes[i]) _HashNode;
     }
-    _numofnodes=nSize;
+    _ctrl=(unsigned char *)(nodes + n);
+    memset(_ctrl,SQ_TABLE_EMPTY,n);
+    memset(_ctrl + n,SQ_TABLE_END,SQ_TABLE_GROUP);
+    _numofnodes=n;
+    _hashmask=nSize-1;
     _nodes=nodes;
-    _firstfree=&_nodes[_numofnodes-1];
+    _usednodes=0;
 }
 
+void SQTable::FreeNodes(_HashNode *nodes,SQInteger n)
+{
+    for(SQInteger i=0;i<n;i++)
+        nodes[i].~_HashNode();
+    SQ_SSFREE(_gcss(_sharedstate),nodes,ALLOC_SIZE(n));
+}
+
+void SQTable::AllocArray(SQInteger nSize)
+{
+    _array=(SQObjectPtr *)SQ_SSMALLOC(_gcss(_sharedstate),ARRAY_ALLOC_SIZE(nSize));
+    for(SQInteger i=0;i<nSize;i++)
+        new (&_array[i]) SQObjectPtr;
+    _arraysize=nSize;
+    ArrayUsed()=0;
+    memset(ArrayBits(),0,ARRAY_WORDS(nSize) * sizeof(SQUnsignedInteger));
+}
+
+void SQTable::FreeArray(SQObjectPtr *array,SQInteger n)
+{
+    if(!array) return;
+    for(SQInteger i=0;i<n;i++)
+        array[i].~SQObjectPtr();
+    SQ_SSFREE(_gcss(_sharedstate),array,ARRAY_ALLOC_SIZE(n));
+}
+
+#ifndef NO_GARBAGE_COLLECTOR
+SQInteger SQTable::MemSize()
+{
+    if(_shape) return sizeof(SQTable) + _valcap * sizeof(SQObjectPtr);
+    return sizeof(SQTable) + ALLOC_SIZE(_numofnodes) + (_array ? ARRAY_ALLOC_SIZE(_arraysize) : 0);
+}
+#endif
+
 void SQTable::Rehash(bool force)
 {
-    SQInteger oldsize=_numofnodes;
-    //prevent problems with the integer division
-    if(oldsize<4)oldsize=4;
-    _HashNode *nold=_nodes;
-    SQInteger nelems=CountUsed();
-    if (nelems >= oldsize-oldsize/4)  /* using more than 3/4? */
-        AllocNodes(oldsize*2);
-    else if (nelems <= oldsize/4 &&  /* less than 1/4? */
-        oldsize > MINPOWER2)
-        AllocNodes(oldsize/2);
-    else if(force)
-        AllocNodes(oldsize);
-    else
+    SQInteger size=_hashmask+1;
+    if (force || _usednodes >= MAX_USED(size) ||
+        (_usednodes <= size/4 && size > MINPOWER2)) { /* less than 1/4? */
+        SQInteger nSize,nArraySize;
+        ComputeSizes(NULL,nSize,nArraySize);
+        Resize(nSize,nArraySize);
+    }
+}
+
+//counts an integer key that could go in an array part, the keys in [2^(b-1),2^b) are counted in nums[b]
+static void CountArrayKey(const SQObjectPtr &key,SQInteger *nums,SQInteger &nint)
+{
+    if(sq_type(key) != OT_INTEGER || (SQUnsignedInteger)_integer(key) >= ((SQUnsignedInteger)1 << SQ_TABLE_MAXARRAYBITS))
         return;
-    _usednodes = 0;
-    for (SQInteger i=0; i<oldsize; i++) {
-        _HashNode *old = nold+i;
-        if (sq_type(old->key) != OT_NULL)
-            NewSlot(old->key,old->val);
+    SQInteger b = 0;
+    for(SQUnsignedInteger k = (SQUnsignedInteger)_integer(key); k; k >>= 1) b++;
+    nums[b]++;
+    nint++;
+}
+
+//sizes of the two parts for the keys of the table and newkey(if any)
+void SQTable::ComputeSizes(const SQObjectPtr *newkey,SQInteger &nSize,SQInteger &nArraySize)
+{
+    SQInteger nums[SQ_TABLE_MAXARRAYBITS + 1];
+    memset(nums,0,sizeof(nums));
+    SQInteger total = CountUsed();
+    SQInteger nint = total - _usednodes;
+    for(SQInteger i=0, b=0, twotob=1; i<_arraysize; i++) {
+        if(i == twotob) { b++; twotob <<= 1; }
+        if(ArraySet(i)) nums[b]++;
+    }
+    for(SQInteger i=0; i<_numofnodes; i++) {
+        if(!(_ctrl[i] & SQ_TABLE_EMPTY)) CountArrayKey(_nodes[i].key,nums,nint);
+    }
+    if(newkey) {
+        CountArrayKey(*newkey,nums,nint);
+        total++;
+    }
+    //the biggest power of 2 with more than half of the slots used
+    SQInteger used = 0, arrayused = 0;
+    nArraySize = 0;
+    for(SQInteger b = 0, twotob = 1; b <= SQ_TABLE_MAXARRAYBITS && nint > twotob / 2; b++, twotob <<= 1) {
+        used += nums[b];
+        if(used > twotob / 2) {
+            nArraySize = twotob;
+            arrayused = used;
+        }
+    }
+    nSize = MINPOWER2;
+    while(total - arrayused > MAX_USED(nSize)) nSize <<= 1;
+}
+
+void SQTable::Resize(SQInteger nSize,SQInteger nArraySize)
+{
+    _HashNode *nold=_nodes;
+    unsigned char *cold=_ctrl;
+    SQInteger oldsize=_numofnodes;
+    SQObjectPtr *aold=NULL;
+    SQUnsignedInteger *bold=NULL;
+    SQInteger oldasize=0;
+    //the same array part keeps its keys, the hash part has none of them
+    if(nArraySize != _arraysize) {
+        aold=_array;
+        oldasize=_arraysize;
+        bold=oldasize ? ArrayBits() : NULL;
+        _array=NULL;
+        _arraysize=0;
+        if(nArraySize) AllocArray(nArraySize);
     }
-    for(SQInteger k=0;k<oldsize;k++)
-        nold[k].~_HashNode();
-    SQ_FREE(nold,oldsize*sizeof(_HashNode));
+    for(;;) {
+        AllocNodes(nSize);
+        bool done = true;
+        for(SQInteger i=0; i<oldasize && done; i++) {
+            if((bold[i / SQ_TABLE_WORDBITS] >> (i % SQ_TABLE_WORDBITS)) & 1)
+                done = Move(SQObjectPtr(i),aold[i]);
+        }
+        for(SQInteger i=0; i<oldsize && done; i++) {
+            if(!(cold[i] & SQ_TABLE_EMPTY))
+                done = Move(nold[i].key,nold[i].val);
+        }
+        if(done)
+            break;
+        FreeNodes(_nodes,_numofnodes);
+        nSize<<=1;
+    }
+    FreeNodes(nold,oldsize);
+    FreeArray(aold,oldasize);
+}
+
+//puts back a key of the table in one of the two parts, false if the hash part has no room
+bool SQTable::Move(const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    if(InArray(key)) {
+        SQInteger i = _integer(key);
+        if(!ArraySet(i)) {
+            ArrayBits()[i / SQ_TABLE_WORDBITS] |= (SQUnsignedInteger)1 << (i % SQ_TABLE_WORDBITS);
+            ArrayUsed()++;
+        }
+        _array[i] = val;
+        return true;
+    }
+    return Insert(key,val,HashObj(key));
+}
+
+//the key must not be in the table already
+bool SQTable::Insert(const SQObjectPtr &key,const SQObjectPtr &val,SQHash hash)
+{
+    SQInteger pos = (SQInteger)(SQ_TABLE_POS(hash) & _hashmask);
+    for(;;) {
+        unsigned int m = sq_groupfree(_ctrl + pos);
+        if(m) {
+            SQInteger idx = pos + sq_lowestbit(m);
+            if(idx >= _numofnodes)
+                return false;
+            _ctrl[idx] = SQ_TABLE_H2(hash);
+            _nodes[idx].key = key;
+            _nodes[idx].val = val;
+            _usednodes++;
+            return true;
+        }
+        pos += SQ_TABLE_GROUP;
+    }
+}
+
+/*
+    backward shift deletion: every node that follows the erased one in the same run of used
+    nodes and whose home position is not after the hole moves into it, so the probes never
+    meet a hole before their key. Nodes only move toward the first one(see Next()).
+*/
+void SQTable::Erase(SQInteger idx)
+{
+    //released once the table is consistent again, a release hook could look into it
+    _HashNode dead;
+    memcpy((void *)&dead,(void *)&_nodes[idx],sizeof(_HashNode));
+    new (&_nodes[idx]) _HashNode;
+    for(SQInteger j = idx + 1; j < _numofnodes && !(_ctrl[j] & SQ_TABLE_EMPTY); j++) {
+        SQInteger home = (SQInteger)(SQ_TABLE_POS(HashObj(_nodes[j].key)) & _hashmask);
+        if(home <= idx) {
+            memcpy((void *)&_nodes[idx],(void *)&_nodes[j],sizeof(_HashNode));
+            new (&_nodes[j]) _HashNode;
+            _ctrl[idx] = _ctrl[j];
+            idx = j;
+        }
+    }
+    _ctrl[idx] = SQ_TABLE_EMPTY;
+    _usednodes--;
 }
 
 SQTable *SQTable::Clone()
 {
-    SQTable *nt=Create(_opt_ss(this),_numofnodes);
-#ifdef _FAST_CLONE
-    _HashNode *basesrc = _nodes;
-    _HashNode *basedst = nt->_nodes;
-    _HashNode *src = _nodes;
-    _HashNode *dst = nt->_nodes;
-    SQInteger n = 0;
-    for(n = 0; n < _numofnodes; n++) {
-        dst->key = src->key;
-        dst->val = src->val;
-        if(src->next) {
-            assert(src->next > basesrc);
-            dst->next = basedst + (src->next - basesrc);
-            assert(dst != dst->next);
-        }
-        dst++;
-        src++;
-    }
-    assert(_firstfree > basesrc);
-    assert(_firstfree != NULL);
-    nt->_firstfree = basedst + (_firstfree - basesrc);
+    if(_shape) {
+        SQTable *nt=Create(_opt_ss(this),_usednodes,_shape);
+        for(SQInteger i=0; i<_usednodes; i++)
+            nt->_values[i] = _values[i];
+        nt->_usednodes = _usednodes;
+        nt->SetDelegate(_delegate);
+        return nt;
+    }
+    SQInteger size=_hashmask+1;
+    SQTable *nt=Create(_opt_ss(this),MAX_USED(size),NULL);
+    assert(nt->_numofnodes == _numofnodes);
+    //same size, every node goes to the same position
+    for(SQInteger i=0; i<_numofnodes; i++) {
+        if(!(_ctrl[i] & SQ_TABLE_EMPTY)) {
+            nt->_nodes[i].key = _nodes[i].key;
+            nt->_nodes[i].val = _nodes[i].val;
+        }
+    }
+    memcpy(nt->_ctrl,_ctrl,_numofnodes);
     nt->_usednodes = _usednodes;
-#else
-    SQInteger ridx=0;
-    SQObjectPtr key,val;
-    while((ridx=Next(true,ridx,key,val))!=-1){
-        nt->NewSlot(key,val);
+    if(_arraysize) {
+        nt->AllocArray(_arraysize);
+        for(SQInteger i=0; i<_arraysize; i++)
+            nt->_array[i] = _array[i];
+        memcpy(nt->ArrayBits(),ArrayBits(),ARRAY_WORDS(_arraysize) * sizeof(SQUnsignedInteger));
+        nt->ArrayUsed() = ArrayUsed();
     }
-#endif
     nt->SetDelegate(_delegate);
     return nt;
 }
 
 bool SQTable::Get(const SQObjectPtr &key,SQObjectPtr &val)
 {
+    if(_shape) {
+        SQInteger i;
+        if(sq_type(key) == OT_STRING && (i = _shape->Find(key)) >= 0) {
+            val = _realval(_values[i]);
+            return true;
+        }
+        return false;
+    }
+    if(InArray(key)) {
+        if(!ArraySet(_integer(key)))
+            return false;
+        val = _realval(_array[_integer(key)]);
+        return true;
+    }
     if(sq_type(key) == OT_NULL)
         return false;
-    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+    _HashNode *n = _Get(key, HashObj(key));
     if (n) {
         val = _realval(n->val);
         return true;
     }
     return false;
 }
+
 bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
 {
     assert(sq_type(key) != OT_NULL);
-    SQHash h = HashObj(key) & (_numofnodes - 1);
+    if(_shape) {
+        //the strings that aren't interned make it a hash table, the shapes tell the keys apart by address
+        if(sq_type(key) == OT_STRING && _string(key)->_interned) {
+            SQInteger i = _shape->Find(key);
+            if(i >= 0) {
+                _values[i] = val;
+                return false;
+            }
+            SQShape *shape = _usednodes < SQ_SHAPE_MAXKEYS ? _shape->AddKey(_gcss(_sharedstate),key) : NULL;
+            if(shape) {
+                if(_usednodes == _valcap)
+                    AllocValues(_valcap ? (_valcap * 2 < SQ_SHAPE_MAXKEYS ? _valcap * 2 : SQ_SHAPE_MAXKEYS) : MINPOWER2);
+                _shape->Release(_gcss(_sharedstate));
+                _shape = shape;
+                _values[_usednodes++] = val;
+                return true;
+            }
+        }
+        ToHash(_usednodes + 1);
+    }
+    if(InArray(key)) {
+        bool isnew = !ArraySet(_integer(key));
+        Move(key,val);
+        return isnew;
+    }
+    SQHash h = HashObj(key);
     _HashNode *n = _Get(key, h);
     if (n) {
         n->val = val;
         return false;
     }
-    _HashNode *mp = &_nodes[h];
-    n = mp;
-
-
-    //key not found I'll insert it
-    //main pos is not free
-
-    if(sq_type(mp->key) != OT_NULL) {
-        n = _firstfree;  /* get a free place */
-        SQHash mph = HashObj(mp->key) & (_numofnodes - 1);
-        _HashNode *othern;  /* main position of colliding node */
-
-        if (mp > n && (othern = &_nodes[mph]) != mp){
-            /* yes; move colliding node into free position */
-            while (othern->next != mp){
-                assert(othern->next != NULL);
-                othern = othern->next;  /* find previous */
-            }
-            othern->next = n;  /* redo the chain with `n' in place of `mp' */
-            n->key = mp->key;
-            n->val = mp->val;/* copy colliding node into free pos. (mp->next also goes) */
-            n->next = mp->next;
-            mp->key.Null();
-            mp->val.Null();
-            mp->next = NULL;  /* now `mp' is free */
-        }
-        else{
-            /* new node will go into free position */
-            n->next = mp->next;  /* chain new position */
-            mp->next = n;
-            mp = n;
-        }
-    }
-    mp->key = key;
-
-    for (;;) {  /* correct `firstfree' */
-        if (sq_type(_firstfree->key) == OT_NULL && _firstfree->next == NULL) {
-            mp->val = val;
-            _usednodes++;
-            return true;  /* OK; table still has a free place */
-        }
-        else if (_firstfree == _nodes) break;  /* cannot decrement from here */
-        else (_firstfree)--;
+    if (_usednodes >= MAX_USED(_hashmask+1)) {
+        //the integer keys may move to the array part, the key too
+        SQInteger nSize,nArraySize;
+        ComputeSizes(&key,nSize,nArraySize);
+        Resize(nSize,nArraySize);
+        if(InArray(key))
+            return Move(key,val);
     }
-    Rehash(true);
-    return NewSlot(key, val);
+    //the probe ran past the overflow nodes
+    while (!Insert(key,val,h))
+        Resize((_hashmask+1)*2,_arraysize);
+    return true;
 }
 
+//iterates the array part and then from the last node back, removing the current key
+//does not skip any other. In shape mode the keys come in the order they were added
 SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval)
 {
     SQInteger idx = (SQInteger)TranslateIndex(refpos);
-    while (idx < _numofnodes) {
-        if(sq_type(_nodes[idx].key) != OT_NULL) {
+    if(_shape) {
+        if(idx >= _usednodes)
+            return -1;
+        outkey = _shape->Key(idx);
+        outval = getweakrefs?(SQObject)_values[idx]:_realval(_values[idx]);
+        return ++idx;
+    }
+    for(; idx < _arraysize; idx++) {
+        if(ArraySet(idx)) {
+            outkey = idx;
+            outval = getweakrefs?(SQObject)_array[idx]:_realval(_array[idx]);
+            return ++idx;
+        }
+    }
+    while (idx < _arraysize + _numofnodes) {
+        SQInteger i = _arraysize + _numofnodes - 1 - idx;
+        if(!(_ctrl[i] & SQ_TABLE_EMPTY)) {
             //first found
-            _HashNode &n = _nodes[idx];
+            _HashNode &n = _nodes[i];
             outkey = n.key;
             outval = getweakrefs?(SQObject)n.val:_realval(n.val);
             //return idx for the next iteration
@@ -194,7 +555,21 @@ SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr
 
 bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
 {
-    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+    if(_shape) {
+        SQInteger i;
+        if(sq_type(key) == OT_STRING && (i = _shape->Find(key)) >= 0) {
+            _values[i] = val;
+            return true;
+        }
+        return false;
+    }
+    if(InArray(key)) {
+        if(!ArraySet(_integer(key)))
+            return false;
+        _array[_integer(key)] = val;
+        return true;
+    }
+    _HashNode *n = _Get(key, HashObj(key));
     if (n) {
         n->val = val;
         return true;
@@ -204,7 +579,23 @@ bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
 
 void SQTable::_ClearNodes()
 {
+    if(_shape) {
+        SQShape *root = _shape->Root();
+        root->AddRef();
+        _shape->Release(_gcss(_sharedstate));
+        _shape = root;
+        for(SQInteger i = 0; i < _usednodes; i++) _values[i].Null();
+        _usednodes = 0;
+        return;
+    }
     for(SQInteger i = 0;i < _numofnodes; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
+    memset(_ctrl,SQ_TABLE_EMPTY,_numofnodes);
+    _usednodes = 0;
+    for(SQInteger i = 0; i < _arraysize; i++) _array[i].Null();
+    if(_arraysize) {
+        memset(ArrayBits(),0,ARRAY_WORDS(_arraysize) * sizeof(SQUnsignedInteger));
+        ArrayUsed() = 0;
+    }
 }
 
 void SQTable::Finalize()
@@ -216,6 +607,6 @@ void SQTable::Finalize()
 void SQTable::Clear()
 {
     _ClearNodes();
-    _usednodes = 0;
-    Rehash(true);
+    if(!_shape)
+        Rehash(true);
 }
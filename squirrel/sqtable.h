@@ -2,13 +2,38 @@
 #ifndef _SQTABLE_H_
 #define _SQTABLE_H_
 /*
-* The following code is based on Lua 4.0 (Copyright 1994-2002 Tecgraf, PUC-Rio.)
-* http://www.lua.org/copyright.html#4
-* http://www.lua.org/source/4.0.1/src_ltable.c.html
+* open addressing hash table: every node has a control byte that is either empty(high bit set)
+* or 7 bits of the hash of its key, the control bytes of a group of nodes are matched at once
+* (with SSE2 when available). Lookups probe linearly from the home position of the key without
+* wrapping around(past the last home position there are a few overflow nodes), deletions move
+* the following nodes back instead of leaving tombstones. Beside the hash part an array part
+* stores the values of the integer keys from 0 to its size by index, sized on every rehash as
+* the biggest power of 2 that has more than half of its slots used.
+* Small tables with string keys start in shape mode instead: the keys live in a shape shared
+* with the other tables that got the same keys in the same order and the table only stores
+* the values. They become hash tables when they get too many keys, a key of another type
+* or a deletion.
 */
 
 #include "sqstring.h"
 
+#if !defined(SQ_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SQ_TABLE_SSE2
+#include <emmintrin.h>
+#endif
+
+#define SQ_TABLE_GROUP 16
+#define SQ_TABLE_EMPTY 0x80
+//control bytes past the last node, they stop the probes
+#define SQ_TABLE_END 0xFF
+//home position of a hash: integer keys hash to themselves and sequential ones stay next to each other
+#define SQ_TABLE_POS(h) ((h) ^ ((h) >> 16))
+//hash bits stored in the control byte, taken from all the bits of the hash
+#ifdef _SQ64
+#define SQ_TABLE_H2(h) ((unsigned char)(((h) * (SQHash)0x9E3779B97F4A7C15ULL) >> 57))
+#else
+#define SQ_TABLE_H2(h) ((unsigned char)(((h) * (SQHash)0x9E3779B9U) >> 25))
+#endif
 
 #define hashptr(p)  ((SQHash)(((SQInteger)p) >> 3))
 
@@ -18,35 +43,187 @@ inline SQHash HashObj(const SQObject &key)
         case OT_STRING:     return _string(key)->_hash;
         case OT_FLOAT:      return (SQHash)((SQInteger)_float(key));
         case OT_BOOL: case OT_INTEGER:  return (SQHash)((SQInteger)_integer(key));
-        default:            return hashptr(key._unVal.pRefCounted);
+        default:            return hashptr(_refcounted(key));
     }
 }
 
+//bit i is set if the control byte i of the group equals h2
+inline unsigned int sq_groupmatch(const unsigned char *ctrl,unsigned char h2)
+{
+#ifdef SQ_TABLE_SSE2
+    __m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g,_mm_set1_epi8((char)h2)));
+#else
+    unsigned int m = 0;
+    for(unsigned int i = 0; i < SQ_TABLE_GROUP; i++) if(ctrl[i] == h2) m |= 1u << i;
+    return m;
+#endif
+}
+
+//bit i is set if the node i of the group is free(or past the end)
+inline unsigned int sq_groupfree(const unsigned char *ctrl)
+{
+#ifdef SQ_TABLE_SSE2
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    unsigned int m = 0;
+    for(unsigned int i = 0; i < SQ_TABLE_GROUP; i++) if(ctrl[i] & SQ_TABLE_EMPTY) m |= 1u << i;
+    return m;
+#endif
+}
+
+inline SQInteger sq_lowestbit(unsigned int m)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(m);
+#else
+    SQInteger i = 0;
+    while(!(m & 1)) { m >>= 1; i++; }
+    return i;
+#endif
+}
+
+//most slots of the array part are 2^SQ_TABLE_MAXARRAYBITS
+#define SQ_TABLE_MAXARRAYBITS 26
+#define SQ_TABLE_WORDBITS ((SQInteger)(sizeof(SQUnsignedInteger) * 8))
+
+//most keys of a table in shape mode, as many as the nodes of a group
+#define SQ_SHAPE_MAXKEYS SQ_TABLE_GROUP
+
+//keys of a chain of shapes, shared until the chain branches
+struct SQShapeKeys
+{
+    SQShapeKeys() { _uiRef = 0; _used = 0; memset(_ctrl,SQ_TABLE_EMPTY,sizeof(_ctrl)); }
+    SQUnsignedInteger _uiRef;
+    //keys set, the shape with as many keys can append the next one in place
+    SQInteger _used;
+    //hash bits of the keys, matched like a group of nodes
+    unsigned char _ctrl[SQ_SHAPE_MAXKEYS];
+    SQObjectPtr _keys[SQ_SHAPE_MAXKEYS];
+};
+
+//unused shapes kept for reuse before they get freed(see SQShape::Unused())
+#define SQ_SHAPE_MINUNUSED 256
+//more transitions from a shape than these make the table a hash table
+#define SQ_SHAPE_MAXCHILDREN 64
+
+/*
+    string keys of the tables in shape mode, the value of the key i is the value i of the
+    table. Shapes form a transition tree rooted in the empty one of the shared state. A shape
+    that no table and no other shape uses stays in the tree for the next table built the same
+    way, the unused ones are freed all together once there are enough of them
+*/
+struct SQShape
+{
+    SQShape() { _parent = _children = _sibling = NULL; _key = NULL; _keys = NULL; _nkeys = 0; _uiRef = 1; _nchildren = 0; _nunusedchildren = 0; _nshapes = 1; _nunused = 0; }
+    //ss is the allocator of the tables(see _gcss())
+    static SQShape *Create(SQSharedState *ss)
+    {
+        SQShape *s;
+        sq_ssnew(ss,s,SQShape);
+        return s;
+    }
+    //the shape with one more key, referenced, or NULL if this has too many transitions
+    SQShape *AddKey(SQSharedState *ss,const SQObjectPtr &key);
+    //index of a string key or -1
+    inline SQInteger Find(const SQObjectPtr &key)
+    {
+        if(!_nkeys) return -1;
+        SQString *str = _string(key);
+        unsigned int m = sq_groupmatch(_keys->_ctrl,SQ_TABLE_H2(str->_hash)) & ((2u << (_nkeys - 1)) - 1);
+        while(m) {
+            SQInteger i = sq_lowestbit(m);
+            if(_streq(_string(_keys->_keys[i]),str)) return i;
+            m &= m - 1;
+        }
+        return -1;
+    }
+    const SQObjectPtr &Key(SQInteger i) { return _keys->_keys[i]; }
+    SQShape *Root() { SQShape *s = this; while(s->_parent) s = s->_parent; return s; }
+    void AddRef() { _uiRef++; }
+    void Release(SQSharedState *ss) { if(--_uiRef == 0) Unused(ss); }
+    //frees the unused children of this shape and, if deep, the unused shapes under them
+    void Prune(SQSharedState *ss,SQShape *root,bool deep);
+    SQShape *_parent;
+    //shapes with one more key than this, the last one used first
+    SQShape *_children;
+    SQShape *_sibling;
+    //last key, the one added to the parent(held by _keys)
+    SQString *_key;
+    SQInteger _nchildren;
+    SQInteger _nunusedchildren;
+    SQShapeKeys *_keys;
+    SQInteger _nkeys;
+    //tables and children using the shape
+    SQUnsignedInteger _uiRef;
+    //shapes of the tree and how many are unused, kept by the root
+    SQInteger _nshapes;
+    SQInteger _nunused;
+private:
+    void Unused(SQSharedState *ss);
+    void Free(SQSharedState *ss);
+};
+
 struct SQTable : public SQDelegable
 {
 private:
     struct _HashNode
     {
-        _HashNode() { next = NULL; }
         SQObjectPtr val;
         SQObjectPtr key;
-        _HashNode *next;
     };
-    _HashNode *_firstfree;
     _HashNode *_nodes;
+    //control bytes, one per node and a group of SQ_TABLE_END after them
+    unsigned char *_ctrl;
+    //nodes, including the overflow ones past the home positions
     SQInteger _numofnodes;
+    //home positions are SQ_TABLE_POS(hash) & _hashmask
+    SQInteger _hashmask;
     SQInteger _usednodes;
+    //keys in shape mode, NULL for a hash table
+    SQShape *_shape;
+    union {
+        //values in shape mode, the first _usednodes are set
+        SQObjectPtr *_values;
+        //array part of a hash table, the integer keys from 0 to _arraysize-1 are never in the hash part
+        SQObjectPtr *_array;
+    };
+    union {
+        SQInteger _valcap;
+        SQInteger _arraysize;
+    };
 
 ///////////////////////////
     void AllocNodes(SQInteger nSize);
+    void FreeNodes(_HashNode *nodes,SQInteger n);
+    void AllocArray(SQInteger nSize);
+    void FreeArray(SQObjectPtr *array,SQInteger n);
     void Rehash(bool force);
-    SQTable(SQSharedState *ss, SQInteger nInitialSize);
+    void ComputeSizes(const SQObjectPtr *newkey,SQInteger &nSize,SQInteger &nArraySize);
+    void Resize(SQInteger nSize,SQInteger nArraySize);
+    bool Move(const SQObjectPtr &key,const SQObjectPtr &val);
+    bool Insert(const SQObjectPtr &key,const SQObjectPtr &val,SQHash hash);
+    void Erase(SQInteger idx);
+    void AllocValues(SQInteger n);
+    void FreeValues(SQObjectPtr *values,SQInteger n);
+    void ToHash(SQInteger nSize);
+    SQTable(SQSharedState *ss, SQInteger nInitialSize, SQShape *shape);
     void _ClearNodes();
+    //the count of the set slots of the array part and their bits follow its slots
+    SQInteger &ArrayUsed() { return *(SQInteger *)(_array + _arraysize); }
+    SQUnsignedInteger *ArrayBits() { return (SQUnsignedInteger *)(&ArrayUsed() + 1); }
+    bool InArray(const SQObjectPtr &key) { return sq_type(key) == OT_INTEGER && (SQUnsignedInteger)_integer(key) < (SQUnsignedInteger)_arraysize; }
+    bool ArraySet(SQInteger i) { return (ArrayBits()[i / SQ_TABLE_WORDBITS] >> (i % SQ_TABLE_WORDBITS)) & 1; }
 public:
     static SQTable* Create(SQSharedState *ss,SQInteger nInitialSize)
     {
-        SQTable *newtable = (SQTable*)SQ_MALLOC(sizeof(SQTable));
-        new (newtable) SQTable(ss, nInitialSize);
+        return Create(ss,nInitialSize,nInitialSize <= SQ_SHAPE_MAXKEYS ? ss->_rootshape : NULL);
+    }
+    //a table in shape mode if shape is not NULL
+    static SQTable* Create(SQSharedState *ss,SQInteger nInitialSize,SQShape *shape)
+    {
+        SQTable *newtable = (SQTable*)SQ_SSMALLOC(_gcss(ss),sizeof(SQTable));
+        new (newtable) SQTable(ss, nInitialSize, shape);
         newtable->_delegate = NULL;
         return newtable;
     }
@@ -55,41 +232,92 @@ public:
     ~SQTable()
     {
         SetDelegate(NULL);
-        REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
-        for (SQInteger i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
-        SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+        REMOVE_FROM_CHAIN(_gcchain(this),this);
+        if(_shape) {
+            FreeValues(_values,_valcap);
+            _shape->Release(_gcss(_sharedstate));
+        }
+        else {
+            FreeNodes(_nodes,_numofnodes);
+            FreeArray(_array,_arraysize);
+        }
     }
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
+    //visits at most n slots of the array part and then nodes from pos on, returns where to resume or -1 past the last node
+    SQInteger TraverseNodes(SQInteger pos,SQInteger n,SQGCVISIT visit,void *ud);
     SQObjectType GetType() {return OT_TABLE;}
 #endif
     inline _HashNode *_Get(const SQObjectPtr &key,SQHash hash)
     {
-        _HashNode *n = &_nodes[hash];
-        do{
-            if(_rawval(n->key) == _rawval(key) && sq_type(n->key) == sq_type(key)){
-                return n;
+        SQInteger pos = (SQInteger)(SQ_TABLE_POS(hash) & _hashmask);
+        unsigned char h2 = SQ_TABLE_H2(hash);
+        for(;;) {
+            const unsigned char *g = _ctrl + pos;
+            unsigned int m = sq_groupmatch(g,h2);
+            while(m) {
+                _HashNode *n = &_nodes[pos + sq_lowestbit(m)];
+                if(_rawequal(n->key,key)
+                    || (sq_type(key) == OT_STRING && sq_type(n->key) == OT_STRING && _streq(_string(n->key),_string(key)))) return n;
+                m &= m - 1;
             }
-        }while((n = n->next));
-        return NULL;
+            //the nodes from the home position on are all used up to the key
+            if(sq_groupfree(g)) return NULL;
+            pos += SQ_TABLE_GROUP;
+        }
     }
     //for compiler use
     inline bool GetStr(const SQChar* key,SQInteger keylen,SQObjectPtr &val)
     {
+        if(_shape) {
+            for(SQInteger i = 0; i < _usednodes; i++) {
+                if(scstrcmp(_stringval(_shape->Key(i)),key) == 0) {
+                    val = _realval(_values[i]);
+                    return true;
+                }
+            }
+            return false;
+        }
         SQHash hash = _hashstr(key,keylen);
-        _HashNode *n = &_nodes[hash & (_numofnodes - 1)];
-        _HashNode *res = NULL;
-        do{
-            if(sq_type(n->key) == OT_STRING && (scstrcmp(_stringval(n->key),key) == 0)){
-                res = n;
-                break;
+        SQInteger pos = (SQInteger)(SQ_TABLE_POS(hash) & _hashmask);
+        unsigned char h2 = SQ_TABLE_H2(hash);
+        for(;;) {
+            const unsigned char *g = _ctrl + pos;
+            unsigned int m = sq_groupmatch(g,h2);
+            while(m) {
+                _HashNode *n = &_nodes[pos + sq_lowestbit(m)];
+                if(sq_type(n->key) == OT_STRING && (scstrcmp(_stringval(n->key),key) == 0)) {
+                    val = _realval(n->val);
+                    return true;
+                }
+                m &= m - 1;
             }
-        }while((n = n->next));
-        if (res) {
-            val = _realval(res->val);
+            if(sq_groupfree(g)) return false;
+            pos += SQ_TABLE_GROUP;
+        }
+    }
+    //Get() of a string key starting from slot, where the key was found the last time.
+    //The key is checked there first, on a miss slot is updated with its new position
+    inline bool GetSlot(const SQObjectPtr &key,SQInteger &slot,SQObjectPtr &val)
+    {
+        SQUnsignedInteger i = (SQUnsignedInteger)slot;
+        if(_shape) {
+            if(i >= (SQUnsignedInteger)_usednodes || !_rawequal(_shape->Key(i),key)) {
+                if((slot = _shape->Find(key)) < 0) return false;
+                i = (SQUnsignedInteger)slot;
+            }
+            val = _realval(_values[i]);
             return true;
         }
-        return false;
+        if(i >= (SQUnsignedInteger)_numofnodes || !_rawequal(_nodes[i].key,key)) {
+            _HashNode *n = _Get(key,_string(key)->_hash);
+            if(!n) return false;
+            slot = i = (SQUnsignedInteger)(n - _nodes);
+        }
+        val = _realval(_nodes[i].val);
+        return true;
     }
     bool Get(const SQObjectPtr &key,SQObjectPtr &val);
     void Remove(const SQObjectPtr &key);
@@ -98,11 +326,11 @@ public:
     bool NewSlot(const SQObjectPtr &key,const SQObjectPtr &val);
     SQInteger Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
 
-    SQInteger CountUsed(){ return _usednodes;}
+    SQInteger CountUsed(){ return _shape || !_arraysize ? _usednodes : _usednodes + ArrayUsed();}
     void Clear();
     void Release()
     {
-        sq_delete(this, SQTable);
+        sq_ssdelete(_gcss(_sharedstate),this, SQTable);
     }
 
 };
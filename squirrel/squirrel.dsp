@@ -179,6 +179,18 @@ SOURCE=.\sqobject.cpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\sqparmark.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\sqpool.cpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\sqsnapshot.cpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\sqstate.cpp
 
 !IF  "$(CFG)" == "squirrel - Win32 Release"
@@ -271,6 +283,10 @@ SOURCE=.\sqpcheader.h
 # End Source File
 # Begin Source File
 
+SOURCE=.\sqpool.h
+# End Source File
+# Begin Source File
+
 SOURCE=.\sqstate.h
 # End Source File
 # Begin Source File
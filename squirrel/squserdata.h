@@ -4,15 +4,15 @@
 
 struct SQUserData : SQDelegable
 {
-    SQUserData(SQSharedState *ss){ _delegate = 0; _hook = NULL; INIT_CHAIN(); ADD_TO_CHAIN(&_ss(this)->_gc_chain, this); }
+    SQUserData(SQSharedState *ss){ _delegate = 0; _hook = NULL; INIT_CHAIN(); ADD_TO_CHAIN(&_ss(this)->_gc_young,this); }
     ~SQUserData()
     {
-        REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain, this);
+        REMOVE_FROM_CHAIN(_gcchain(this),this);
         SetDelegate(NULL);
     }
     static SQUserData* Create(SQSharedState *ss, SQInteger size)
     {
-        SQUserData* ud = (SQUserData*)SQ_MALLOC(sq_aligning(sizeof(SQUserData))+size);
+        SQUserData* ud = (SQUserData*)SQ_SSMALLOC(_gcss(ss),sq_aligning(sizeof(SQUserData))+size);
         new (ud) SQUserData(ss);
         ud->_size = size;
         ud->_typetag = 0;
@@ -20,14 +20,17 @@ struct SQUserData : SQDelegable
     }
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     void Finalize(){SetDelegate(NULL);}
     SQObjectType GetType(){ return OT_USERDATA;}
 #endif
     void Release() {
         if (_hook) _hook((SQUserPointer)sq_aligning(this + 1),_size);
         SQInteger tsize = _size;
+        SQSharedState *ss = _gcss(_sharedstate);
         this->~SQUserData();
-        SQ_FREE(this, sq_aligning(sizeof(SQUserData)) + tsize);
+        SQ_SSFREE(ss,this, sq_aligning(sizeof(SQUserData)) + tsize);
     }
 
 
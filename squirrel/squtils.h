@@ -12,6 +12,18 @@ void sq_vm_free(void *p,SQUnsignedInteger size);
 #define SQ_FREE(__ptr,__size) sq_vm_free((__ptr),(__size));
 #define SQ_REALLOC(__ptr,__oldsize,__size) sq_vm_realloc((__ptr),(__oldsize),(__size));
 
+//allocations charged to a shared state(see SQSharedState::_allocated), ss can be NULL
+struct SQSharedState;
+void *sq_ss_malloc(SQSharedState *ss,SQUnsignedInteger size);
+void *sq_ss_realloc(SQSharedState *ss,void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
+void sq_ss_free(SQSharedState *ss,void *p,SQUnsignedInteger size);
+
+#define sq_ssnew(__ss,__ptr,__type) {__ptr=(__type *)sq_ss_malloc((__ss),sizeof(__type));new (__ptr) __type;}
+#define sq_ssdelete(__ss,__ptr,__type) {SQSharedState *__owner=(__ss);__ptr->~__type();sq_ss_free(__owner,__ptr,sizeof(__type));}
+#define SQ_SSMALLOC(__ss,__size) sq_ss_malloc((__ss),(__size));
+#define SQ_SSFREE(__ss,__ptr,__size) sq_ss_free((__ss),(__ptr),(__size));
+#define SQ_SSREALLOC(__ss,__ptr,__oldsize,__size) sq_ss_realloc((__ss),(__ptr),(__oldsize),(__size));
+
 #define sq_aligning(v) (((size_t)(v) + (SQ_ALIGNMENT-1)) & (~(SQ_ALIGNMENT-1)))
 #define sq_max(a, b) ((a) > (b) ? (a) : (b))
 
@@ -19,14 +31,19 @@ void sq_vm_free(void *p,SQUnsignedInteger size);
 template<typename T> class sqvector
 {
 public:
-    sqvector()
+    sqvector(SQSharedState *owner = NULL)
     {
         _vals = NULL;
         _size = 0;
         _allocated = 0;
+        _owner = owner;
     }
     sqvector(const sqvector<T>& v)
     {
+        _vals = NULL;
+        _size = 0;
+        _allocated = 0;
+        _owner = v._owner;
         copy(v);
     }
     void copy(const sqvector<T>& v)
@@ -48,7 +65,7 @@ public:
         if(_allocated) {
             for(SQUnsignedInteger i = 0; i < _size; i++)
                 _vals[i].~T();
-            SQ_FREE(_vals, (_allocated * sizeof(T)));
+            SQ_SSFREE(_owner, _vals, (_allocated * sizeof(T)));
         }
     }
     void reserve(SQUnsignedInteger newsize) { _realloc(newsize); }
@@ -100,6 +117,8 @@ public:
         _size--;
     }
     SQUnsignedInteger capacity() { return _allocated; }
+    //the shared state charged for the storage
+    void setowner(SQSharedState *owner) { assert(!_allocated); _owner = owner; }
     inline T &back() const { return _vals[_size - 1]; }
     inline T& operator[](SQUnsignedInteger pos) const{ return _vals[pos]; }
     T* _vals;
@@ -107,11 +126,12 @@ private:
     void _realloc(SQUnsignedInteger newsize)
     {
         newsize = (newsize > 0)?newsize:4;
-        _vals = (T*)SQ_REALLOC(_vals, _allocated * sizeof(T), newsize * sizeof(T));
+        _vals = (T*)SQ_SSREALLOC(_owner, _vals, _allocated * sizeof(T), newsize * sizeof(T));
         _allocated = newsize;
     }
     SQUnsignedInteger _size;
     SQUnsignedInteger _allocated;
+    SQSharedState *_owner;
 };
 
 #endif //_SQUTILS_H_
@@ -13,6 +13,15 @@
 #include "squserdata.h"
 #include "sqarray.h"
 #include "sqclass.h"
+#include "sqjit.h"
+
+#ifdef SQ_USE_COMPUTED_GOTO
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wpedantic" //labels as values are a GCC/Clang extension
+#else
+#undef SQ_USE_COMPUTED_GOTO
+#endif
+#endif
 
 #define TOP() (_stack._vals[_top-1])
 #define TARGET _stack._vals[_stackbase+arg0]
@@ -110,6 +119,9 @@ bool SQVM::ARITH_OP(SQUnsignedInteger op,SQObjectPtr &trg,const SQObjectPtr &o1,
 SQVM::SQVM(SQSharedState *ss)
 {
     _sharedstate=ss;
+    _stack.setowner(ss);
+    _callstackdata.setowner(ss);
+    _etraps.setowner(ss);
     _suspended = SQFalse;
     _suspended_target = -1;
     _suspended_root = SQFalse;
@@ -125,7 +137,7 @@ SQVM::SQVM(SQSharedState *ss)
     _openouters = NULL;
     ci = NULL;
     _releasehook = NULL;
-    INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_chain,this);
+    INIT_CHAIN();ADD_TO_CHAIN(&_ss(this)->_gc_young,this);
 }
 
 void SQVM::Finalize()
@@ -148,7 +160,7 @@ void SQVM::Finalize()
 SQVM::~SQVM()
 {
     Finalize();
-    REMOVE_FROM_CHAIN(&_ss(this)->_gc_chain,this);
+    REMOVE_FROM_CHAIN(_gcchain(this),this);
 }
 
 bool SQVM::ArithMetaMethod(SQInteger op,const SQObjectPtr &o1,const SQObjectPtr &o2,SQObjectPtr &dest)
@@ -316,7 +328,7 @@ bool SQVM::ToString(const SQObjectPtr &o,SQObjectPtr &res)
             }
         }
     default:
-        scsprintf(_sp(sq_rsl((sizeof(void*)*2)+NUMBER_MAX_CHAR)),sq_rsl((sizeof(void*)*2)+NUMBER_MAX_CHAR),_SC("(%s : 0x%p)"),GetTypeName(o),(void*)_rawval(o));
+        scsprintf(_sp(sq_rsl((sizeof(void*)*2)+NUMBER_MAX_CHAR)),sq_rsl((sizeof(void*)*2)+NUMBER_MAX_CHAR),_SC("(%s : 0x%p)"),GetTypeName(o),(void*)_refcounted(o));
     }
     res = SQString::Create(_ss(this),_spval);
     return true;
@@ -334,9 +346,15 @@ bool SQVM::StringCat(const SQObjectPtr &str,const SQObjectPtr &obj,SQObjectPtr &
     memcpy(s + l, _stringval(b), sq_rsl(ol));
     dest = SQString::Create(_ss(this), _spval, l + ol);
 #else
-    dest = SQString::Concat(_ss(this),_stringval(a),l,_stringval(b),ol);
+    //s += x on a string only the register of s holds grows it in place, the loops building a string stay linear
+    if(&dest == &str && sq_type(dest) == OT_STRING && _string(a) == _string(dest)
+        && _string(a)->_uiRef == 2 && !_string(a)->_weakref) {
+        a.Null();
+        _ss(this)->_stringtable->Append(dest,_stringval(b),ol);
+    }
+    else dest = SQString::Concat(_ss(this),_stringval(a),l,_stringval(b),ol);
 #endif
-    return true;
+    return SQ_MEMCHECK(_ss(this),this);
 }
 
 bool SQVM::TypeOf(const SQObjectPtr &obj1,SQObjectPtr &dest)
@@ -522,6 +540,40 @@ SQRESULT SQVM::Suspend()
 }
 
 
+SQInteger SQVM::JMPTABLE_OP(const SQInstruction &i,const SQObjectPtr &o)
+{
+    const SQInstruction *slots = &i + 1;
+    SQInteger nslots = JMPTABLE_JUMPS(i) - 1, s = nslots, n = 0;
+    SQObjectType t = sq_type(o);
+    if(t == OT_INTEGER) {
+        n = _integer(o);
+    }
+    else if(t == OT_FLOAT) {
+        //== between a float and an integer label
+        SQFloat f = _float(o);
+        if(f >= -(SQFloat)JMPTABLE_MAXKEY && f <= (SQFloat)JMPTABLE_MAXKEY && f == (SQFloat)(SQInteger)f) {
+            n = (SQInteger)f;
+            t = OT_INTEGER;
+        }
+    }
+    if(i.op == _OP_JMPTABLE) {
+        if(t == OT_INTEGER && (SQUnsignedInteger)n - (SQUnsignedInteger)(SQInteger)i._arg1 < (SQUnsignedInteger)nslots) {
+            s = n - i._arg1;
+        }
+    }
+    else if(t == OT_INTEGER || t == OT_STRING) {
+        SQHash h = t == OT_STRING ? _string(o)->_hash : (SQHash)n;
+        for(SQInteger k = JMPHASH_SLOT(h,i._arg2); JMPHASH_KEY(slots[k]); k = (k + 1) & (nslots - 1)) {
+            const SQObjectPtr &label = ci->_literals[JMPHASH_KEY(slots[k]) - 1];
+            if(sq_type(label) == t && (t == OT_INTEGER ? _integer(label) == n : _streq(_string(label),_string(o)))) {
+                s = k;
+                break;
+            }
+        }
+    }
+    return s + 1 + slots[s]._arg1;
+}
+
 #define _FINISH(howmuchtojump) {jump = howmuchtojump; return true; }
 bool SQVM::FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr
 &o3,SQObjectPtr &o4,SQInteger SQ_UNUSED_ARG(arg_2),int exitpos,int &jump)
@@ -584,11 +636,72 @@ bool SQVM::FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr
 }
 
 #define COND_LITERAL (arg3!=0?ci->_literals[arg1]:STK(arg1))
+#define FORLOOP_BOUND ((arg1 & FORLOOP_LITERAL)?ci->_literals[arg2]:STK(arg2))
 
 #define SQ_THROW() { goto exception_trap; }
 
 #define _GUARD(exp) { if(!exp) { SQ_THROW();} }
 
+#ifdef SQ_JIT
+//continues the current function in native code once it is hot(not while debugging)
+#define SQ_JIT_ENTER() { \
+    if(!_debughook) { \
+        SQFunctionProto *jf = _closure(ci->_closure)->_function; \
+        if(!jf->_jitcode && ++jf->_jithotness == SQ_JIT_THRESHOLD) jf->_jitcode = sq_jit_compile(this,jf); \
+        if(jf->_jitcode && sq_jit_run(this,jf->_jitcode,ci->_ip,&_stack._vals[_stackbase]) == SQ_JIT_THROW) SQ_THROW(); \
+    } \
+}
+#else
+#define SQ_JIT_ENTER() {}
+#endif
+
+#define _i_ (*_pi_)
+
+//rewrites the executing instruction into its int-int/float-float variant
+#define _QUICKEN(o1,o2,iop,fop) { \
+    SQInteger qmask = sq_type(o1)|sq_type(o2); \
+    if(qmask == OT_INTEGER) (ci->_ip-1)->op = iop; \
+    else if(qmask == OT_FLOAT) (ci->_ip-1)->op = fop; \
+}
+
+#define _DEQUICKEN(op_) { (ci->_ip-1)->op = op_; }
+
+#define _ARITH_QUICK(op,gop,trg,o1,o2) \
+{ \
+    if((sq_type(o1)|sq_type(o2)) == OT_INTEGER) { trg = _integer(o1) op _integer(o2); } \
+    else { _DEQUICKEN(gop); _ARITH_(op,trg,o1,o2); } \
+}
+
+#define _ARITH_QUICKF(op,gop,trg,o1,o2) \
+{ \
+    if((sq_type(o1)|sq_type(o2)) == OT_FLOAT) { trg = _float(o1) op _float(o2); } \
+    else { _DEQUICKEN(gop); _ARITH_(op,trg,o1,o2); } \
+}
+
+//same results of ObjCmp() for two integers or two floats
+#define _INTCMP(o1,o2) (_integer(o1) == _integer(o2) ? 0 : (_integer(o1) < _integer(o2) ? -1 : 1))
+#define _FLOATCMP(o1,o2) (_rawval(o1) == _rawval(o2) ? 0 : (_float(o1) < _float(o2) ? -1 : 1))
+
+#define _CMP_RES(cmpop,r,res) { \
+    switch(cmpop) { \
+        case CMP_G: res = (r > 0); break; \
+        case CMP_GE: res = (r >= 0); break; \
+        case CMP_L: res = (r < 0); break; \
+        case CMP_LE: res = (r <= 0); break; \
+        default: res = r; break; \
+    } \
+}
+
+#ifdef SQ_USE_COMPUTED_GOTO
+//every handler fetches and jumps to the next one through _dispatch_table;
+//the jump does not run destructors, so SQObjectPtr locals must be out of scope
+#define SQ_OPCODE(op) case op: L##op
+#define SQ_DISPATCH() { _pi_ = ci->_ip++; goto *_dispatch_table[_i_.op]; }
+#else
+#define SQ_OPCODE(op) case op
+#define SQ_DISPATCH() continue
+#endif
+
 bool SQVM::CLOSURE_OP(SQObjectPtr &target, SQFunctionProto *func,SQInteger boundtarget)
 {
     SQInteger nouters;
@@ -665,6 +778,9 @@ bool SQVM::IsEqual(const SQObjectPtr &o1,const SQObjectPtr &o2,bool &res)
 		if (t1 == OT_FLOAT) {
 			res = (_float(o1) == _float(o2));
 		}
+		else if (t1 == OT_STRING) {
+			res = _streq(_string(o1),_string(o2));
+		}
 		else {
 			res = (_rawval(o1) == _rawval(o2));
 		}
@@ -684,7 +800,7 @@ bool SQVM::IsFalse(SQObjectPtr &o)
 {
     if(((sq_type(o) & SQOBJECT_CANBEFALSE)
         && ( ((sq_type(o) == OT_FLOAT) && (_float(o) == SQFloat(0.0))) ))
-#if !defined(SQUSEDOUBLE) || (defined(SQUSEDOUBLE) && defined(_SQ64))
+#if (!defined(SQUSEDOUBLE) || (defined(SQUSEDOUBLE) && defined(_SQ64))) && !defined(SQ_NANBOXING)
         || (_integer(o) == 0) )  //OT_NULL|OT_INTEGER|OT_BOOL
 #else
         || (((sq_type(o) != OT_FLOAT) && (_integer(o) == 0))) )  //OT_NULL|OT_INTEGER|OT_BOOL
@@ -694,6 +810,55 @@ bool SQVM::IsFalse(SQObjectPtr &o)
     }
     return false;
 }
+//the cache of the instruction being executed; a hit skips the lookup in _class->_members
+bool SQVM::InlineCacheGet(SQInstance *inst,const SQObjectPtr &key,SQObjectPtr &dest)
+{
+    SQInlineCache *ic = _closure(ci->_closure)->_function->GetInlineCache(ci->_ip - 1);
+    SQClass *c = inst->_class;
+    SQInteger member;
+    if(!ic) return false;
+    if(!ic->Lookup(c->_classid,key,member)) {
+        SQObjectPtr idx;
+        if(sq_type(key) != OT_STRING || !c->_members->Get(key,idx)) return false;
+        member = _integer(idx);
+        ic->Fill(c->_classid,key,member);
+    }
+    if(member & MEMBER_TYPE_FIELD) {
+        SQObjectPtr &o = inst->_values[member & MEMBER_MAX_COUNT];
+        dest = _realval(o);
+    }
+    else {
+        dest = c->_methods[member & MEMBER_MAX_COUNT].val;
+    }
+    return true;
+}
+
+//same for a table(the root table of the global variables mostly), a hit is a key compare
+//at the position the site found the key the last time. A deleted key or another table
+//just make it look the key up again
+bool SQVM::InlineCacheGetTable(SQTable *t,const SQObjectPtr &key,SQObjectPtr &dest)
+{
+    if(sq_type(key) != OT_STRING) return false;
+    SQInlineCache *ic = _closure(ci->_closure)->_function->GetInlineCache(ci->_ip - 1);
+    return ic && t->GetSlot(key,ic->_tableslot,dest);
+}
+
+bool SQVM::InlineCacheSet(SQInstance *inst,const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    SQInlineCache *ic = _closure(ci->_closure)->_function->GetInlineCache(ci->_ip - 1);
+    SQClass *c = inst->_class;
+    SQInteger member;
+    if(!ic) return false;
+    if(!ic->Lookup(c->_classid,key,member)) {
+        SQObjectPtr idx;
+        if(sq_type(key) != OT_STRING || !c->_members->Get(key,idx) || !_isfield(idx)) return false;
+        member = _integer(idx);
+        ic->Fill(c->_classid,key,member);
+    }
+    inst->_values[member & MEMBER_MAX_COUNT] = val;
+    return true;
+}
+
 extern SQInstructionDesc g_InstrDesc[];
 bool SQVM::Execute(SQObjectPtr &closure, SQInteger nargs, SQInteger stackbase,SQObjectPtr &outres, SQBool raiseerror,ExecutionType et)
 {
@@ -716,6 +881,7 @@ bool SQVM::Execute(SQObjectPtr &closure, SQInteger nargs, SQInteger stackbase,SQ
                 return true;
             }
             ci->_root = SQTrue;
+            SQ_JIT_ENTER();
                       }
             break;
         case ET_RESUME_GENERATOR: 
@@ -734,27 +900,55 @@ bool SQVM::Execute(SQObjectPtr &closure, SQInteger nargs, SQInteger stackbase,SQ
             break;
     }
 
+#ifdef SQ_USE_COMPUTED_GOTO
+    //must follow the order of SQOpcode(see sqopcodes.h)
+    static const void * const _dispatch_table[] = {
+        &&L_OP_LINE, &&L_OP_LOAD, &&L_OP_LOADINT, &&L_OP_LOADFLOAT,
+        &&L_OP_DLOAD, &&L_OP_TAILCALL, &&L_OP_CALL, &&L_OP_PREPCALL,
+        &&L_OP_PREPCALLK, &&L_OP_GETK, &&L_OP_MOVE, &&L_OP_NEWSLOT,
+        &&L_OP_DELETE, &&L_OP_SET, &&L_OP_GET, &&L_OP_EQ,
+        &&L_OP_NE, &&L_OP_ADD, &&L_OP_SUB, &&L_OP_MUL,
+        &&L_OP_DIV, &&L_OP_MOD, &&L_OP_BITW, &&L_OP_RETURN,
+        &&L_OP_LOADNULLS, &&L_OP_LOADROOT, &&L_OP_LOADBOOL, &&L_OP_DMOVE,
+        &&L_OP_JMP, &&L_OP_JCMP, &&L_OP_JZ, &&L_OP_SETOUTER,
+        &&L_OP_GETOUTER, &&L_OP_NEWOBJ, &&L_OP_APPENDARRAY, &&L_OP_COMPARITH,
+        &&L_OP_INC, &&L_OP_INCL, &&L_OP_PINC, &&L_OP_PINCL,
+        &&L_OP_CMP, &&L_OP_EXISTS, &&L_OP_INSTANCEOF, &&L_OP_AND,
+        &&L_OP_OR, &&L_OP_NEG, &&L_OP_NOT, &&L_OP_BWNOT,
+        &&L_OP_CLOSURE, &&L_OP_YIELD, &&L_OP_RESUME, &&L_OP_FOREACH,
+        &&L_OP_POSTFOREACH, &&L_OP_CLONE, &&L_OP_TYPEOF, &&L_OP_PUSHTRAP,
+        &&L_OP_POPTRAP, &&L_OP_THROW, &&L_OP_NEWSLOTA, &&L_OP_GETBASE,
+        &&L_OP_CLOSE, &&L_OP_ADDI, &&L_OP_ADDF, &&L_OP_SUBI,
+        &&L_OP_SUBF, &&L_OP_MULI, &&L_OP_MULF, &&L_OP_CMPI,
+        &&L_OP_CMPF, &&L_OP_JCMPI, &&L_OP_JCMPF, &&L_OP_FORLOOP,
+        &&L_OP_JMPTABLE, &&L_OP_JMPHASH
+    };
+#endif
+
 exception_restore:
     //
     {
         for(;;)
         {
-            const SQInstruction &_i_ = *ci->_ip++;
+            const SQInstruction *_pi_ = ci->_ip++;
             //dumpstack(_stackbase);
             //scprintf("\n[%d] %s %d %d %d %d\n",ci->_ip-_closure(ci->_closure)->_function->_instructions,g_InstrDesc[_i_.op].name,arg0,arg1,arg2,arg3);
+#ifdef SQ_USE_COMPUTED_GOTO
+            goto *_dispatch_table[_i_.op];
+#endif
             switch(_i_.op)
             {
-            case _OP_LINE: if (_debughook) CallDebugHook(_SC('l'),arg1); continue;
-            case _OP_LOAD: TARGET = ci->_literals[arg1]; continue;
-            case _OP_LOADINT:
+            SQ_OPCODE(_OP_LINE): if (_debughook) CallDebugHook(_SC('l'),arg1); SQ_DISPATCH();
+            SQ_OPCODE(_OP_LOAD): TARGET = ci->_literals[arg1]; SQ_DISPATCH();
+            SQ_OPCODE(_OP_LOADINT):
 #ifndef _SQ64
-                TARGET = (SQInteger)arg1; continue;
+                TARGET = (SQInteger)arg1; SQ_DISPATCH();
 #else
-                TARGET = (SQInteger)((SQInt32)arg1); continue;
+                TARGET = (SQInteger)((SQInt32)arg1); SQ_DISPATCH();
 #endif
-            case _OP_LOADFLOAT: TARGET = *((const SQFloat *)&arg1); continue;
-            case _OP_DLOAD: TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];continue;
-            case _OP_TAILCALL:{
+            SQ_OPCODE(_OP_LOADFLOAT): TARGET = *((const SQFloat *)&arg1); SQ_DISPATCH();
+            SQ_OPCODE(_OP_DLOAD): TARGET = ci->_literals[arg1]; STK(arg2) = ci->_literals[arg3];SQ_DISPATCH();
+            SQ_OPCODE(_OP_TAILCALL):{
                 SQObjectPtr &t = STK(arg1);
                 if (sq_type(t) == OT_CLOSURE
                     && (!_closure(t)->_function->_bgenerator)){
@@ -766,15 +960,16 @@ exception_restore:
                     if (last_top >= _top) {
                         _top = last_top;
                     }
-                    continue;
+                    SQ_JIT_ENTER();
+                    continue; //a computed goto would skip the destructor of clo
                 }
                               }
-            case _OP_CALL: {
+            SQ_OPCODE(_OP_CALL): {
                     SQObjectPtr clo = STK(arg1);
                     switch (sq_type(clo)) {
                     case OT_CLOSURE:
                         _GUARD(StartCall(_closure(clo), sarg0, arg3, _stackbase+arg2, false));
-                        continue;
+                        break;
                     case OT_NATIVECLOSURE: {
                         bool suspend;
 						bool tailcall;
@@ -790,8 +985,9 @@ exception_restore:
                         if(sarg0 != -1 && !tailcall) {
                             STK(arg0) = clo;
                         }
+                        _GUARD(SQ_MEMCHECK(_ss(this),this));
                                            }
-                        continue;
+                        break;
                     case OT_CLASS:{
                         SQObjectPtr inst;
                         _GUARD(CreateClassInstance(_class(clo),inst,clo));
@@ -837,53 +1033,69 @@ exception_restore:
                         SQ_THROW();
                     }
                 }
-                  continue;
-            case _OP_PREPCALL:
-            case _OP_PREPCALLK: {
+                  SQ_JIT_ENTER();
+                  SQ_DISPATCH();
+            SQ_OPCODE(_OP_PREPCALL):
+            SQ_OPCODE(_OP_PREPCALLK): {
                     SQObjectPtr &key = _i_.op == _OP_PREPCALLK?(ci->_literals)[arg1]:STK(arg1);
                     SQObjectPtr &o = STK(arg2);
-                    if (!Get(o, key, temp_reg,0,arg2)) {
-                        SQ_THROW();
+                    if (sq_type(o) == OT_INSTANCE ? !InlineCacheGet(_instance(o), key, temp_reg)
+                        : sq_type(o) != OT_TABLE || !InlineCacheGetTable(_table(o), key, temp_reg)) {
+                        if (!Get(o, key, temp_reg,0,arg2)) {
+                            SQ_THROW();
+                        }
                     }
                     STK(arg3) = o;
                     _Swap(TARGET,temp_reg);//TARGET = temp_reg;
                 }
-                continue;
-            case _OP_GETK:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_GETK):
+                if (sq_type(STK(arg2)) == OT_INSTANCE && InlineCacheGet(_instance(STK(arg2)), ci->_literals[arg1], TARGET)) SQ_DISPATCH();
+                if (sq_type(STK(arg2)) == OT_TABLE && InlineCacheGetTable(_table(STK(arg2)), ci->_literals[arg1], TARGET)) SQ_DISPATCH();
                 if (!Get(STK(arg2), ci->_literals[arg1], temp_reg, 0,arg2)) { SQ_THROW();}
                 _Swap(TARGET,temp_reg);//TARGET = temp_reg;
-                continue;
-            case _OP_MOVE: TARGET = STK(arg1); continue;
-            case _OP_NEWSLOT:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_MOVE): TARGET = STK(arg1); SQ_DISPATCH();
+            SQ_OPCODE(_OP_NEWSLOT):
                 _GUARD(NewSlot(STK(arg1), STK(arg2), STK(arg3),false));
+                _GUARD(SQ_MEMCHECK(_ss(this),this));
                 if(arg0 != 0xFF) TARGET = STK(arg3);
-                continue;
-            case _OP_DELETE: _GUARD(DeleteSlot(STK(arg1), STK(arg2), TARGET)); continue;
-            case _OP_SET:
-                if (!Set(STK(arg1), STK(arg2), STK(arg3),arg1)) { SQ_THROW(); }
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_DELETE): _GUARD(DeleteSlot(STK(arg1), STK(arg2), TARGET)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_SET):
+                if (sq_type(STK(arg1)) != OT_INSTANCE || !InlineCacheSet(_instance(STK(arg1)), STK(arg2), STK(arg3))) {
+                    if (!Set(STK(arg1), STK(arg2), STK(arg3),arg1)) { SQ_THROW(); }
+                }
                 if (arg0 != 0xFF) TARGET = STK(arg3);
-                continue;
-            case _OP_GET:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_GET):
+                if (sq_type(STK(arg1)) == OT_INSTANCE && InlineCacheGet(_instance(STK(arg1)), STK(arg2), TARGET)) SQ_DISPATCH();
                 if (!Get(STK(arg1), STK(arg2), temp_reg, 0,arg1)) { SQ_THROW(); }
                 _Swap(TARGET,temp_reg);//TARGET = temp_reg;
-                continue;
-            case _OP_EQ:{
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_EQ):{
                 bool res;
                 if(!IsEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
                 TARGET = res?true:false;
-                }continue;
-            case _OP_NE:{
+                }SQ_DISPATCH();
+            SQ_OPCODE(_OP_NE):{
                 bool res;
                 if(!IsEqual(STK(arg2),COND_LITERAL,res)) { SQ_THROW(); }
                 TARGET = (!res)?true:false;
-                } continue;
-            case _OP_ADD: _ARITH_(+,TARGET,STK(arg2),STK(arg1)); continue;
-            case _OP_SUB: _ARITH_(-,TARGET,STK(arg2),STK(arg1)); continue;
-            case _OP_MUL: _ARITH_(*,TARGET,STK(arg2),STK(arg1)); continue;
-            case _OP_DIV: _ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),_SC("division by zero")); continue;
-            case _OP_MOD: ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); continue;
-            case _OP_BITW:  _GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); continue;
-            case _OP_RETURN:
+                } SQ_DISPATCH();
+            SQ_OPCODE(_OP_ADD):
+                _QUICKEN(STK(arg2),STK(arg1),_OP_ADDI,_OP_ADDF);
+                _ARITH_(+,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_SUB):
+                _QUICKEN(STK(arg2),STK(arg1),_OP_SUBI,_OP_SUBF);
+                _ARITH_(-,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_MUL):
+                _QUICKEN(STK(arg2),STK(arg1),_OP_MULI,_OP_MULF);
+                _ARITH_(*,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_DIV): _ARITH_NOZERO(/,TARGET,STK(arg2),STK(arg1),_SC("division by zero")); SQ_DISPATCH();
+            SQ_OPCODE(_OP_MOD): ARITH_OP('%',TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_BITW):  _GUARD(BW_OP( arg3,TARGET,STK(arg2),STK(arg1))); SQ_DISPATCH();
+            SQ_OPCODE(_OP_RETURN):
                 if((ci)->_generator) {
                     (ci)->_generator->Kill();
                 }
@@ -893,9 +1105,9 @@ exception_restore:
                     _Swap(outres,temp_reg);
                     return true;
                 }
-                continue;
-            case _OP_LOADNULLS:{ for(SQInt32 n=0; n < arg1; n++) STK(arg0+n).Null(); }continue;
-            case _OP_LOADROOT:  {
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_LOADNULLS):{ for(SQInt32 n=0; n < arg1; n++) STK(arg0+n).Null(); }SQ_DISPATCH();
+            SQ_OPCODE(_OP_LOADROOT):  {
                 SQWeakRef *w = _closure(ci->_closure)->_root;
                 if(sq_type(w->_obj) != OT_NULL) {
                     TARGET = w->_obj;
@@ -903,23 +1115,27 @@ exception_restore:
                     TARGET = _roottable; //shoud this be like this? or null
                 }
                                 }
-                continue;
-            case _OP_LOADBOOL: TARGET = arg1?true:false; continue;
-            case _OP_DMOVE: STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); continue;
-            case _OP_JMP: ci->_ip += (sarg1); continue;
-            //case _OP_JNZ: if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-            case _OP_JCMP:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_LOADBOOL): TARGET = arg1?true:false; SQ_DISPATCH();
+            SQ_OPCODE(_OP_DMOVE): STK(arg0) = STK(arg1); STK(arg2) = STK(arg3); SQ_DISPATCH();
+            SQ_OPCODE(_OP_JMP):
+                ci->_ip += (sarg1);
+                if(sarg1 < 0) SQ_JIT_ENTER();
+                SQ_DISPATCH();
+            //case _OP_JNZ: if(!IsFalse(STK(arg0))) ci->_ip+=(sarg1); SQ_DISPATCH();
+            SQ_OPCODE(_OP_JCMP):
+                _QUICKEN(STK(arg2),STK(arg0),_OP_JCMPI,_OP_JCMPF);
                 _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
                 if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
-                continue;
-            case _OP_JZ: if(IsFalse(STK(arg0))) ci->_ip+=(sarg1); continue;
-            case _OP_GETOUTER: {
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_JZ): if(IsFalse(STK(arg0))) ci->_ip+=(sarg1); SQ_DISPATCH();
+            SQ_OPCODE(_OP_GETOUTER): {
                 SQClosure *cur_cls = _closure(ci->_closure);
                 SQOuter *otr = _outer(cur_cls->_outervalues[arg1]);
                 TARGET = *(otr->_valptr);
                 }
-            continue;
-            case _OP_SETOUTER: {
+            SQ_DISPATCH();
+            SQ_OPCODE(_OP_SETOUTER): {
                 SQClosure *cur_cls = _closure(ci->_closure);
                 SQOuter   *otr = _outer(cur_cls->_outervalues[arg1]);
                 *(otr->_valptr) = STK(arg2);
@@ -927,108 +1143,109 @@ exception_restore:
                     TARGET = STK(arg2);
                 }
                 }
-            continue;
-            case _OP_NEWOBJ:
+            SQ_DISPATCH();
+            SQ_OPCODE(_OP_NEWOBJ):
                 switch(arg3) {
-                    case NOT_TABLE: TARGET = SQTable::Create(_ss(this), arg1); continue;
-                    case NOT_ARRAY: TARGET = SQArray::Create(_ss(this), 0); _array(TARGET)->Reserve(arg1); continue;
-                    case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); continue;
-                    default: assert(0); continue;
+                    case NOT_TABLE: TARGET = SQTable::Create(_ss(this), arg1); break;
+                    case NOT_ARRAY: TARGET = SQArray::Create(_ss(this), 0); _array(TARGET)->Reserve(arg1); break;
+                    case NOT_CLASS: _GUARD(CLASS_OP(TARGET,arg1,arg2)); break;
+                    default: assert(0); break;
                 }
-            case _OP_APPENDARRAY:
+                _GUARD(SQ_MEMCHECK(_ss(this),this));
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_APPENDARRAY):
                 {
                     SQObject val;
-                    val._unVal.raw = 0;
                 switch(arg2) {
                 case AAT_STACK:
                     val = STK(arg1); break;
                 case AAT_LITERAL:
                     val = ci->_literals[arg1]; break;
                 case AAT_INT:
-                    val._type = OT_INTEGER;
 #ifndef _SQ64
-                    val._unVal.nInteger = (SQInteger)arg1;
+                    _setinteger(val,(SQInteger)arg1);
 #else
-                    val._unVal.nInteger = (SQInteger)((SQInt32)arg1);
+                    _setinteger(val,(SQInteger)((SQInt32)arg1));
 #endif
                     break;
                 case AAT_FLOAT:
-                    val._type = OT_FLOAT;
-                    val._unVal.fFloat = *((const SQFloat *)&arg1);
+                    _setfloat(val,*((const SQFloat *)&arg1));
                     break;
                 case AAT_BOOL:
-                    val._type = OT_BOOL;
-                    val._unVal.nInteger = arg1;
+                    _setbool(val,arg1);
                     break;
-                default: val._type = OT_INTEGER; assert(0); break;
+                default: _setinteger(val,0); assert(0); break;
 
                 }
-                _array(STK(arg0))->Append(val); continue;
+                _array(STK(arg0))->Append(val); SQ_DISPATCH();
                 }
-            case _OP_COMPARITH: {
+            SQ_OPCODE(_OP_COMPARITH): {
                 SQInteger selfidx = (((SQUnsignedInteger)arg1&0xFFFF0000)>>16);
                 _GUARD(DerefInc(arg3, TARGET, STK(selfidx), STK(arg2), STK(arg1&0x0000FFFF), false, selfidx));
                                 }
-                continue;
-            case _OP_INC: {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} continue;
-            case _OP_INCL: {
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_INC): {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, false, arg1));} SQ_DISPATCH();
+            SQ_OPCODE(_OP_INCL): {
                 SQObjectPtr &a = STK(arg1);
                 if(sq_type(a) == OT_INTEGER) {
-                    a._unVal.nInteger = _integer(a) + sarg3;
+                    _setinteger(a,_integer(a) + sarg3);
                 }
                 else {
                     SQObjectPtr o(sarg3); //_GUARD(LOCAL_INC('+',TARGET, STK(arg1), o));
                     _ARITH_(+,a,a,o);
                 }
-                           } continue;
-            case _OP_PINC: {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} continue;
-            case _OP_PINCL: {
+                           } SQ_DISPATCH();
+            SQ_OPCODE(_OP_PINC): {SQObjectPtr o(sarg3); _GUARD(DerefInc('+',TARGET, STK(arg1), STK(arg2), o, true, arg1));} SQ_DISPATCH();
+            SQ_OPCODE(_OP_PINCL): {
                 SQObjectPtr &a = STK(arg1);
                 if(sq_type(a) == OT_INTEGER) {
                     TARGET = a;
-                    a._unVal.nInteger = _integer(a) + sarg3;
+                    _setinteger(a,_integer(a) + sarg3);
                 }
                 else {
                     SQObjectPtr o(sarg3); _GUARD(PLOCAL_INC('+',TARGET, STK(arg1), o));
                 }
 
-                        } continue;
-            case _OP_CMP:   _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))  continue;
-            case _OP_EXISTS: TARGET = Get(STK(arg1), STK(arg2), temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false; continue;
-            case _OP_INSTANCEOF:
+                        } SQ_DISPATCH();
+            SQ_OPCODE(_OP_CMP):
+                _QUICKEN(STK(arg2),STK(arg1),_OP_CMPI,_OP_CMPF);
+                _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET))  SQ_DISPATCH();
+            SQ_OPCODE(_OP_EXISTS): TARGET = Get(STK(arg1), STK(arg2), temp_reg, GET_FLAG_DO_NOT_RAISE_ERROR | GET_FLAG_RAW, DONT_FALL_BACK) ? true : false; SQ_DISPATCH();
+            SQ_OPCODE(_OP_INSTANCEOF):
                 if(sq_type(STK(arg1)) != OT_CLASS)
                 {Raise_Error(_SC("cannot apply instanceof between a %s and a %s"),GetTypeName(STK(arg1)),GetTypeName(STK(arg2))); SQ_THROW();}
                 TARGET = (sq_type(STK(arg2)) == OT_INSTANCE) ? (_instance(STK(arg2))->InstanceOf(_class(STK(arg1)))?true:false) : false;
-                continue;
-            case _OP_AND:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_AND):
                 if(IsFalse(STK(arg2))) {
                     TARGET = STK(arg2);
                     ci->_ip += (sarg1);
                 }
-                continue;
-            case _OP_OR:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_OR):
                 if(!IsFalse(STK(arg2))) {
                     TARGET = STK(arg2);
                     ci->_ip += (sarg1);
                 }
-                continue;
-            case _OP_NEG: _GUARD(NEG_OP(TARGET,STK(arg1))); continue;
-            case _OP_NOT: TARGET = IsFalse(STK(arg1)); continue;
-            case _OP_BWNOT:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_NEG): _GUARD(NEG_OP(TARGET,STK(arg1))); SQ_DISPATCH();
+            SQ_OPCODE(_OP_NOT): TARGET = IsFalse(STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_BWNOT):
                 if(sq_type(STK(arg1)) == OT_INTEGER) {
                     SQInteger t = _integer(STK(arg1));
                     TARGET = SQInteger(~t);
-                    continue;
+                    SQ_DISPATCH();
                 }
                 Raise_Error(_SC("attempt to perform a bitwise op on a %s"), GetTypeName(STK(arg1)));
                 SQ_THROW();
-            case _OP_CLOSURE: {
-                SQClosure *c = ci->_closure._unVal.pClosure;
+            SQ_OPCODE(_OP_CLOSURE): {
+                SQClosure *c = _closure(ci->_closure);
                 SQFunctionProto *fp = c->_function;
-                if(!CLOSURE_OP(TARGET,fp->_functions[arg1]._unVal.pFunctionProto,arg2)) { SQ_THROW(); }
-                continue;
+                if(!CLOSURE_OP(TARGET,_funcproto(fp->_functions[arg1]),arg2)) { SQ_THROW(); }
+                _GUARD(SQ_MEMCHECK(_ss(this),this));
+                SQ_DISPATCH();
             }
-            case _OP_YIELD:{
+            SQ_OPCODE(_OP_YIELD):{
                 if(ci->_generator) {
                     if(sarg1 != MAX_FUNC_STACKSIZE) temp_reg = STK(arg1);
 					if (_openouters) CloseOuters(&_stack._vals[_stackbase]);
@@ -1044,41 +1261,42 @@ exception_restore:
                 }
 
                 }
-                continue;
-            case _OP_RESUME:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_RESUME):
                 if(sq_type(STK(arg1)) != OT_GENERATOR){ Raise_Error(_SC("trying to resume a '%s',only genenerator can be resumed"), GetTypeName(STK(arg1))); SQ_THROW();}
                 _GUARD(_generator(STK(arg1))->Resume(this, TARGET));
                 traps += ci->_etraps;
-                continue;
-            case _OP_FOREACH:{ int tojump;
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_FOREACH):{ int tojump;
                 _GUARD(FOREACH_OP(STK(arg0),STK(arg2),STK(arg2+1),STK(arg2+2),arg2,sarg1,tojump));
                 ci->_ip += tojump; }
-                continue;
-            case _OP_POSTFOREACH:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_POSTFOREACH):
                 assert(sq_type(STK(arg0)) == OT_GENERATOR);
                 if(_generator(STK(arg0))->_state == SQGenerator::eDead)
                     ci->_ip += (sarg1 - 1);
-                continue;
-            case _OP_CLONE: _GUARD(Clone(STK(arg1), TARGET)); continue;
-            case _OP_TYPEOF: _GUARD(TypeOf(STK(arg1), TARGET)) continue;
-            case _OP_PUSHTRAP:{
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_CLONE): _GUARD(Clone(STK(arg1), TARGET)); _GUARD(SQ_MEMCHECK(_ss(this),this)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_TYPEOF): _GUARD(TypeOf(STK(arg1), TARGET)) SQ_DISPATCH();
+            SQ_OPCODE(_OP_PUSHTRAP):{
                 SQInstruction *_iv = _closure(ci->_closure)->_function->_instructions;
                 _etraps.push_back(SQExceptionTrap(_top,_stackbase, &_iv[(ci->_ip-_iv)+arg1], arg0)); traps++;
                 ci->_etraps++;
                               }
-                continue;
-            case _OP_POPTRAP: {
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_POPTRAP): {
                 for(SQInteger i = 0; i < arg0; i++) {
                     _etraps.pop_back(); traps--;
                     ci->_etraps--;
                 }
                               }
-                continue;
-            case _OP_THROW: Raise_Error(TARGET); SQ_THROW(); continue;
-            case _OP_NEWSLOTA:
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_THROW): Raise_Error(TARGET); SQ_THROW(); SQ_DISPATCH();
+            SQ_OPCODE(_OP_NEWSLOTA):
                 _GUARD(NewSlotA(STK(arg1),STK(arg2),STK(arg3),(arg0&NEW_SLOT_ATTRIBUTES_FLAG) ? STK(arg2-1) : SQObjectPtr(),(arg0&NEW_SLOT_STATIC_FLAG)?true:false,false));
-                continue;
-            case _OP_GETBASE:{
+                _GUARD(SQ_MEMCHECK(_ss(this),this));
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_GETBASE):{
                 SQClosure *clo = _closure(ci->_closure);
                 if(clo->_base) {
                     TARGET = clo->_base;
@@ -1086,11 +1304,81 @@ exception_restore:
                 else {
                     TARGET.Null();
                 }
-                continue;
+                SQ_DISPATCH();
             }
-            case _OP_CLOSE:
+            SQ_OPCODE(_OP_CLOSE):
                 if(_openouters) CloseOuters(&(STK(arg1)));
-                continue;
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_ADDI): _ARITH_QUICK(+,_OP_ADD,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_ADDF): _ARITH_QUICKF(+,_OP_ADD,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_SUBI): _ARITH_QUICK(-,_OP_SUB,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_SUBF): _ARITH_QUICKF(-,_OP_SUB,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_MULI): _ARITH_QUICK(*,_OP_MUL,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_MULF): _ARITH_QUICKF(*,_OP_MUL,TARGET,STK(arg2),STK(arg1)); SQ_DISPATCH();
+            SQ_OPCODE(_OP_CMPI):
+                if((sq_type(STK(arg2))|sq_type(STK(arg1))) == OT_INTEGER) {
+                    SQInteger r = _INTCMP(STK(arg2),STK(arg1));
+                    _CMP_RES(arg3,r,TARGET);
+                    SQ_DISPATCH();
+                }
+                _DEQUICKEN(_OP_CMP);
+                _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET)) SQ_DISPATCH();
+            SQ_OPCODE(_OP_CMPF):
+                if((sq_type(STK(arg2))|sq_type(STK(arg1))) == OT_FLOAT) {
+                    SQInteger r = _FLOATCMP(STK(arg2),STK(arg1));
+                    _CMP_RES(arg3,r,TARGET);
+                    SQ_DISPATCH();
+                }
+                _DEQUICKEN(_OP_CMP);
+                _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg1),TARGET)) SQ_DISPATCH();
+            SQ_OPCODE(_OP_JCMPI):
+                if((sq_type(STK(arg2))|sq_type(STK(arg0))) == OT_INTEGER) {
+                    SQInteger r = _INTCMP(STK(arg2),STK(arg0));
+                    bool res;
+                    _CMP_RES(arg3,r,res);
+                    if(!res) ci->_ip+=(sarg1);
+                    SQ_DISPATCH();
+                }
+                _DEQUICKEN(_OP_JCMP);
+                _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
+                if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_JCMPF):
+                if((sq_type(STK(arg2))|sq_type(STK(arg0))) == OT_FLOAT) {
+                    SQInteger r = _FLOATCMP(STK(arg2),STK(arg0));
+                    bool res;
+                    _CMP_RES(arg3,r,res);
+                    if(!res) ci->_ip+=(sarg1);
+                    SQ_DISPATCH();
+                }
+                _DEQUICKEN(_OP_JCMP);
+                _GUARD(CMP_OP((CmpOP)arg3,STK(arg2),STK(arg0),temp_reg));
+                if(IsFalse(temp_reg)) ci->_ip+=(sarg1);
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_FORLOOP): {
+                bool res;
+                SQObjectPtr &a = STK(arg0);
+                if((sq_type(a)|sq_type(FORLOOP_BOUND)) == OT_INTEGER) {
+                    _setinteger(a,_integer(a) + sarg3);
+                    SQInteger r = _INTCMP(a,FORLOOP_BOUND);
+                    _CMP_RES(FORLOOP_CMP(arg1),r,res);
+                }
+                else {
+                    if(arg1 & FORLOOP_SUB) { SQObjectPtr o(-sarg3); _ARITH_(-,a,a,o); }
+                    else { SQObjectPtr o(sarg3); _ARITH_(+,a,a,o); }
+                    _GUARD(CMP_OP(FORLOOP_CMP(arg1),STK(arg0),FORLOOP_BOUND,temp_reg));
+                    res = !IsFalse(temp_reg);
+                }
+                if(res) {
+                    ci->_ip += FORLOOP_JUMP(sarg1);
+                    SQ_JIT_ENTER();
+                }
+                }
+                SQ_DISPATCH();
+            SQ_OPCODE(_OP_JMPTABLE):
+            SQ_OPCODE(_OP_JMPHASH):
+                ci->_ip += JMPTABLE_OP(_i_,STK(arg0));
+                SQ_DISPATCH();
             }
 
         }
@@ -72,6 +72,9 @@ public:
     SQInteger FallBackGet(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest);
     bool InvokeDefaultDelegate(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest);
     bool Set(const SQObjectPtr &self, const SQObjectPtr &key, const SQObjectPtr &val, SQInteger selfidx);
+    bool InlineCacheGet(SQInstance *inst,const SQObjectPtr &key,SQObjectPtr &dest);
+    bool InlineCacheGetTable(SQTable *t,const SQObjectPtr &key,SQObjectPtr &dest);
+    bool InlineCacheSet(SQInstance *inst,const SQObjectPtr &key,const SQObjectPtr &val);
     SQInteger FallBackSet(const SQObjectPtr &self,const SQObjectPtr &key,const SQObjectPtr &val);
     bool NewSlot(const SQObjectPtr &self, const SQObjectPtr &key, const SQObjectPtr &val,bool bstatic);
     bool NewSlotA(const SQObjectPtr &self,const SQObjectPtr &key,const SQObjectPtr &val,const SQObjectPtr &attrs,bool bstatic,bool raw);
@@ -107,6 +110,8 @@ public:
     bool CLASS_OP(SQObjectPtr &target,SQInteger base,SQInteger attrs);
     //return true if the loop is finished
     bool FOREACH_OP(SQObjectPtr &o1,SQObjectPtr &o2,SQObjectPtr &o3,SQObjectPtr &o4,SQInteger arg_2,int exitpos,int &jump);
+    //how far from the next instruction the case of o is, for _OP_JMPTABLE and _OP_JMPHASH
+    SQInteger JMPTABLE_OP(const SQInstruction &i,const SQObjectPtr &o);
     //_INLINE bool LOCAL_INC(SQInteger op,SQObjectPtr &target, SQObjectPtr &a, SQObjectPtr &incr);
     _INLINE bool PLOCAL_INC(SQInteger op,SQObjectPtr &target, SQObjectPtr &a, SQObjectPtr &incr);
     _INLINE bool DerefInc(SQInteger op,SQObjectPtr &target, SQObjectPtr &self, SQObjectPtr &key, SQObjectPtr &incr, bool postfix,SQInteger arg0);
@@ -116,6 +121,8 @@ public:
 
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
+    void Traverse(SQGCVISIT visit,void *ud);
+    SQInteger MemSize();
     SQObjectType GetType() {return OT_THREAD;}
 #endif
     void Finalize();
@@ -127,7 +134,7 @@ public:
     }
     bool EnterFrame(SQInteger newbase, SQInteger newtop, bool tailcall);
     void LeaveFrame();
-    void Release(){ sq_delete(this,SQVM); }
+    void Release(){ sq_ssdelete(_sharedstate,this,SQVM); }
 ////////////////////////////////////////////////////////////////////////////
     //stack functions for the api
     void Remove(SQInteger n);